@@ -5,6 +5,523 @@
 #include "servicelib.h"
 #include "resource.h"
 
+//-----------------------------------------------------------------------------
+// Harness checks
+//
+// Run instead of dispatching the service table when /check is specified on the command
+// line; each check reports its measurements with OutputDebugString and returns false if
+// the behavior being checked is broken
+
+// Report
+//
+// Writes a formatted line to the debugger output
+static void Report(const TCHAR* format, ...)
+{
+	TCHAR buffer[512];
+
+	va_list args;
+	va_start(args, format);
+	_vsntprintf_s(buffer, _countof(buffer), _TRUNCATE, format, args);
+	va_end(args);
+
+	OutputDebugString(buffer);
+	OutputDebugString(_T("\r\n"));
+}
+
+// ElapsedMicroseconds
+//
+// Gets the number of microseconds that have elapsed since a point in time
+static uint64_t ElapsedMicroseconds(std::chrono::steady_clock::time_point since)
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count());
+}
+
+// CheckSignal
+//
+// Compares svctl::signal with a Win32 event object, uncontended and between two threads
+static bool CheckSignal(void)
+{
+	const int ITERATIONS = 1000000;
+	const int ROUNDTRIPS = 100000;
+
+	// Uncontended Set/Wait pairs never leave user mode with svctl::signal
+	svctl::signal<svctl::signal_type::AutomaticReset> signal;
+	auto start = std::chrono::steady_clock::now();
+	for(int index = 0; index < ITERATIONS; index++) { signal.Set(); if(!signal.Wait(0)) return false; }
+	uint64_t signalset = ElapsedMicroseconds(start);
+
+	HANDLE event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if(event == nullptr) return false;
+
+	start = std::chrono::steady_clock::now();
+	for(int index = 0; index < ITERATIONS; index++) { SetEvent(event); if(WaitForSingleObject(event, 0) != WAIT_OBJECT_0) { CloseHandle(event); return false; } }
+	uint64_t eventset = ElapsedMicroseconds(start);
+
+	Report(_T("signal: %d uncontended Set/Wait: svctl::signal %llu us, event %llu us"), ITERATIONS, signalset, eventset);
+
+	// Ping-pong between two threads; both primitives have to block here
+	svctl::signal<svctl::signal_type::AutomaticReset> ping, pong;
+	std::thread partner([&]() { for(int index = 0; index < ROUNDTRIPS; index++) { ping.Wait(); pong.Set(); } });
+
+	start = std::chrono::steady_clock::now();
+	for(int index = 0; index < ROUNDTRIPS; index++) { ping.Set(); pong.Wait(); }
+	uint64_t signalpingpong = ElapsedMicroseconds(start);
+	partner.join();
+
+	HANDLE eventping = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if(eventping == nullptr) { CloseHandle(event); return false; }
+
+	partner = std::thread([&]() { for(int index = 0; index < ROUNDTRIPS; index++) { WaitForSingleObject(eventping, INFINITE); SetEvent(event); } });
+
+	start = std::chrono::steady_clock::now();
+	for(int index = 0; index < ROUNDTRIPS; index++) { SetEvent(eventping); WaitForSingleObject(event, INFINITE); }
+	uint64_t eventpingpong = ElapsedMicroseconds(start);
+	partner.join();
+
+	CloseHandle(eventping);
+	CloseHandle(event);
+
+	Report(_T("signal: %d round trips: svctl::signal %llu us, event %llu us"), ROUNDTRIPS, signalpingpong, eventpingpong);
+
+	// WaitAny has to report the signal that satisfied the wait and consume only that one
+	svctl::signal<svctl::signal_type::AutomaticReset> first, second;
+	second.Set();
+	if(svctl::signal_base::WaitAny({ first, second }, 0) != WAIT_OBJECT_0 + 1) return false;
+	if(svctl::signal_base::WaitAny({ first, second }, 0) != WAIT_TIMEOUT) return false;
+
+	return true;
+}
+
+// QuiesceService
+//
+// Service with many worker threads registered with the pause gate
+class QuiesceService : public Service<QuiesceService>
+{
+public:
+
+	static const int WORKERS = 64;
+
+	// Iterations
+	//
+	// Total number of loop iterations executed by the worker threads
+	static std::atomic<uint64_t> Iterations;
+
+	void OnStart(int argc, svctl::tchar_t** argv)
+	{
+		UNREFERENCED_PARAMETER(argc);
+		UNREFERENCED_PARAMETER(argv);
+
+		for(int index = 0; index < WORKERS; index++) m_workers.emplace_back([=]() {
+
+			PauseGate.Register();
+			while(!StopToken.IsCancellationRequested) {
+
+				PauseGate.Pass();
+				Iterations.fetch_add(1);
+				std::this_thread::yield();
+			}
+			PauseGate.Unregister();
+		});
+	}
+
+	void OnPause(void) {}
+	void OnContinue(void) {}
+	void OnStop(void) { for(auto& worker : m_workers) worker.join(); }
+
+	BEGIN_CONTROL_HANDLER_MAP(QuiesceService)
+		CONTROL_HANDLER_ENTRY(ServiceControl::Pause, OnPause)
+		CONTROL_HANDLER_ENTRY(ServiceControl::Continue, OnContinue)
+		CONTROL_HANDLER_ENTRY(ServiceControl::Stop, OnStop)
+	END_CONTROL_HANDLER_MAP()
+
+private:
+
+	std::vector<std::thread> m_workers;
+};
+
+std::atomic<uint64_t> QuiesceService::Iterations;
+
+// CheckQuiesce
+//
+// Measures the time taken for the registered worker threads to park when the service is paused
+static bool CheckQuiesce(void)
+{
+	ServiceHarness<QuiesceService> harness;
+	harness.Start(_T("QuiesceService"));
+
+	// Let every worker get into its loop before pausing
+	Sleep(100);
+
+	auto start = std::chrono::steady_clock::now();
+	harness.Pause();
+	uint64_t quiesce = ElapsedMicroseconds(start);
+
+	// Every registered worker has parked, so none of them can still be iterating
+	uint64_t parked = QuiesceService::Iterations.load();
+	Sleep(100);
+	bool quiesced = (QuiesceService::Iterations.load() == parked);
+
+	start = std::chrono::steady_clock::now();
+	harness.Continue();
+	uint64_t resume = ElapsedMicroseconds(start);
+
+	harness.Stop();
+
+	Report(_T("quiesce: %d workers: pause %llu us, continue %llu us"), QuiesceService::WORKERS, quiesce, resume);
+	return quiesced;
+}
+
+// FlushService
+//
+// Service with PRESHUTDOWN flushes that complete, complete slowly and never complete
+class FlushService : public Service<FlushService>
+{
+public:
+
+	static const uint32_t BUDGET = 1000;
+
+	// Flushed / Abandoned / Elapsed
+	//
+	// Results reported to OnPreShutdownFlushed
+	static std::atomic<uint64_t> Flushed;
+	static std::atomic<uint64_t> Abandoned;
+	static std::atomic<uint32_t> Elapsed;
+
+	void OnStart(int argc, svctl::tchar_t** argv)
+	{
+		UNREFERENCED_PARAMETER(argc);
+		UNREFERENCED_PARAMETER(argv);
+
+		RegisterFlush(10, []() -> uint64_t { return 1000; }, [](const svctl::cancellation_token&, uint32_t) -> uint64_t { return 1000; });
+		RegisterFlush(1, []() -> uint64_t { return 4000; }, [](const svctl::cancellation_token&, uint32_t) -> uint64_t { Sleep(100); return 4000; });
+
+		// This one only returns when its share of the budget has expired and it has been cancelled
+		RegisterFlush(1, []() -> uint64_t { return 5000; }, [](const svctl::cancellation_token& token, uint32_t) -> uint64_t { token.Wait(); return 0; });
+	}
+
+	void OnPreShutdownFlushed(uint64_t flushed, uint64_t abandoned, uint32_t elapsed)
+	{
+		Flushed.store(flushed);
+		Abandoned.store(abandoned);
+		Elapsed.store(elapsed);
+	}
+
+	void OnPause(void) {}
+	void OnContinue(void) {}
+	void OnStop(void) {}
+
+	BEGIN_CONTROL_HANDLER_MAP(FlushService)
+		CONTROL_HANDLER_ENTRY(ServiceControl::Pause, OnPause)
+		CONTROL_HANDLER_ENTRY(ServiceControl::Continue, OnContinue)
+		CONTROL_HANDLER_ENTRY(ServiceControl::Stop, OnStop)
+	END_CONTROL_HANDLER_MAP()
+};
+
+std::atomic<uint64_t> FlushService::Flushed;
+std::atomic<uint64_t> FlushService::Abandoned;
+std::atomic<uint32_t> FlushService::Elapsed;
+
+// CheckPreShutdown
+//
+// Simulates a PRESHUTDOWN budget with a single thread pool worker while the service is paused;
+// the flushes still have to run in parallel and the stuck one has to be abandoned in time
+static bool CheckPreShutdown(void)
+{
+	ServiceHarness<FlushService> harness;
+	harness.SetParameter(_T("PreShutdownTimeout"), static_cast<uint32_t>(FlushService::BUDGET));
+	harness.SetParameter(_T("ThreadPoolSize"), static_cast<uint32_t>(1));
+	harness.Start(_T("FlushService"));
+	harness.Pause();
+
+	DWORD result = harness.SendControl(ServiceControl::PreShutdown);
+	harness.Stop();
+
+	Report(_T("preshutdown: budget %u ms: flushed %llu bytes, abandoned %llu bytes in %u ms"), FlushService::BUDGET,
+		FlushService::Flushed.load(), FlushService::Abandoned.load(), FlushService::Elapsed.load());
+
+	return (result == ERROR_SUCCESS) && (FlushService::Flushed.load() == 5000) && (FlushService::Abandoned.load() == 5000) &&
+		(FlushService::Elapsed.load() <= FlushService::BUDGET + 250);
+}
+
+// PrewarmService
+//
+// Service with an expensive constructor
+class PrewarmService : public Service<PrewarmService>
+{
+public:
+
+	static const uint32_t CONSTRUCTION = 50;
+
+	PrewarmService() : m_buffer(16 << 20, 1) { Sleep(CONSTRUCTION); }
+
+	void OnStart(int argc, svctl::tchar_t** argv)
+	{
+		UNREFERENCED_PARAMETER(argc);
+		UNREFERENCED_PARAMETER(argv);
+	}
+
+	void OnStop(void) {}
+
+	BEGIN_CONTROL_HANDLER_MAP(PrewarmService)
+		CONTROL_HANDLER_ENTRY(ServiceControl::Stop, OnStop)
+	END_CONTROL_HANDLER_MAP()
+
+private:
+
+	std::vector<uint8_t> m_buffer;
+};
+
+// MeasureRestarts
+//
+// Gets the average time, in microseconds, taken to restart PrewarmService with the test harness
+static uint64_t MeasureRestarts(int restarts)
+{
+	ServiceHarness<PrewarmService> harness;
+	harness.Start(_T("PrewarmService"));
+
+	uint64_t total = 0;
+	for(int index = 0; index < restarts; index++) {
+
+		// Give the pool time to construct the replacement instance between restarts
+		Sleep(PrewarmService::CONSTRUCTION * 2);
+
+		auto start = std::chrono::steady_clock::now();
+		harness.Stop();
+		harness.Start(_T("PrewarmService"));
+		total += ElapsedMicroseconds(start);
+	}
+
+	harness.Stop();
+	return total / restarts;
+}
+
+// CheckPrewarm
+//
+// Compares the restart latency of a service with an expensive constructor with and without prewarming
+static bool CheckPrewarm(void)
+{
+	const int RESTARTS = 10;
+
+	ServicePool<PrewarmService>::Disable();
+	uint64_t cold = MeasureRestarts(RESTARTS);
+
+	ServicePool<PrewarmService>::Prewarm(1);
+	Sleep(PrewarmService::CONSTRUCTION * 2);
+	uint64_t warm = MeasureRestarts(RESTARTS);
+
+	auto statistics = ServicePool<PrewarmService>::GetStatistics();
+	ServicePool<PrewarmService>::Disable();
+
+	Report(_T("prewarm: %d restarts: average %llu us without pooling, %llu us with pooling (%llu hits, %llu misses)"),
+		RESTARTS, cold, warm, statistics.Hits, statistics.Misses);
+
+	// Every restart after the pool was filled should have found an instance waiting
+	return (statistics.Hits >= static_cast<uint64_t>(RESTARTS)) && (warm < cold);
+}
+
+// RecoveryService
+//
+// Service whose parameter change handler fails, with in-process recovery enabled
+class RecoveryService : public Service<RecoveryService>
+{
+public:
+
+	static const uint32_t ATTEMPTS = 3;
+	static const uint32_t DELAY = 100;
+
+	// Started
+	//
+	// Number of instances that have reached OnStart
+	static std::atomic<uint32_t> Started;
+
+	void OnStart(int argc, svctl::tchar_t** argv)
+	{
+		UNREFERENCED_PARAMETER(argc);
+		UNREFERENCED_PARAMETER(argv);
+
+		Started.fetch_add(1);
+	}
+
+	void OnParameterChange(void) { throw svctl::winexception(ERROR_INVALID_DATA); }
+	void OnStop(void) {}
+
+	BEGIN_CONTROL_HANDLER_MAP(RecoveryService)
+		CONTROL_HANDLER_ENTRY(ServiceControl::ParameterChange, OnParameterChange)
+		CONTROL_HANDLER_ENTRY(ServiceControl::Stop, OnStop)
+	END_CONTROL_HANDLER_MAP()
+};
+
+std::atomic<uint32_t> RecoveryService::Started;
+
+// WaitForRecoveries
+//
+// Waits for the harness to record a number of completed recoveries; returns false on timeout
+static bool WaitForRecoveries(ServiceHarness<RecoveryService>& harness, size_t count, uint32_t timeout)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	while(std::chrono::steady_clock::now() < deadline) {
+
+		auto recoveries = harness.Recoveries;
+		if((recoveries.size() >= count) && recoveries[count - 1].Recovered) return true;
+		Sleep(10);
+	}
+
+	return false;
+}
+
+// CheckRecovery
+//
+// Measures the time taken to replace a failed instance in place, and that consecutive failures back off
+static bool CheckRecovery(void)
+{
+	ServiceHarness<RecoveryService> harness;
+	harness.SetParameter(_T("RecoveryAttempts"), static_cast<uint32_t>(RecoveryService::ATTEMPTS));
+	harness.SetParameter(_T("RecoveryDelay"), static_cast<uint32_t>(RecoveryService::DELAY));
+	harness.Start(_T("RecoveryService"));
+
+	// Fail the service twice; the second failure is a consecutive one, so its delay is doubled
+	harness.SendControl(ServiceControl::ParameterChange);
+	bool first = WaitForRecoveries(harness, 1, 10000);
+
+	harness.SendControl(ServiceControl::ParameterChange);
+	bool second = first && WaitForRecoveries(harness, 2, 10000);
+
+	auto recoveries = harness.Recoveries;
+	harness.Stop();
+
+	if(!second || (recoveries.size() < 2)) return false;
+
+	Report(_T("recovery: attempt %u: delay %u ms, running again after %u ms"), recoveries[0].Attempt, recoveries[0].Delay, recoveries[0].Elapsed);
+	Report(_T("recovery: attempt %u: delay %u ms, running again after %u ms"), recoveries[1].Attempt, recoveries[1].Delay, recoveries[1].Elapsed);
+
+	// The service has to be running again shortly after the delay, with a new instance each time
+	return (RecoveryService::Started.load() == 3) && (recoveries[1].Attempt == 2) && (recoveries[1].Delay == RecoveryService::DELAY * 2) &&
+		(recoveries[0].Elapsed < RecoveryService::DELAY + 1000) && (recoveries[1].Elapsed < (RecoveryService::DELAY * 2) + 1000);
+}
+
+// ListenerService
+//
+// Service that takes its listening sockets from the service host and retains the ones it creates
+class ListenerService : public Service<ListenerService>
+{
+public:
+
+	// Inherited / Retained
+	//
+	// Listening sockets found by the most recent instance, zero if it had none
+	static std::atomic<uintptr_t> Inherited;
+	static std::atomic<uintptr_t> Retained;
+
+	// Created
+	//
+	// Number of listening sockets the instances had to create themselves
+	static std::atomic<uint32_t> Created;
+
+	void OnStart(int argc, svctl::tchar_t** argv)
+	{
+		UNREFERENCED_PARAMETER(argc);
+		UNREFERENCED_PARAMETER(argv);
+
+		uintptr_t listener = 0;
+		Inherited.store((GetListener(_T("http"), listener)) ? listener : 0);
+
+		// An event object stands in for a bound socket, the registry only keeps the handle value
+		if(!GetListener(_T("admin"), listener)) {
+
+			listener = reinterpret_cast<uintptr_t>(CreateEvent(nullptr, TRUE, FALSE, nullptr));
+			RetainListener(_T("admin"), listener);
+			Created.fetch_add(1);
+		}
+
+		Retained.store(listener);
+	}
+
+	void OnStop(void) {}
+
+	BEGIN_CONTROL_HANDLER_MAP(ListenerService)
+		CONTROL_HANDLER_ENTRY(ServiceControl::Stop, OnStop)
+	END_CONTROL_HANDLER_MAP()
+};
+
+std::atomic<uintptr_t> ListenerService::Inherited;
+std::atomic<uintptr_t> ListenerService::Retained;
+std::atomic<uint32_t> ListenerService::Created;
+
+// CheckListeners
+//
+// Stands in for a supervisor that passes a listening socket to the service process, and checks that
+// the socket passed in and the one retained by the service are both handed to a restarted instance
+static bool CheckListeners(void)
+{
+	// The supervisor creates an inheritable handle and passes it in LISTEN_SOCKETS
+	SECURITY_ATTRIBUTES attributes = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+	HANDLE passed = CreateEvent(&attributes, TRUE, FALSE, nullptr);
+	if(passed == nullptr) return false;
+
+	TCHAR variable[64];
+	_sntprintf_s(variable, _countof(variable), _TRUNCATE, _T("http=%llu"), static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(passed)));
+	SetEnvironmentVariable(_T("LISTEN_SOCKETS"), variable);
+
+	ServiceHarness<ListenerService> harness;
+	size_t inherited = harness.Listeners.Inherit();
+
+	// The variable and the handle must not be passed on to any process the service starts
+	DWORD flags = 0;
+	bool isolated = (GetEnvironmentVariable(_T("LISTEN_SOCKETS"), nullptr, 0) == 0) &&
+		GetHandleInformation(passed, &flags) && ((flags & HANDLE_FLAG_INHERIT) == 0);
+
+	harness.Start(_T("ListenerService"));
+	uintptr_t retained = ListenerService::Retained.load();
+	bool first = (ListenerService::Inherited.load() == reinterpret_cast<uintptr_t>(passed));
+	harness.Stop();
+
+	// The restarted instance gets the same sockets without creating any
+	auto start = std::chrono::steady_clock::now();
+	harness.Start(_T("ListenerService"));
+	uint64_t restart = ElapsedMicroseconds(start);
+
+	bool second = (ListenerService::Inherited.load() == reinterpret_cast<uintptr_t>(passed)) && (ListenerService::Retained.load() == retained);
+	harness.Stop();
+
+	Report(_T("listeners: %zu inherited, %u created, restart %llu us"), inherited, ListenerService::Created.load(), restart);
+
+	// The check is responsible for the sockets once they have been removed from the registry
+	uintptr_t removed = 0;
+	if(harness.Listeners.Remove(_T("http"), removed)) CloseHandle(reinterpret_cast<HANDLE>(removed));
+	if(harness.Listeners.Remove(_T("admin"), removed)) CloseHandle(reinterpret_cast<HANDLE>(removed));
+
+	return (inherited == 1) && isolated && first && second && (ListenerService::Created.load() == 1);
+}
+
+// RunChecks
+//
+// Runs each of the harness checks; returns the number of checks that failed
+static int RunChecks(void)
+{
+	static const struct { const TCHAR* Name; bool(*Check)(void); } checks[] = {
+
+		{ _T("signal"), CheckSignal },
+		{ _T("quiesce"), CheckQuiesce },
+		{ _T("preshutdown"), CheckPreShutdown },
+		{ _T("prewarm"), CheckPrewarm },
+		{ _T("recovery"), CheckRecovery },
+		{ _T("listeners"), CheckListeners },
+	};
+
+	int failed = 0;
+	for(const auto& check : checks) {
+
+		bool passed = false;
+		try { passed = check.Check(); }
+		catch(std::exception& ex) { Report(_T("%s: %hs"), check.Name, ex.what()); }
+
+		Report(_T("%s: %s"), check.Name, (passed) ? _T("passed") : _T("FAILED"));
+		if(!passed) failed++;
+	}
+
+	return failed;
+}
+
 
 class MyService : public Service<MyService>
 {
@@ -93,6 +610,9 @@ int APIENTRY _tWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstanc
 
 #endif	// _DEBUG
 
+	// Harness checks
+	if(_tcsstr(lpCmdLine, _T("/check")) != nullptr) return RunChecks();
+
 	//struct test { 
 
 	//	int me1;
@@ -25,8 +25,148 @@
 
 #pragma warning(push, 4)
 
+// SERVICELIB_TRACING
+//
+// When defined, the service lifecycle and control dispatch emit TraceLogging events through
+// the "ServiceLib" ETW provider; when not defined the SVCTL_TRACE() probes compile to nothing
+#ifdef SERVICELIB_TRACING
+#include <TraceLoggingProvider.h>
+
+// {a04b2720-0aaa-5717-1dac-a57af04e8a76}; derived from the provider name "ServiceLib"
+TRACELOGGING_DEFINE_PROVIDER(g_svctltrace, "ServiceLib", (0xa04b2720, 0x0aaa, 0x5717, 0x1d, 0xac, 0xa5, 0x7a, 0xf0, 0x4e, 0x8a, 0x76));
+
+// The provider is registered for the lifetime of the module; an event written while no
+// trace session has enabled the provider costs a single test of the provider enable flag
+static struct trace_registration
+{
+	trace_registration() { TraceLoggingRegister(g_svctltrace); }
+	~trace_registration() { TraceLoggingUnregister(g_svctltrace); }
+} g_svctltraceregistration;
+
+#define SVCTL_TRACE(_event, ...) TraceLoggingWrite(g_svctltrace, _event, __VA_ARGS__)
+#else
+#define SVCTL_TRACE(_event, ...) ((void)0)
+#endif
+
 namespace svctl {
 
+//-----------------------------------------------------------------------------
+// svctl::GetListenerRegistry
+//
+// Gets the process-wide listener registry used by the services dispatched
+// through a ServiceTable
+//
+// Arguments:
+//
+//	NONE
+
+listener_registry& GetListenerRegistry(void)
+{
+	static listener_registry listeners;
+	static std::once_flag inherited;
+
+	// Sockets passed by the parent process are added the first time the registry is accessed
+	std::call_once(inherited, [&]() { listeners.Inherit(); });
+	return listeners;
+}
+
+#ifdef SERVICELIB_LOCK_INSTRUMENTATION
+
+// lock_registry
+//
+// Statistics for each named lock; entries are never removed so the pointers remain valid
+struct lock_registry
+{
+	std::map<tstring, std::unique_ptr<lock_counters>>	Counters;	// Statistics by lock name
+	std::mutex											Lock;		// Synchronization object
+};
+
+// GetLockRegistry (local)
+//
+// Gets the named lock statistics registry; locks may be constructed during static initialization
+static lock_registry& GetLockRegistry(void)
+{
+	static lock_registry registry;
+	return registry;
+}
+
+//-----------------------------------------------------------------------------
+// svctl::GetLockCounters
+//
+// Gets the statistics for a named lock, creating them if necessary
+//
+// Arguments:
+//
+//	name		- Name of the lock
+
+lock_counters* GetLockCounters(const tchar_t* name)
+{
+	lock_registry& registry = GetLockRegistry();
+	std::lock_guard<std::mutex> critsec(registry.Lock);
+
+	auto& counters = registry.Counters[(name) ? name : _T("")];
+	if(!counters) counters = std::make_unique<lock_counters>();
+
+	return counters.get();
+}
+
+#endif	// SERVICELIB_LOCK_INSTRUMENTATION
+
+//-----------------------------------------------------------------------------
+// svctl::GetLockStatistics
+//
+// Gets a snapshot of the statistics recorded for each named lock
+//
+// Arguments:
+//
+//	NONE
+
+std::vector<lock_statistics> GetLockStatistics(void)
+{
+	std::vector<lock_statistics> statistics;
+
+#ifdef SERVICELIB_LOCK_INSTRUMENTATION
+	lock_registry& registry = GetLockRegistry();
+	std::lock_guard<std::mutex> critsec(registry.Lock);
+
+	for(const auto& iterator : registry.Counters) {
+
+		const lock_counters& counters = *iterator.second;
+
+		lock_statistics stats;
+		stats.Name = iterator.first;
+		stats.Acquisitions = counters.Acquisitions.load(std::memory_order_relaxed);
+		stats.Contentions = counters.Contentions.load(std::memory_order_relaxed);
+		stats.WaitP50 = counters.WaitTime.Percentile(50.0);
+		stats.WaitP99 = counters.WaitTime.Percentile(99.0);
+		stats.WaitMax = counters.WaitTime.Max;
+		stats.HoldP50 = counters.HoldTime.Percentile(50.0);
+		stats.HoldP99 = counters.HoldTime.Percentile(99.0);
+		stats.HoldMax = counters.HoldTime.Max;
+		stats.MaxRecursion = counters.MaxRecursion.load(std::memory_order_relaxed);
+		statistics.push_back(std::move(stats));
+	}
+#endif	// SERVICELIB_LOCK_INSTRUMENTATION
+
+	return statistics;
+}
+
+//-----------------------------------------------------------------------------
+// svctl::GetServiceDependencies
+//
+// Gets the process-wide dependency tracker used by the services dispatched
+// through a ServiceTable
+//
+// Arguments:
+//
+//	NONE
+
+dependency_tracker& GetServiceDependencies(void)
+{
+	static dependency_tracker dependencies;
+	return dependencies;
+}
+
 //-----------------------------------------------------------------------------
 // svctl::GetServiceProcessType
 //
@@ -54,1246 +194,5224 @@ ServiceProcessType GetServiceProcessType(const tchar_t* name)
 }
 
 //-----------------------------------------------------------------------------
-// svctl::parameter_base
+// svctl::GetShutdownBroadcaster
+//
+// Gets the process-wide shutdown broadcaster used by the services dispatched
+// through a ServiceTable
+//
+// Arguments:
+//
+//	NONE
+
+shutdown_broadcaster& GetShutdownBroadcaster(void)
+{
+	static shutdown_broadcaster broadcaster;
+	return broadcaster;
+}
+
+//-----------------------------------------------------------------------------
+// svctl::cancellation_source
 //-----------------------------------------------------------------------------
 
 //-----------------------------------------------------------------------------
-// parameter_base::Bind
-//
-// Binds the parameter to the parameter storage
+// cancellation_source Constructor
 //
 // Arguments:
 //
-//	handle		- Parameter storage handle
-//	name		- Parameter value name to bind the parameter to
-//	loadfunc	- Function used to load the parameter value from storage
+//	parent		- Parent cancellation token
 
-void parameter_base::Bind(void* handle, const tchar_t* name, const load_parameter_func& loadfunc) 
+cancellation_source::cancellation_source(const cancellation_token& parent) :
+	m_parent(std::make_unique<cancellation_token>(parent)), m_parentcookie(0), m_state(std::make_shared<cancellation_state>())
 {
-	std::lock_guard<std::recursive_mutex> critsec(m_lock);
+	// Cancel this source when the parent is cancelled; only a weak reference to the
+	// state is held by the callback so the parent does not keep it alive
+	std::weak_ptr<cancellation_state> weakstate(m_state);
+	m_parentcookie = m_parent->Register([=]() {
 
-	m_handle = handle;
-	m_loadfunc = loadfunc;
-	m_name = name;
+		std::shared_ptr<cancellation_state> state = weakstate.lock();
+		if(state) Cancel(state);
+	});
 }
 
 //-----------------------------------------------------------------------------
-// parameter_base::IsBound (protected)
+// cancellation_source Destructor
+
+cancellation_source::~cancellation_source()
+{
+	// Remove the callback registered with the parent token, if any
+	if(m_parent && (m_parentcookie != 0)) m_parent->Unregister(m_parentcookie);
+}
+
+//-----------------------------------------------------------------------------
+// cancellation_source::Cancel (private, static)
 //
-// Determines if the parameter has been bound to storage or not
+// Requests cancellation of a cancellation state instance
 //
 // Arguments:
 //
-//	NONE
+//	state		- Cancellation state to be cancelled
 
-bool parameter_base::IsBound(void)
+void cancellation_source::Cancel(const std::shared_ptr<cancellation_state>& state)
 {
-	std::lock_guard<std::recursive_mutex> critsec(m_lock);
-	return ((m_handle != nullptr) && (m_loadfunc != nullptr));
+	std::map<uint32_t, std::function<void(void)>> callbacks;
+
+	// Set the cancelled flag and take ownership of the registered callbacks
+	{
+		std::lock_guard<std::mutex> critsec(state->Lock);
+
+		if(state->Cancelled.load()) return;
+		state->Cancelled.store(true);
+		callbacks.swap(state->Callbacks);
+	}
+
+	// Release any waiting threads and invoke the callbacks outside of the lock
+	state->Signal.Set();
+	for(const auto& iterator : callbacks) iterator.second();
 }
 
 //-----------------------------------------------------------------------------
-// parameter_base::TryLoad
+// svctl::cancellation_token
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// cancellation_token::Register
 //
-// Loads the parameter value from storage, will eat any thrown exception
+// Registers a callback to be invoked when cancellation has been requested
 //
 // Arguments:
 //
-//	NONE
+//	callback	- Callback to be invoked on cancellation
 
-bool parameter_base::TryLoad(void)
+uint32_t cancellation_token::Register(std::function<void(void)> callback) const
 {
-	try { Load(); }
-	catch(...) { return false; }
+	{
+		std::lock_guard<std::mutex> critsec(m_state->Lock);
 
-	return true;
+		// If cancellation has not been requested, add the callback to the collection
+		if(!m_state->Cancelled.load()) {
+
+			uint32_t cookie = m_state->NextCookie++;
+			m_state->Callbacks[cookie] = std::move(callback);
+			return cookie;
+		}
+	}
+
+	// Cancellation has already been requested; invoke the callback immediately
+	callback();
+	return 0;
 }
 
 //-----------------------------------------------------------------------------
-// parameter_base::Unbind
+// cancellation_token::Unregister
 //
-// Unbinds the parameter from the parameter storage
+// Removes a previously registered cancellation callback
 //
 // Arguments:
 //
-//	NONE
+//	cookie		- Cookie returned from Register()
 
-void parameter_base::Unbind(void)
+void cancellation_token::Unregister(uint32_t cookie) const
 {
-	std::lock_guard<std::recursive_mutex> critsec(m_lock);
-
-	m_handle = nullptr;
-	m_loadfunc = nullptr;
-	m_name.clear();
+	std::lock_guard<std::mutex> critsec(m_state->Lock);
+	m_state->Callbacks.erase(cookie);
 }
 
 //-----------------------------------------------------------------------------
-// svctl::resstring
+// svctl::dependency_tracker
 //-----------------------------------------------------------------------------
 
 //-----------------------------------------------------------------------------
-// resstring::GetResourceString (private, static)
+// dependency_tracker::Add
 //
-// Gets a tstring from a module string resource
+// Declares a service and the names of the in-process services it depends on
 //
 // Arguments:
 //
-//	id			- Resource identifier code
-//	instance	- Module instance handle to acquire the resource from
+//	name			- Service name
+//	dependencies	- Names of the services this service depends on
 
-const tstring resstring::GetResourceString(unsigned int id, HINSTANCE instance)
+void dependency_tracker::Add(const tstring& name, const std::vector<tstring>& dependencies)
 {
-	// LoadString() has a neat trick to return a read-only string pointer, but
-	// it won't necessarily be null-terminated.  Length is returned as result
-	tchar_t* string = nullptr;
-	int result = LoadString(instance, id, reinterpret_cast<tchar_t*>(&string), 0);
-
-	return tstring(string, result);
+	std::lock_guard<std::mutex> critsec(m_lock);
+	m_nodes[name].Dependencies = dependencies;
 }
 
 //-----------------------------------------------------------------------------
-// svctl::service
-//-----------------------------------------------------------------------------
-
-//-----------------------------------------------------------------------------
-// service::Abort (private)
+// dependency_tracker::Attach
 //
-// Abnormally terminates the service; does not return to the calling thread
+// Sets the function used to stop a service on behalf of a service it depends on
 //
 // Arguments:
 //
-//	exception	- The unhandled exception that is aborting the service
+//	name		- Service name
+//	stop		- Function that stops the service
 
-void service::Abort(std::exception_ptr exception)
+void dependency_tracker::Attach(const tstring& name, std::function<void(void)> stop)
 {
-	std::lock_guard<std::recursive_mutex> critsec(m_statuslock);
+	std::lock_guard<std::mutex> critsec(m_lock);
 
-	// If this is an svctl::winexception the code can be used to set the exit
-	// code for the service otherwise just use ERROR_UNHANDLED_EXCEPTION
-	try { std::rethrow_exception(exception); }
-	catch(winexception& ex) { TrySetStatus(ServiceStatus::Stopped, ex.code()); }
-	catch(...) { TrySetStatus(ServiceStatus::Stopped, ERROR_UNHANDLED_EXCEPTION); }
+	auto iterator = m_nodes.find(name);
+	if(iterator == m_nodes.end()) return;
 
-	m_stopsignal.Set();				// Interrupt the main service thread wait
-	Sleep(INFINITE);				// Never return
+	iterator->second.Stop = std::move(stop);
+	iterator->second.StopRequested = false;
+	m_changed.notify_all();
 }
 
 //-----------------------------------------------------------------------------
-// service::CloseParameterStore (private)
+// dependency_tracker::Detach
 //
-// Default implementation for closing parameter storage; uses the registry
+// Removes the stop function for a service; waits for any invocation of it that
+// is in progress to return so that the service instance can be destroyed
 //
 // Arguments:
 //
-//	handle		- Handle returned from OpenParameterStore
+//	name		- Service name
 
-void service::CloseParameterStore(void* handle)
+void dependency_tracker::Detach(const tstring& name)
 {
-	// Close the registry key handle
-	if(handle) RegCloseKey(reinterpret_cast<HKEY>(handle));
+	std::unique_lock<std::mutex> critsec(m_lock);
+
+	auto iterator = m_nodes.find(name);
+	if(iterator == m_nodes.end()) return;
+
+	node& entry = iterator->second;
+	m_changed.wait(critsec, [&]() { return entry.Stopping == 0; });
+	entry.Stop = nullptr;
 }
 
 //-----------------------------------------------------------------------------
-// service::Continue
+// dependency_tracker::SetStatus
 //
-// Continues the service from a paused state
+// Records a change in the status of a service
 //
 // Arguments:
 //
-//	NONE
+//	name		- Service name
+//	status		- New service status
 
-DWORD service::Continue(void)
+void dependency_tracker::SetStatus(const tstring& name, ServiceStatus status)
 {
-	std::lock_guard<std::recursive_mutex> critsec(m_statuslock);
-
-	// Service has to be in a status of PAUSED to accept this control
-	if(m_status != ServiceStatus::Paused) return ERROR_CALL_NOT_IMPLEMENTED;
-	
-	// Set the status to CONTINUE_PENDING
-	try { SetStatus(ServiceStatus::ContinuePending); }
-	catch(...) { Abort(std::current_exception()); }
-
-	try {
+	std::lock_guard<std::mutex> critsec(m_lock);
 
-		// Invoke all of the CONTINUE handlers prior to setting the service to RUNNING
-		for(const auto& handler : Handlers) if(handler->Control == ServiceControl::Continue) handler->Invoke(this, 0, nullptr);
-		SetStatus(ServiceStatus::Running);
-	}
+	auto iterator = m_nodes.find(name);
+	if(iterator == m_nodes.end()) return;
 
-	catch(...) { Abort(std::current_exception()); }
+	node& entry = iterator->second;
+	entry.Status = status;
+	if(status != ServiceStatus::Stopped) entry.Started = true;
+	else entry.StopRequested = false;
 
-	return ERROR_SUCCESS;
+	m_changed.notify_all();
 }
 
 //-----------------------------------------------------------------------------
-// service::ControlHandler (private)
+// dependency_tracker::StopDependents
 //
-// Handles a service control request from the service control manager
+// Stops every service that depends on a service and waits for them to stop.  The
+// dependents are stopped in parallel, and each of them stops its own dependents
+// first, so the services are stopped in reverse dependency order
 //
 // Arguments:
 //
-//	control			- Service control code
-//	eventtype		- Control-specific event type
-//	eventdata		- Control-specific event data
+//	name		- Service name
 
-DWORD service::ControlHandler(ServiceControl control, DWORD eventtype, void* eventdata)
+void dependency_tracker::StopDependents(const tstring& name)
 {
-	std::unique_lock<std::recursive_mutex> critsec(m_statuslock);
+	uint32_t outstanding = 0;
+	std::unique_lock<std::mutex> critsec(m_lock);
 
-	// Nothing should be coming in from the service control manager when stopped
-	if(m_status == ServiceStatus::Stopped) return ERROR_CALL_NOT_IMPLEMENTED;
+	// A stop blocks its executor thread until the dependents of that service have stopped as well, so
+	// there has to be a thread for every service; this has no effect once the worker threads exist
+	m_executor.Resize(static_cast<uint32_t>(m_nodes.size()));
 
-	// INTERROGATE, STOP, PAUSE and CONTINUE are special case handlers
-	if(control == ServiceControl::Interrogate) return ERROR_SUCCESS;
-	else if(control == ServiceControl::Stop) { Stop(); return ERROR_SUCCESS; }
-	else if(control == ServiceControl::Pause) { Pause(); return ERROR_SUCCESS; }
-	else if(control == ServiceControl::Continue) { Continue(); return ERROR_SUCCESS; }
+	while(true) {
 
-	// When a trigger event is received during service stop, ERROR_SHUTDOWN_IN_PROGRESS
-	// should be returned.  The service won't indicate that this is accepted, but the
-	// documentation in MSDN seems to imply that it may still get this control ...
-	if((control == ServiceControl::TriggerEvent) && (m_status == ServiceStatus::StopPending))
-		return ERROR_SHUTDOWN_IN_PROGRESS;
+		bool waiting = false;
 
-	// Done with messing about with the current service status; release the critsec
-	critsec.unlock();
+		for(auto& iterator : m_nodes) {
 
-	// PARAMCHANGE is automatically accepted if there are any parameters in the service,
-	// but may also have a service-defined handler so don't return after processing
-	if(control == ServiceControl::ParameterChange) ReloadParameters();
+			node& entry = iterator.second;
 
-	// Iterate over all of the implemented control handlers and invoke each of them
-	// in the order in which they appear in the control handler vector<>
-	bool handled = false;
-	for(const auto& iterator : Handlers) {
+			// Only services that depend on this one and have not stopped are of interest
+			if(entry.Status == ServiceStatus::Stopped) continue;
+			if(std::none_of(entry.Dependencies.begin(), entry.Dependencies.end(), [&](const tstring& dependency) { return _tcsicmp(dependency.c_str(), name.c_str()) == 0; })) continue;
 
-		if(iterator->Control != control) continue;
+			waiting = true;
 
-		// Invoke the service control handler; if a non-zero result is returned stop
-		// processing them and return that result back to the service control manager
-		try { 
+			// A dependent that is starting, pausing or continuing is stopped once it has settled
+			if(entry.StopRequested || !entry.Stop || ((entry.Status != ServiceStatus::Running) && (entry.Status != ServiceStatus::Paused))) continue;
 
-			DWORD result = iterator->Invoke(this, eventtype, eventdata);
-			if(result != ERROR_SUCCESS) return result;
+			entry.StopRequested = true;
+			entry.Stopping++;
+			outstanding++;
+
+			std::function<void(void)> stop = entry.Stop;
+			auto task = [=, &entry, &outstanding]() {
+
+				try { stop(); }
+				catch(...) { /* DO NOTHING */ }
+
+				std::lock_guard<std::mutex> stopcritsec(m_lock);
+
+				// A dependent that changed status before the stop reached it (PAUSE_PENDING, for example) refuses
+				// it; it's asked again once it has settled
+				if((entry.Status != ServiceStatus::StopPending) && (entry.Status != ServiceStatus::Stopped)) entry.StopRequested = false;
+
+				entry.Stopping--;
+				outstanding--;
+				m_changed.notify_all();
+			};
+
+			// If the executor has been drained the dependent is stopped on this thread instead
+			try { m_executor.Submit(task); }
+			catch(winexception&) { critsec.unlock(); task(); critsec.lock(); }
 		}
-		catch(...) { Abort(std::current_exception()); }
-		
-		handled = true;				// At least one handler was successfully invoked
+
+		if(!waiting) break;
+		m_changed.wait(critsec);
 	}
 
-	// Default for most service controls is to return ERROR_SUCCESS if it was handled
-	// and ERROR_CALL_NOT_IMPLEMENTED if no handler was present for the control
-	return (handled) ? ERROR_SUCCESS : ERROR_CALL_NOT_IMPLEMENTED;
+	// Wait for every stop that was started here to return; the tasks refer to this stack frame
+	m_changed.wait(critsec, [&]() { return outstanding == 0; });
 }
 
 //-----------------------------------------------------------------------------
-// service::IterateParameters (protected)
+// dependency_tracker::Validate
 //
-// Iterates over all parameters defined for the service and executes a function
+// Verifies that every dependency names a declared service and that there are no cycles
 //
 // Arguments:
 //
-//	func		- Function to pass each parameter name and reference to
+//	NONE
 
-void service::IterateParameters(std::function<void(const tstring& name, parameter_base& param)> func)
+void dependency_tracker::Validate(void) const
 {
-	// Default implementation has no parameters to iterate
+	std::lock_guard<std::mutex> critsec(m_lock);
+
+	std::map<tstring, int, name_compare> visited;
+	for(const auto& iterator : m_nodes) Visit(iterator.first, visited);
 }
 
 //-----------------------------------------------------------------------------
-// service::getAcceptedControls (private)
+// dependency_tracker::Visit (private)
 //
-// Determines what SERVICE_ACCEPT_XXXX codes the service will respond to based
-// on what control handlers have been registered
+// Depth-first search used to detect dependency cycles; must be called with the lock held
 //
 // Arguments:
 //
-//	NONE
+//	name		- Service name
+//	visited		- State of each service visited so far (1 = in progress, 2 = complete)
 
-DWORD service::getAcceptedControls(void)
+void dependency_tracker::Visit(const tstring& name, std::map<tstring, int, name_compare>& visited) const
 {
-	DWORD accept = 0;
-
-	// Derive what controls this service should report based on what service control handlers have
-	// been implemented in the derived class
-	for(const auto& iterator : Handlers) {
-
-		if(iterator->Control == ServiceControl::Stop)						accept |= SERVICE_ACCEPT_STOP;
-		else if(iterator->Control == ServiceControl::Pause)					accept |= SERVICE_ACCEPT_PAUSE_CONTINUE;
-		else if(iterator->Control == ServiceControl::Continue)				accept |= SERVICE_ACCEPT_PAUSE_CONTINUE;
-		else if(iterator->Control == ServiceControl::Shutdown)				accept |= SERVICE_ACCEPT_SHUTDOWN;
-		else if(iterator->Control == ServiceControl::ParameterChange)		accept |= SERVICE_ACCEPT_PARAMCHANGE;
-		else if(iterator->Control == ServiceControl::NetBindAdd)			accept |= SERVICE_ACCEPT_NETBINDCHANGE;
-		else if(iterator->Control == ServiceControl::NetBindRemove)			accept |= SERVICE_ACCEPT_NETBINDCHANGE;
-		else if(iterator->Control == ServiceControl::NetBindEnable)			accept |= SERVICE_ACCEPT_NETBINDCHANGE;
-		else if(iterator->Control == ServiceControl::NetBindDisable)		accept |= SERVICE_ACCEPT_NETBINDCHANGE;
-		else if(iterator->Control == ServiceControl::HardwareProfileChange)	accept |= SERVICE_ACCEPT_HARDWAREPROFILECHANGE;
-		else if(iterator->Control == ServiceControl::PowerEvent)			accept |= SERVICE_ACCEPT_POWEREVENT;
-		else if(iterator->Control == ServiceControl::SessionChange)			accept |= SERVICE_ACCEPT_SESSIONCHANGE;
-		else if(iterator->Control == ServiceControl::PreShutdown)			accept |= SERVICE_ACCEPT_PRESHUTDOWN;
-		else if(iterator->Control == ServiceControl::TimeChange)			accept |= SERVICE_ACCEPT_TIMECHANGE;
-		else if(iterator->Control == ServiceControl::TriggerEvent)			accept |= SERVICE_ACCEPT_TRIGGEREVENT;
-		else if(iterator->Control == ServiceControl::UserModeReboot)		accept |= SERVICE_ACCEPT_USERMODEREBOOT;
-	}
+	int& state = visited[name];
+	if(state == 2) return;
+	if(state == 1) throw winexception(ERROR_CIRCULAR_DEPENDENCY);
 
-	// If there are any svctl parameters in the service class, auto-accept PARAMCHANGE
-	IterateParameters([&](const tstring&, parameter_base&) { accept |= SERVICE_ACCEPT_PARAMCHANGE; });
+	auto iterator = m_nodes.find(name);
+	if(iterator == m_nodes.end()) throw winexception(ERROR_SERVICE_DEPENDENCY_DELETED);
 
-	return accept;						// Return the generated bitmask
+	state = 1;
+	for(const auto& dependency : iterator->second.Dependencies) Visit(dependency, visited);
+	visited[name] = 2;
 }
 
 //-----------------------------------------------------------------------------
-// service::getHandlers (protected, virtual)
+// dependency_tracker::WaitForDependencies
 //
-// Gets the collection of service-specific control handlers
+// Waits for every service that a service depends on to report SERVICE_RUNNING; returns
+// false if the wait was cancelled
+//
+// Arguments:
+//
+//	name		- Service name
+//	token		- Cancellation token that interrupts the wait
+//	timeout		- Maximum time to wait, in milliseconds
 
-const control_handler_table& service::getHandlers(void) const
+bool dependency_tracker::WaitForDependencies(const tstring& name, const cancellation_token& token, uint32_t timeout)
 {
-	// The default implementation has no handlers; this results in a service that
-	// can be started but otherwise will not respond to any controls, including STOP
-	static control_handler_table nohandlers;
-	return nohandlers;
+	// Wake the wait when cancellation is requested; this has to be registered before the lock is
+	// taken since the callback is invoked immediately if cancellation has already been requested
+	uint32_t cookie = token.Register([=]() { std::lock_guard<std::mutex> critsec(m_lock); m_changed.notify_all(); });
+
+	std::unique_lock<std::mutex> critsec(m_lock);
+
+	auto iterator = m_nodes.find(name);
+	if(iterator == m_nodes.end()) { critsec.unlock(); token.Unregister(cookie); return true; }
+
+	const std::vector<tstring>& dependencies = iterator->second.Dependencies;
+	bool failed = false;
+
+	auto predicate = [&]() {
+
+		if(token.IsCancellationRequested) return true;
+
+		bool running = true;
+		for(const auto& dependency : dependencies) {
+
+			auto prerequisite = m_nodes.find(dependency);
+			if(prerequisite == m_nodes.end()) { failed = true; return true; }
+
+			// A dependency that is stopping, or that has stopped after it was started, will not become available
+			const node& entry = prerequisite->second;
+			if((entry.Status == ServiceStatus::StopPending) || ((entry.Status == ServiceStatus::Stopped) && entry.Started)) { failed = true; return true; }
+
+			if((entry.Status != ServiceStatus::Running) && (entry.Status != ServiceStatus::Paused) &&
+				(entry.Status != ServiceStatus::PausePending) && (entry.Status != ServiceStatus::ContinuePending)) running = false;
+		}
+
+		return running;
+	};
+
+	bool completed = true;
+	if(timeout == INFINITE) m_changed.wait(critsec, predicate);
+	else completed = m_changed.wait_for(critsec, std::chrono::milliseconds(timeout), predicate);
+
+	critsec.unlock();
+	token.Unregister(cookie);
+
+	if(token.IsCancellationRequested) return false;
+	if(failed) throw winexception(ERROR_SERVICE_DEPENDENCY_FAIL);
+	if(!completed) throw winexception(ERROR_SERVICE_REQUEST_TIMEOUT);
+
+	return true;
 }
 
+//-----------------------------------------------------------------------------
+// svctl::flight_recorder
+//-----------------------------------------------------------------------------
 
 //-----------------------------------------------------------------------------
-// service::LoadParameter (private)
-//
-// Default implementation for loading a value from parameter storage
+// flight_recorder Constructor
 //
 // Arguments:
 //
-//	handle		- Handle returned from OpenParameterStore
-//	name		- Parameter value name
-//	format		- Expected parameter value format
-//	buffer		- Buffer to receive the parameter value
-//	length		- Length of the buffer
+//	NONE
 
-size_t service::LoadParameter(void* handle, const tchar_t* name, ServiceParameterFormat format, void* buffer, size_t length)
+flight_recorder::flight_recorder() : m_next(0)
 {
-	DWORD cb = static_cast<DWORD>(length);
-
-	// Pass all arguments onto RegGetValue(), no special processing is necessary
-	LSTATUS result = RegGetValue(reinterpret_cast<HKEY>(handle), nullptr, name, static_cast<DWORD>(format), nullptr, buffer, &cb);
-	if(result != ERROR_SUCCESS) throw winexception(result);
+	for(auto& slot : m_slots) {
 
-	return static_cast<size_t>(cb);			// Return required/used buffer size
+		slot.Sequence.store(0, std::memory_order_relaxed);
+		slot.Timestamp.store(0, std::memory_order_relaxed);
+		slot.Header.store(0, std::memory_order_relaxed);
+		slot.Arguments.store(0, std::memory_order_relaxed);
+	}
 }
 
 //-----------------------------------------------------------------------------
-// service::OpenParameterStore (private)
+// flight_recorder::Dump
 //
-// Default implementation for opening parameter storage; uses the registry
+// Generates a binary dump of the recorded events
 //
 // Arguments:
 //
-//	servicename		- Name assigned to the service instance
+//	NONE
 
-void* service::OpenParameterStore(const tchar_t* servicename)
+std::vector<uint8_t> flight_recorder::Dump(void) const
 {
-	HKEY hkey = nullptr;
+	std::vector<record> records;
+	records.reserve(CAPACITY);
+
+	// Copy each slot that isn't being written; the sequence number is checked again after the copy
+	// and the slot is skipped if it was overwritten while it was being read
+	for(const auto& slot : m_slots) {
+
+		record entry;
+		entry.Sequence = slot.Sequence.load(std::memory_order_acquire);
+		if(entry.Sequence == 0) continue;
+
+		entry.Timestamp = slot.Timestamp.load(std::memory_order_relaxed);
+		uint64_t header = slot.Header.load(std::memory_order_relaxed);
+		uint64_t arguments = slot.Arguments.load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(slot.Sequence.load(std::memory_order_relaxed) != entry.Sequence) continue;
+
+		entry.ThreadId = static_cast<uint32_t>(header);
+		entry.Event = static_cast<uint16_t>(header >> 32);
+		entry.Code = static_cast<uint16_t>(header >> 48);
+		entry.Arg1 = static_cast<uint32_t>(arguments);
+		entry.Arg2 = static_cast<uint32_t>(arguments >> 32);
+		records.push_back(entry);
+	}
 
-	// The default implementation for service parameters reads them from the service's Parameters key in HKLM
-	return (RegCreateKeyEx(HKEY_LOCAL_MACHINE, (tstring(_T("System\\CurrentControlSet\\Services\\")) + servicename + _T("\\Parameters")).c_str(), 
-		0, nullptr, 0, KEY_READ | KEY_WRITE, nullptr, &hkey, nullptr) == ERROR_SUCCESS) ? hkey : nullptr;
+	std::sort(records.begin(), records.end(), [](const record& lhs, const record& rhs) { return lhs.Sequence < rhs.Sequence; });
+
+	header dumpheader;
+	dumpheader.Magic = HEADER_MAGIC;
+	dumpheader.Version = HEADER_VERSION;
+	dumpheader.RecordSize = sizeof(record);
+	dumpheader.Frequency = static_cast<uint64_t>(std::chrono::steady_clock::period::den / std::chrono::steady_clock::period::num);
+	dumpheader.ProcessId = GetCurrentProcessId();
+	dumpheader.Count = static_cast<uint32_t>(records.size());
+
+	std::vector<uint8_t> dump(sizeof(header) + (records.size() * sizeof(record)));
+	memcpy(dump.data(), &dumpheader, sizeof(header));
+	if(!records.empty()) memcpy(dump.data() + sizeof(header), records.data(), records.size() * sizeof(record));
+
+	return dump;
 }
 
 //-----------------------------------------------------------------------------
-// service::Pause
+// flight_recorder::Record
 //
-// Pauses the service
+// Records an event, overwriting the oldest event in the ring buffer
 //
 // Arguments:
 //
-//	NONE
+//	event		- Event being recorded
+//	code		- Event-specific code
+//	arg1		- Event-specific argument
+//	arg2		- Event-specific argument
 
-DWORD service::Pause(void)
+void flight_recorder::Record(flight_event event, uint32_t code, uint32_t arg1, uint32_t arg2)
 {
-	std::lock_guard<std::recursive_mutex> critsec(m_statuslock);
+	uint64_t sequence = m_next.fetch_add(1, std::memory_order_relaxed) + 1;
+	slot& target = m_slots[(sequence - 1) % CAPACITY];
 
-	// Service has to be in a status of RUNNING to accept this control
-	if(m_status != ServiceStatus::Running) return ERROR_CALL_NOT_IMPLEMENTED;
-	
-	// Set the service status to PAUSE_PENDING
-	try { SetStatus(ServiceStatus::PausePending); }
-	catch(...) { Abort(std::current_exception()); }
+	// Invalidate the slot before writing it so that Dump() won't copy a partially written event
+	target.Sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
 
-	try {
+	target.Timestamp.store(static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()), std::memory_order_relaxed);
+	target.Header.store(static_cast<uint64_t>(GetCurrentThreadId()) | (static_cast<uint64_t>(event) << 32) | (static_cast<uint64_t>(code & 0xFFFF) << 48), std::memory_order_relaxed);
+	target.Arguments.store(static_cast<uint64_t>(arg1) | (static_cast<uint64_t>(arg2) << 32), std::memory_order_relaxed);
 
-		// Invoke all of the PAUSE handlers prior to setting the service to PAUSED
-		for(const auto& handler : Handlers) if(handler->Control == ServiceControl::Pause) handler->Invoke(this, 0, nullptr);
-		SetStatus(ServiceStatus::Paused);
-	}
+	target.Sequence.store(sequence, std::memory_order_release);
+}
 
-	catch(...) { Abort(std::current_exception()); }
+//-----------------------------------------------------------------------------
+// svctl::latency_histogram
+//-----------------------------------------------------------------------------
 
-	return ERROR_SUCCESS;
+//-----------------------------------------------------------------------------
+// latency_histogram Constructor
+//
+// Arguments:
+//
+//	NONE
+
+latency_histogram::latency_histogram() : m_count(0), m_max(0)
+{
+	for(auto& bucket : m_buckets) bucket.store(0, std::memory_order_relaxed);
 }
 
 //-----------------------------------------------------------------------------
-// service::ReloadParameters
+// latency_histogram::BucketIndex (private, static)
 //
-// Reloads the values for all bound parameter member variables
+// Gets the index of the bucket that a value falls into
 //
 // Arguments:
 //
-//	NONE
+//	value		- Value to get the bucket index for
 
-void service::ReloadParameters(void)
+size_t latency_histogram::BucketIndex(uint64_t value)
 {
-	// This can be done asynchronously; just iterate each parameter and reload it's value from storage
-	std::async(std::launch::async, [=]() { IterateParameters([=](const tstring&, parameter_base& param) { param.TryLoad(); }); });
+	const uint64_t subbuckets = (1ui64 << SUB_BUCKET_BITS);
+
+	// Values smaller than the number of sub-buckets map directly onto a bucket
+	if(value < subbuckets) return static_cast<size_t>(value);
+
+	// Find the most significant bit set in the value, clamping it to the largest tracked magnitude
+	unsigned long magnitude;
+	if(!_BitScanReverse(&magnitude, static_cast<unsigned long>(value >> 32))) _BitScanReverse(&magnitude, static_cast<unsigned long>(value));
+	else magnitude += 32;
+
+	if(magnitude > MAX_MAGNITUDE) return BUCKET_COUNT - 1;
+
+	// The bits immediately below the most significant bit select the linear sub-bucket
+	uint32_t shift = magnitude - SUB_BUCKET_BITS;
+	return static_cast<size_t>(((shift + 1) << SUB_BUCKET_BITS) + ((value >> shift) & (subbuckets - 1)));
 }
 
 //-----------------------------------------------------------------------------
-// service::Main
+// latency_histogram::BucketUpperBound (private, static)
 //
-// Service instance entry point
+// Gets the largest value that falls into a bucket
 //
 // Arguments:
 //
-//	argc				- Number of command line arguments
-//	argv				- Array of command line argument strings
-//	context				- Service runtime context information and callbacks
+//	index		- Bucket index
 
-void service::Main(int argc, tchar_t** argv, const service_context& context)
+uint64_t latency_histogram::BucketUpperBound(size_t index)
 {
-	using namespace std::placeholders;
-
-	void* paramhandle = nullptr;					// Service parameters handle
+	const uint64_t subbuckets = (1ui64 << SUB_BUCKET_BITS);
 
-	_ASSERTE(context.RegisterHandlerFunc);
-	if(!context.RegisterHandlerFunc) throw winexception(ERROR_INVALID_PARAMETER);
+	if(index < subbuckets) return index;
 
-	_ASSERTE(context.SetStatusFunc);
-	if(!context.SetStatusFunc) throw winexception(ERROR_INVALID_PARAMETER);
+	uint32_t shift = static_cast<uint32_t>(index >> SUB_BUCKET_BITS) - 1;
+	uint64_t lower = (subbuckets + (index & (subbuckets - 1))) << shift;
+	return lower + (1ui64 << shift) - 1;
+}
 
-	// Define a static HandlerEx callback that calls back into this service instance
-	LPHANDLER_FUNCTION_EX handler = [](DWORD control, DWORD eventtype, void* eventdata, void* context) -> DWORD { 
-		return reinterpret_cast<service*>(context)->ControlHandler(static_cast<ServiceControl>(control), eventtype, eventdata); };
+//-----------------------------------------------------------------------------
+// latency_histogram::Percentile
+//
+// Gets the upper bound of the bucket containing the specified percentile
+//
+// Arguments:
+//
+//	percentile	- Percentile to retrieve (0-100)
 
-	// Register a service control handler for this service instance
-	SERVICE_STATUS_HANDLE statushandle = context.RegisterHandlerFunc(argv[0], handler, this);
-	if(statushandle == 0) throw winexception();
+uint64_t latency_histogram::Percentile(double percentile) const
+{
+	uint64_t count = m_count.load(std::memory_order_relaxed);
+	if(count == 0) return 0;
+
+	// Determine the rank of the requested percentile; the rank is always at least one
+	if(percentile < 0.0) percentile = 0.0;
+	if(percentile > 100.0) percentile = 100.0;
+	uint64_t rank = static_cast<uint64_t>((percentile / 100.0) * count + 0.5);
+	if(rank == 0) rank = 1;
+
+	// Scan the buckets until the cumulative count reaches the rank; never report a value larger
+	// than the recorded maximum, the bucket upper bound may well exceed it
+	uint64_t cumulative = 0;
+	for(size_t index = 0; index < BUCKET_COUNT; index++) {
+
+		cumulative += m_buckets[index].load(std::memory_order_relaxed);
+		if(cumulative >= rank) {
+
+			uint64_t upper = BucketUpperBound(index);
+			uint64_t max = m_max.load(std::memory_order_relaxed);
+			return (upper < max) ? upper : max;
+		}
+	}
 
-	// Define a status reporting function that uses the handle and process type defined above
-	m_statusfunc = [=](SERVICE_STATUS& status) -> void {
+	// Recording may be in progress; the buckets can lag slightly behind the count
+	return m_max.load(std::memory_order_relaxed);
+}
 
-		_ASSERTE(statushandle != 0);
-		status.dwServiceType = static_cast<DWORD>(context.ProcessType);
-		if(!context.SetStatusFunc(statushandle, &status)) throw winexception();
-	};
+//-----------------------------------------------------------------------------
+// latency_histogram::Record
+//
+// Records a single latency value
+//
+// Arguments:
+//
+//	value		- Value to be recorded, in microseconds
 
-	try {
+void latency_histogram::Record(uint64_t value)
+{
+	m_buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
 
-		// Service is starting; report SERVICE_START_PENDING
-		SetStatus(ServiceStatus::StartPending);
+	uint64_t max = m_max.load(std::memory_order_relaxed);
+	while((value > max) && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed));
+}
 
-		// Open the parameter storage for this instance and bind/load all service parameters
-		paramhandle = (context.OpenParameterStore) ? context.OpenParameterStore(argv[0]) : OpenParameterStore(argv[0]);
-		load_parameter_func paramloader = (context.LoadParameter) ? context.LoadParameter : std::bind(&service::LoadParameter, this, _1, _2, _3, _4, _5);
-		IterateParameters([=](const tstring& name, parameter_base& param) { param.Bind(paramhandle, name.c_str(), paramloader); param.TryLoad(); });
+//-----------------------------------------------------------------------------
+// svctl::listener_registry
+//-----------------------------------------------------------------------------
 
-		// Invoke derived service class startup code
-		OnStart(argc, argv);
+//-----------------------------------------------------------------------------
+// listener_registry::Add
+//
+// Adds a listening socket under the specified name
+//
+// Arguments:
+//
+//	name		- Name of the listening socket
+//	socket		- Listening socket
 
-		// Service is now running, wait for the event indicating SERVICE_STOPPED has been set
-		SetStatus(ServiceStatus::Running);
-		WaitForSingleObject(m_stopsignal, INFINITE);
-	}
+void listener_registry::Add(const tstring& name, uintptr_t socket)
+{
+	if(name.length() == 0) throw winexception(E_INVALIDARG);
 
-	// Set the service to STOPPED on an unhandled winexception, translating ERROR_SUCCESS into ERROR_SERVICE_SPECIFIC.
-	// If the exception thrown is unknown use a generic ERROR_UNHANDLED_EXCEPTION as the stop code
-	catch(winexception& ex) { TrySetStatus(ServiceStatus::Stopped, (ex.code() != ERROR_SUCCESS) ? ex.code() : ERROR_SERVICE_SPECIFIC_ERROR); }
-	catch(...) { TrySetStatus(ServiceStatus::Stopped, ERROR_UNHANDLED_EXCEPTION); }
+	std::lock_guard<std::mutex> critsec(m_lock);
 
-	// Unbind all of the service parameters and close the parameter storage
-	IterateParameters([](const tstring&, parameter_base& param) { param.Unbind(); });
-	if(context.CloseParameterStore) context.CloseParameterStore(paramhandle);
-	else CloseParameterStore(paramhandle);
+	// Adding the same socket again is allowed; a service restarted in place hands back what it was given
+	auto result = m_listeners.emplace(name, socket);
+	if(!result.second && (result.first->second != socket)) throw winexception(ERROR_ALREADY_EXISTS);
 }
 
 //-----------------------------------------------------------------------------
-// service::SetNonPendingStatus (private)
+// listener_registry::Find
 //
-// Sets a non-pending service status
+// Looks up a listening socket by name
 //
 // Arguments:
 //
-//	status				- New service status to set
-//	win32exitcode		- Win32 service exit code for ServiceStatus::Stopped (see documentation)
-//	serviceexitcode		- Service specific exit code for ServiceStatus::Stopped (see documentation)
+//	name		- Name of the listening socket
+//	socket		- On success, receives the listening socket
 
-void service::SetNonPendingStatus(ServiceStatus status, uint32_t win32exitcode, uint32_t serviceexitcode)
+bool listener_registry::Find(const tstring& name, uintptr_t& socket) const
 {
-	std::lock_guard<std::recursive_mutex> critsec(m_statuslock);
+	std::lock_guard<std::mutex> critsec(m_lock);
 
-	_ASSERTE(m_statusfunc);							// Needs to be set
-	_ASSERTE(!m_statusworker.joinable());			// Should not be running
+	auto found = m_listeners.find(name);
+	if(found == m_listeners.end()) return false;
 
-	// Create and initialize a new SERVICE_STATUS for this operation
-	SERVICE_STATUS newstatus;
-	newstatus.dwServiceType = 0;		// <-- Set by m_statusfunc
-	newstatus.dwCurrentState = static_cast<DWORD>(status);
-	newstatus.dwControlsAccepted = (status == ServiceStatus::Stopped) ? 0 : AcceptedControls;
-	newstatus.dwWin32ExitCode = (status == ServiceStatus::Stopped) ? win32exitcode : ERROR_SUCCESS;
-	newstatus.dwServiceSpecificExitCode = (status == ServiceStatus::Stopped) ? serviceexitcode : ERROR_SUCCESS;
-	newstatus.dwCheckPoint = 0;
-	newstatus.dwWaitHint = 0;
+	socket = found->second;
+	return true;
+}
 
-	m_statusfunc(newstatus);						// Set the non-pending status
+//-----------------------------------------------------------------------------
+// listener_registry::getNames
+//
+// Gets the names of the listening sockets in the registry
+
+std::vector<tstring> listener_registry::getNames(void) const
+{
+	std::vector<tstring> names;
+	std::lock_guard<std::mutex> critsec(m_lock);
+
+	for(const auto& iterator : m_listeners) names.push_back(iterator.first);
+	return names;
 }
 
 //-----------------------------------------------------------------------------
-// service::SetPendingStatus (private)
+// listener_registry::Inherit
 //
-// Sets an automatically checkpointed pending service status
+// Adds the listening sockets passed by the parent process.  The parent creates the sockets
+// as inheritable handles, starts this process with handle inheritance enabled and sets the
+// LISTEN_SOCKETS environment variable to a list of name=socket entries separated by semicolons,
+// with each socket value in decimal (http=1234;admin=5678)
 //
 // Arguments:
 //
-//	status				- Pending service status to set
+//	NONE
 
-void service::SetPendingStatus(ServiceStatus status)
+size_t listener_registry::Inherit(void)
 {
-	std::lock_guard<std::recursive_mutex> critsec(m_statuslock);
+	// A length of zero indicates that the parent process did not pass any sockets
+	DWORD length = GetEnvironmentVariable(LISTEN_SOCKETS_VARIABLE, nullptr, 0);
+	if(length == 0) return 0;
 
-	_ASSERTE(m_statusfunc);							// Needs to be set
-	_ASSERTE(!m_statusworker.joinable());			// Should not be running
+	std::vector<tchar_t> buffer(length);
+	length = GetEnvironmentVariable(LISTEN_SOCKETS_VARIABLE, buffer.data(), length);
 
-	// Block all controls during SERVICE_START_PENDING and SERVICE_STOP_PENDING, otherwise only block
-	// controls that would result in a service status change while a status change is pending
-	DWORD accept = ((status == ServiceStatus::StartPending) || (status == ServiceStatus::StopPending)) ? 0 
-		: (AcceptedControls & ~(SERVICE_ACCEPT_STOP | SERVICE_ACCEPT_PAUSE_CONTINUE | SERVICE_ACCEPT_SHUTDOWN));
+	// The sockets are meant for this process only; don't pass them on to any child processes
+	SetEnvironmentVariable(LISTEN_SOCKETS_VARIABLE, nullptr);
 
-	// Set the initial pending status before launching the worker thread
-	SERVICE_STATUS newstatus;
-	newstatus.dwServiceType = 0;			// <-- Set by m_statusfunc
-	newstatus.dwCurrentState = static_cast<DWORD>(status);
-	newstatus.dwControlsAccepted = accept;
-	newstatus.dwWin32ExitCode = ERROR_SUCCESS;
-	newstatus.dwServiceSpecificExitCode = ERROR_SUCCESS;
-	newstatus.dwCheckPoint = 1;
-	newstatus.dwWaitHint = (status == ServiceStatus::StartPending) ? STARTUP_WAIT_HINT : PENDING_WAIT_HINT;
-	m_statusfunc(newstatus);
+	tstring value(buffer.data(), length);
+	size_t inherited = 0;
 
-	// Kick off a new worker thread to manage the automatic checkpoint operation
-	m_statusworker = std::move(std::thread([=]() {
+	std::lock_guard<std::mutex> critsec(m_lock);
 
-		try {
+	for(size_t start = 0; start < value.length(); ) {
 
-			// Copy the previous SERVICE_STATUS into a structure on the thread's stack
-			SERVICE_STATUS pendingstatus = newstatus;
+		size_t end = value.find(_T(';'), start);
+		if(end == tstring::npos) end = value.length();
 
-			// Continually report the same pending status with an incremented checkpoint until signaled
-			while(WaitForSingleObject(m_statussignal, PENDING_CHECKPOINT_INTERVAL) == WAIT_TIMEOUT) {
+		tstring entry = value.substr(start, end - start);
+		start = end + 1;
 
-				++pendingstatus.dwCheckPoint;
-				m_statusfunc(pendingstatus);
-			}
-		}
+		// Malformed entries are skipped rather than failing the service
+		size_t separator = entry.find(_T('='));
+		if((separator == 0) || (separator == tstring::npos)) continue;
 
-		// Copy any worker thread exceptions into the m_statusexception member variable,
-		// this can be checked on the next call to SetStatus()
-		catch(...) { m_statusexception = std::current_exception(); }
-	}));
+		const tchar_t* digits = entry.c_str() + separator + 1;
+		tchar_t* last = nullptr;
+		uintptr_t socket = static_cast<uintptr_t>(_tcstoui64(digits, &last, 10));
+		if((last == digits) || (*last != _T('\0'))) continue;
+
+		// The socket remains valid in this process but should not be inherited by any process it starts
+		SetHandleInformation(reinterpret_cast<HANDLE>(socket), HANDLE_FLAG_INHERIT, 0);
+		if(m_listeners.emplace(entry.substr(0, separator), socket).second) inherited++;
+	}
+
+	return inherited;
 }
 
 //-----------------------------------------------------------------------------
-// service::SetStatus (private)
+// listener_registry::Remove
 //
-// Sets a new service status; pending vs. non-pending is handled automatically
+// Removes a listening socket by name; the caller becomes responsible for closing it
 //
 // Arguments:
 //
-//	status			- New service status to set
-//	win32exitcode	- Win32 specific exit code for ServiceStatus::Stopped (see documentation)
-//	serviceexitcode	- Service-specific exit code for ServiceStatus::Stopped (see documentation)
+//	name		- Name of the listening socket
+//	socket		- On success, receives the listening socket
 
-void service::SetStatus(ServiceStatus status, uint32_t win32exitcode, uint32_t serviceexitcode)
+bool listener_registry::Remove(const tstring& name, uintptr_t& socket)
 {
-	std::lock_guard<std::recursive_mutex> critsec(m_statuslock);
+	std::lock_guard<std::mutex> critsec(m_lock);
 
-	// Check for a duplicate status; pending states are managed automatically
-	if(status == m_status) return;
+	auto found = m_listeners.find(name);
+	if(found == m_listeners.end()) return false;
 
-	// Check for a pending service state operation
-	if(m_statusworker.joinable()) {
+	socket = found->second;
+	m_listeners.erase(found);
+	return true;
+}
 
-		// Cancel the pending state checkpoint thread by signaling the event object
-		if(SignalObjectAndWait(m_statussignal, m_statusworker.native_handle(), INFINITE, FALSE) == WAIT_FAILED) 
-			throw winexception();
+//-----------------------------------------------------------------------------
+// svctl::parameter_base
+//-----------------------------------------------------------------------------
 
-		m_statusworker.join();
-		m_statussignal.Reset();
+//-----------------------------------------------------------------------------
+// parameter_base::Bind
+//
+// Binds the parameter to the parameter storage
+//
+// Arguments:
+//
+//	handle		- Parameter storage handle
+//	name		- Parameter value name to bind the parameter to
+//	loadfunc	- Function used to load the parameter value from storage
 
-		// Check for the presence of an exception from the worker thread and rethrow it
-		if(m_statusexception) std::rethrow_exception(m_statusexception);
-	}
+void parameter_base::Bind(void* handle, const tchar_t* name, const load_parameter_func& loadfunc) 
+{
+	std::lock_guard<named_recursive_mutex> critsec(m_lock);
 
-	// Invoke the proper status helper based on the type of status being set
-	switch(status) {
+	m_handle = handle;
+	m_loadfunc = loadfunc;
+	m_name = name;
+}
 
-		// Pending status codes
-		case ServiceStatus::StartPending:
-		case ServiceStatus::StopPending:
-		case ServiceStatus::ContinuePending:
-		case ServiceStatus::PausePending:
-			SetPendingStatus(status);
-			break;
+//-----------------------------------------------------------------------------
+// parameter_base::IsBound (protected)
+//
+// Determines if the parameter has been bound to storage or not
+//
+// Arguments:
+//
+//	NONE
 
-		// Non-pending status codes without an exit status
+bool parameter_base::IsBound(void)
+{
+	std::lock_guard<named_recursive_mutex> critsec(m_lock);
+	return ((m_handle != nullptr) && (m_loadfunc != nullptr));
+}
+
+//-----------------------------------------------------------------------------
+// parameter_base::TryLoad
+//
+// Loads the parameter value from storage, will eat any thrown exception
+//
+// Arguments:
+//
+//	NONE
+
+bool parameter_base::TryLoad(void)
+{
+	try { Load(); }
+	catch(...) { return false; }
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// parameter_base::Unbind
+//
+// Unbinds the parameter from the parameter storage
+//
+// Arguments:
+//
+//	NONE
+
+void parameter_base::Unbind(void)
+{
+	std::lock_guard<named_recursive_mutex> critsec(m_lock);
+
+	m_handle = nullptr;
+	m_loadfunc = nullptr;
+	m_name.clear();
+}
+
+//-----------------------------------------------------------------------------
+// svctl::pause_gate
+//-----------------------------------------------------------------------------
+
+// t_pausegate
+//
+// Identifies the pause gate the calling thread is registered with, if any
+static __declspec(thread) const pause_gate* t_pausegate = nullptr;
+
+//-----------------------------------------------------------------------------
+// pause_gate::Close
+//
+// Closes the gate and waits for all registered worker threads to park
+//
+// Arguments:
+//
+//	timeout		- Time to wait for the registered threads, in milliseconds
+
+uint32_t pause_gate::Close(uint32_t timeout)
+{
+	std::unique_lock<std::mutex> critsec(m_lock);
+
+	m_closed.store(true);
+
+	// Only registered threads are counted when they park, so the gate is quiesced once
+	// the counts match; the gate remains closed for any thread that has not parked yet
+	auto quiesced = [=]() { return m_parked == m_registered; };
+
+	if(timeout == INFINITE) m_changed.wait(critsec, quiesced);
+	else m_changed.wait_for(critsec, std::chrono::milliseconds(timeout), quiesced);
+
+	return m_registered - m_parked;
+}
+
+//-----------------------------------------------------------------------------
+// pause_gate::Open
+//
+// Opens the gate and releases any parked worker threads
+//
+// Arguments:
+//
+//	NONE
+
+void pause_gate::Open(void)
+{
+	std::lock_guard<std::mutex> critsec(m_lock);
+
+	m_closed.store(false);
+	m_changed.notify_all();
+}
+
+//-----------------------------------------------------------------------------
+// pause_gate::Park (private)
+//
+// Blocks the calling worker thread until the gate has been opened
+//
+// Arguments:
+//
+//	NONE
+
+void pause_gate::Park(void)
+{
+	std::unique_lock<std::mutex> critsec(m_lock);
+	if(!m_closed.load()) return;
+
+	// Let Close() know that another registered worker has parked, then wait for the gate to open
+	bool registered = (t_pausegate == this);
+	if(registered) { ++m_parked; m_changed.notify_all(); }
+
+	m_changed.wait(critsec, [=]() { return !m_closed.load(); });
+	if(registered) --m_parked;
+}
+
+//-----------------------------------------------------------------------------
+// pause_gate::Register
+//
+// Registers the calling worker thread with the gate
+//
+// Arguments:
+//
+//	NONE
+
+void pause_gate::Register(void)
+{
+	if(t_pausegate != nullptr) throw winexception(ERROR_ALREADY_REGISTERED);
+
+	std::lock_guard<std::mutex> critsec(m_lock);
+
+	t_pausegate = this;
+	++m_registered;
+}
+
+//-----------------------------------------------------------------------------
+// pause_gate::Unregister
+//
+// Unregisters the calling worker thread from the gate
+//
+// Arguments:
+//
+//	NONE
+
+void pause_gate::Unregister(void)
+{
+	std::lock_guard<std::mutex> critsec(m_lock);
+
+	_ASSERTE(t_pausegate == this);
+	if(t_pausegate != this) return;
+
+	t_pausegate = nullptr;
+	--m_registered;
+
+	// A closing thread may have been waiting on this worker to park
+	m_changed.notify_all();
+}
+
+//-----------------------------------------------------------------------------
+// svctl::resstring
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// resstring::GetResourceString (private, static)
+//
+// Gets a tstring from a module string resource
+//
+// Arguments:
+//
+//	id			- Resource identifier code
+//	instance	- Module instance handle to acquire the resource from
+
+const tstring resstring::GetResourceString(unsigned int id, HINSTANCE instance)
+{
+	// LoadString() has a neat trick to return a read-only string pointer, but
+	// it won't necessarily be null-terminated.  Length is returned as result
+	tchar_t* string = nullptr;
+	int result = LoadString(instance, id, reinterpret_cast<tchar_t*>(&string), 0);
+
+	return tstring(string, result);
+}
+
+//-----------------------------------------------------------------------------
+// svctl::service
+//-----------------------------------------------------------------------------
+
+// t_abortframes
+//
+// Number of service::Unwindable() frames on the calling thread; Abort() can only unwind a thread that has one
+static __declspec(thread) uint32_t t_abortframes = 0;
+
+//-----------------------------------------------------------------------------
+// service Destructor
+
+service::~service()
+{
+	// Release the statistics for any service control codes that were received
+	for(auto& counters : m_controlcounters) delete counters.load(std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// service::Abort (private)
+//
+// Abnormally terminates the service; does not return to the calling thread.  When in-process
+// recovery is enabled and the calling thread entered through Unwindable(), the thread is unwound
+// instead of being parked so that the service instance can be replaced
+//
+// Arguments:
+//
+//	exception	- The unhandled exception that is aborting the service
+
+void service::Abort(std::exception_ptr exception)
+{
+	std::lock_guard<named_recursive_mutex> critsec(m_statuslock);
+
+	// A catch(...) between an earlier abort and Unwindable() just continues the unwinding
+	if(m_aborted && t_abortframes) throw abort_exception();
+
+	// If this is an svctl::winexception the code can be used to set the exit
+	// code for the service otherwise just use ERROR_UNHANDLED_EXCEPTION
+	DWORD exitcode = ERROR_UNHANDLED_EXCEPTION;
+	try { std::rethrow_exception(exception); }
+	catch(winexception& ex) { exitcode = ex.code(); }
+	catch(...) { /* DO NOTHING */ }
+
+	SVCTL_TRACE("Abort", TraceLoggingUInt32(exitcode, "Win32ExitCode"));
+
+	// Preserve the events that led up to the failure before the parameter store is closed
+	m_recorder->Record(flight_event::Abort, 0, exitcode);
+	try { SaveFlightRecorder(); }
+	catch(...) { /* DO NOTHING */ }
+
+	// With in-process recovery enabled, the instance is torn down without reporting SERVICE_STOPPED so that
+	// it can be replaced, and the calling thread unwinds to where it entered the service releasing its locks
+	if(m_recoveryattempts && t_abortframes) {
+
+		m_aborted = true;
+		m_abortcode = exitcode;
+
+		// In-process dependents see the service as starting again until it has been replaced
+		if(m_dependencies) m_dependencies->SetStatus(m_servicename, ServiceStatus::StartPending);
+
+		// Stop reporting the pending status the service was in, if any
+		if(m_statusworker.joinable()) {
+
+			m_statussignal.Set();
+			m_statusworker.join();
+			m_statussignal.Reset();
+		}
+
+		m_stopsource.Cancel();
+		m_pausegate.Open();
+		m_stopsignal.Set();
+		throw abort_exception();
+	}
+
+	TrySetStatus(ServiceStatus::Stopped, exitcode);
+
+	m_stopsource.Cancel();			// Interrupt any worker thread waits
+	m_pausegate.Open();				// Release any parked worker threads
+	m_stopsignal.Set();				// Interrupt the main service thread wait
+	Sleep(INFINITE);				// Never return
+}
+
+//-----------------------------------------------------------------------------
+// service::CloseParameterStore (private)
+//
+// Default implementation for closing parameter storage; uses the registry
+//
+// Arguments:
+//
+//	handle		- Handle returned from OpenParameterStore
+
+void service::CloseParameterStore(void* handle)
+{
+	// Close the registry key handle
+	if(handle) RegCloseKey(reinterpret_cast<HKEY>(handle));
+}
+
+//-----------------------------------------------------------------------------
+// service::Continue
+//
+// Continues the service from a paused state
+//
+// Arguments:
+//
+//	NONE
+
+DWORD service::Continue(void)
+{
+	std::lock_guard<named_recursive_mutex> critsec(m_statuslock);
+
+	// Service has to be in a status of PAUSED to accept this control
+	if(m_status != ServiceStatus::Paused) return ERROR_CALL_NOT_IMPLEMENTED;
+	
+	// Set the status to CONTINUE_PENDING
+	try { SetStatus(ServiceStatus::ContinuePending); }
+	catch(...) { Abort(std::current_exception()); }
+
+	try {
+
+		// Release the parked worker threads, resume the thread pool and invoke all of the
+		// CONTINUE handlers prior to setting the service to RUNNING
+		m_pausegate.Open();
+		m_executor.Resume();
+		for(const auto& handler : Handlers) if(handler->Control == ServiceControl::Continue) handler->Invoke(this, 0, nullptr);
+		SubmitContinuations(ServiceControl::Continue);
+		SetStatus(ServiceStatus::Running);
+	}
+
+	catch(...) { Abort(std::current_exception()); }
+
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// service::ControlHandler (private)
+//
+// Handles a service control request from the service control manager
+//
+// Arguments:
+//
+//	control			- Service control code
+//	eventtype		- Control-specific event type
+//	eventdata		- Control-specific event data
+
+DWORD service::ControlHandler(ServiceControl control, DWORD eventtype, void* eventdata)
+{
+	m_recorder->Record(flight_event::ControlReceived, static_cast<uint32_t>(control), eventtype);
+	SVCTL_TRACE("ControlReceived", TraceLoggingUInt32(static_cast<uint32_t>(control), "Control"), TraceLoggingUInt32(eventtype, "EventType"));
+
+	control_counters* counters = GetControlCounters(control);
+	counters->Invocations.fetch_add(1, std::memory_order_relaxed);
+
+	// Dispatch the control and record how long it took to acquire the status lock and
+	// how long it took overall; an aborted service never returns here to record anything
+	auto start = std::chrono::steady_clock::now();
+	auto acquired = start;
+
+	DWORD result = DispatchControl(control, eventtype, eventdata, acquired);
+
+	auto finish = std::chrono::steady_clock::now();
+	counters->LockWait.Record(std::chrono::duration_cast<std::chrono::microseconds>(acquired - start).count());
+	counters->HandlerTime.Record(std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count());
+	if(result != ERROR_SUCCESS) counters->Errors.fetch_add(1, std::memory_order_relaxed);
+
+	m_recorder->Record(flight_event::ControlCompleted, static_cast<uint32_t>(control), result);
+	SVCTL_TRACE("ControlDispatched", TraceLoggingUInt32(static_cast<uint32_t>(control), "Control"), TraceLoggingUInt32(result, "Result"));
+
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+// service::DispatchControl (private)
+//
+// Dispatches a service control request to the appropriate handler(s)
+//
+// Arguments:
+//
+//	control			- Service control code
+//	eventtype		- Control-specific event type
+//	eventdata		- Control-specific event data
+//	acquired		- Set to the time at which the status lock was acquired
+
+DWORD service::DispatchControl(ServiceControl control, DWORD eventtype, void* eventdata, std::chrono::steady_clock::time_point& acquired)
+{
+	std::unique_lock<named_recursive_mutex> critsec(m_statuslock);
+	acquired = std::chrono::steady_clock::now();
+
+	// Nothing should be coming in from the service control manager when stopped or aborted
+	if((m_status == ServiceStatus::Stopped) || m_aborted) return ERROR_CALL_NOT_IMPLEMENTED;
+
+	// INTERROGATE, STOP, PAUSE and CONTINUE are special case handlers; the status lock is released
+	// first since STOP and PAUSE release it themselves while waiting for the worker threads
+	if(control == ServiceControl::Interrogate) return ERROR_SUCCESS;
+	else if(control == ServiceControl::Stop) { critsec.unlock(); Stop(); return ERROR_SUCCESS; }
+	else if(control == ServiceControl::Pause) { critsec.unlock(); Pause(); return ERROR_SUCCESS; }
+	else if(control == ServiceControl::Continue) { critsec.unlock(); Continue(); return ERROR_SUCCESS; }
+
+	// When a trigger event is received during service stop, ERROR_SHUTDOWN_IN_PROGRESS
+	// should be returned.  The service won't indicate that this is accepted, but the
+	// documentation in MSDN seems to imply that it may still get this control ...
+	if((control == ServiceControl::TriggerEvent) && (m_status == ServiceStatus::StopPending))
+		return ERROR_SHUTDOWN_IN_PROGRESS;
+
+	// Done with messing about with the current service status; release the critsec
+	critsec.unlock();
+
+	// SHUTDOWN and PRESHUTDOWN trigger the stop token before any handlers are invoked
+	// so that worker threads can begin winding down as soon as possible
+	if((control == ServiceControl::Shutdown) || (control == ServiceControl::PreShutdown)) m_stopsource.Cancel();
+
+	// PARAMCHANGE is automatically accepted if there are any parameters in the service,
+	// but may also have a service-defined handler so don't return after processing
+	if(control == ServiceControl::ParameterChange) ReloadParameters();
+
+	// PRESHUTDOWN is automatically accepted if there are any registered flush functions,
+	// which are run before any service-defined handlers
+	bool handled = false;
+	if(control == ServiceControl::PreShutdown) {
+
+		std::unique_lock<std::mutex> flushcritsec(m_flusherslock);
+		handled = !m_flushers.empty();
+		flushcritsec.unlock();
+
+		if(handled) PreShutdownFlush();
+	}
+
+	// Iterate over all of the implemented control handlers and invoke each of them
+	// in the order in which they appear in the control handler vector<>
+	const control_handler_table& handlers = Handlers;
+	for(size_t index = 0; index < handlers.size(); index++) {
+
+		if(handlers[index]->Control != control) continue;
+
+		// Invoke the service control handler; if a non-zero result is returned stop
+		// processing them and return that result back to the service control manager
+		try { 
+
+			m_recorder->Record(flight_event::HandlerEnter, static_cast<uint32_t>(control), static_cast<uint32_t>(index));
+			SVCTL_TRACE("HandlerBegin", TraceLoggingUInt32(static_cast<uint32_t>(control), "Control"), TraceLoggingValue(handlers[index]->Name, "Handler"));
+
+			DWORD result = handlers[index]->Invoke(this, eventtype, eventdata);
+
+			m_recorder->Record(flight_event::HandlerExit, static_cast<uint32_t>(control), static_cast<uint32_t>(index), result);
+			SVCTL_TRACE("HandlerEnd", TraceLoggingUInt32(static_cast<uint32_t>(control), "Control"), TraceLoggingValue(handlers[index]->Name, "Handler"), TraceLoggingUInt32(result, "Result"));
+
+			if(result != ERROR_SUCCESS) return result;
+		}
+		catch(...) { Abort(std::current_exception()); }
+		
+		handled = true;				// At least one handler was successfully invoked
+	}
+
+	// Queue any one-shot tasks that were waiting for this control to be processed
+	SubmitContinuations(control);
+
+	// Default for most service controls is to return ERROR_SUCCESS if it was handled
+	// and ERROR_CALL_NOT_IMPLEMENTED if no handler was present for the control
+	return (handled) ? ERROR_SUCCESS : ERROR_CALL_NOT_IMPLEMENTED;
+}
+
+//-----------------------------------------------------------------------------
+// service::DumpControlStatistics (protected)
+//
+// Writes the statistics for every control code received to the debugger output
+//
+// Arguments:
+//
+//	NONE
+
+void service::DumpControlStatistics(void)
+{
+	tchar_t line[256];
+
+	for(size_t index = 0; index < _countof(m_controlcounters); index++) {
+
+		if(m_controlcounters[index].load(std::memory_order_acquire) == nullptr) continue;
+
+		control_statistics stats = GetControlStatistics(static_cast<ServiceControl>(index));
+		_sntprintf_s(line, _countof(line), _TRUNCATE, _T("control %3u: invocations=%I64u errors=%I64u handler(us) p50=%I64u p99=%I64u max=%I64u lockwait(us) p50=%I64u p99=%I64u max=%I64u\n"),
+			static_cast<uint32_t>(index), stats.Invocations, stats.Errors, stats.HandlerP50, stats.HandlerP99, stats.HandlerMax, 
+			stats.LockWaitP50, stats.LockWaitP99, stats.LockWaitMax);
+		OutputDebugString(line);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// service::DumpTimeline (private)
+//
+// Writes the lifecycle timeline to the debugger output
+//
+// Arguments:
+//
+//	NONE
+
+void service::DumpTimeline(void)
+{
+	tchar_t line[256];
+
+	for(const auto& entry : Timeline) {
+
+		_sntprintf_s(line, _countof(line), _TRUNCATE, _T("%10I64u us %10I64u us  %s\n"), entry.Start, entry.Duration, entry.Phase.c_str());
+		OutputDebugString(line);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// service::InvokeStopGroup (private)
+//
+// Invokes a group of Stop handlers in parallel on the service thread pool
+//
+// Arguments:
+//
+//	group		- Stop group being invoked
+//	handlers	- Stop handlers in the group
+
+void service::InvokeStopGroup(uint32_t group, const std::vector<const control_handler*>& handlers)
+{
+	std::vector<std::exception_ptr> exceptions(handlers.size());	// Handler exceptions
+	std::vector<bool> completed(handlers.size(), false);			// Handler completion flags
+	std::mutex lock;												// Completion synchronization
+	std::condition_variable changed;								// Completion condition variable
+
+	uint32_t deadline = GetStopGroupDeadline(group);
+	auto started = std::chrono::steady_clock::now();
+
+	// Invokes a single handler and flags it as completed; the state lives on this stack
+	// frame, which is safe since every handler is waited for before returning
+	auto invoke = [&](size_t index) -> void {
+
+		try { handlers[index]->Invoke(this, 0, nullptr); }
+		catch(...) { exceptions[index] = std::current_exception(); }
+
+		std::lock_guard<std::mutex> critsec(lock);
+		completed[index] = true;
+		changed.notify_all();
+	};
+
+	// Queue each of the handlers to the thread pool.  When Stop() has been called from a task the
+	// handlers are invoked in order on this thread instead, since they could otherwise be queued
+	// behind this task on its own worker and never run.  A handler the pool refuses is invoked here
+	for(size_t index = 0; index < handlers.size(); index++) {
+
+		if(m_executor.IsWorkerThread()) { invoke(index); continue; }
+
+		try { m_executor.Submit([&, index]() { invoke(index); }); }
+		catch(winexception&) { invoke(index); }
+	}
+
+	std::unique_lock<std::mutex> critsec(lock);
+	auto finished = [&]() { return std::find(completed.begin(), completed.end(), false) == completed.end(); };
+
+	// Wait for the handlers to complete within the deadline and report any that have overrun it
+	if(deadline && !changed.wait_until(critsec, started + std::chrono::milliseconds(deadline), finished)) {
+
+		std::vector<size_t> overruns;
+		for(size_t index = 0; index < completed.size(); index++) if(!completed[index]) overruns.push_back(index);
+
+		critsec.unlock();
+		for(const auto& index : overruns) OnStopHandlerOverrun(handlers[index]->Name, group, deadline);
+		critsec.lock();
+	}
+
+	// Overrunning handlers cannot be abandoned, the service can't report STOPPED until they return
+	changed.wait(critsec, finished);
+	critsec.unlock();
+
+	// Propagate the first exception thrown by a handler in the group
+	for(const auto& exception : exceptions) if(exception) std::rethrow_exception(exception);
+}
+
+//-----------------------------------------------------------------------------
+// service::InvokeStopHandlers (private)
+//
+// Invokes the ungrouped Stop handlers, followed by each group of Stop handlers
+//
+// Arguments:
+//
+//	NONE
+
+void service::InvokeStopHandlers(void)
+{
+	std::map<uint32_t, std::vector<const control_handler*>> groups;
+	const control_handler_table& handlers = Handlers;
+
+	// Ungrouped handlers are invoked sequentially in the order they were declared; group zero is
+	// reserved for them, STOP_GROUP_HANDLER_ENTRY rejects it at compile time
+	for(size_t index = 0; index < handlers.size(); index++) {
+
+		if(handlers[index]->Control != ServiceControl::Stop) continue;
+		if(handlers[index]->Group != 0) { groups[handlers[index]->Group].push_back(handlers[index].get()); continue; }
+
+		MarkPhase((tstring(_T("Stop handler ")) + handlers[index]->Name).c_str());
+
+		m_recorder->Record(flight_event::HandlerEnter, static_cast<uint32_t>(ServiceControl::Stop), static_cast<uint32_t>(index));
+		SVCTL_TRACE("HandlerBegin", TraceLoggingUInt32(static_cast<uint32_t>(ServiceControl::Stop), "Control"), TraceLoggingValue(handlers[index]->Name, "Handler"));
+
+		handlers[index]->Invoke(this, 0, nullptr);
+
+		m_recorder->Record(flight_event::HandlerExit, static_cast<uint32_t>(ServiceControl::Stop), static_cast<uint32_t>(index));
+		SVCTL_TRACE("HandlerEnd", TraceLoggingUInt32(static_cast<uint32_t>(ServiceControl::Stop), "Control"), TraceLoggingValue(handlers[index]->Name, "Handler"), TraceLoggingUInt32(ERROR_SUCCESS, "Result"));
+	}
+
+	// Grouped handlers overlap; each group is marked as a single phase
+	for(const auto& group : groups) {
+
+		MarkPhase((tstring(_T("Stop group ")) + to_tstring(group.first)).c_str());
+
+		m_recorder->Record(flight_event::StopGroupEnter, 0, group.first);
+		InvokeStopGroup(group.first, group.second);
+		m_recorder->Record(flight_event::StopGroupExit, 0, group.first);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// service::IterateParameters (protected)
+//
+// Iterates over all parameters defined for the service and executes a function
+//
+// Arguments:
+//
+//	func		- Function to pass each parameter name and reference to
+
+void service::IterateParameters(std::function<void(const tstring& name, parameter_base& param)> func)
+{
+	// Default implementation has no parameters to iterate
+}
+
+//-----------------------------------------------------------------------------
+// service::getAcceptedControls (private)
+//
+// Determines what SERVICE_ACCEPT_XXXX codes the service will respond to based
+// on what control handlers have been registered
+//
+// Arguments:
+//
+//	NONE
+
+DWORD service::getAcceptedControls(void)
+{
+	DWORD accept = 0;
+
+	// Derive what controls this service should report based on what service control handlers have
+	// been implemented in the derived class
+	for(const auto& iterator : Handlers) {
+
+		if(iterator->Control == ServiceControl::Stop)						accept |= SERVICE_ACCEPT_STOP;
+		else if(iterator->Control == ServiceControl::Pause)					accept |= SERVICE_ACCEPT_PAUSE_CONTINUE;
+		else if(iterator->Control == ServiceControl::Continue)				accept |= SERVICE_ACCEPT_PAUSE_CONTINUE;
+		else if(iterator->Control == ServiceControl::Shutdown)				accept |= SERVICE_ACCEPT_SHUTDOWN;
+		else if(iterator->Control == ServiceControl::ParameterChange)		accept |= SERVICE_ACCEPT_PARAMCHANGE;
+		else if(iterator->Control == ServiceControl::NetBindAdd)			accept |= SERVICE_ACCEPT_NETBINDCHANGE;
+		else if(iterator->Control == ServiceControl::NetBindRemove)			accept |= SERVICE_ACCEPT_NETBINDCHANGE;
+		else if(iterator->Control == ServiceControl::NetBindEnable)			accept |= SERVICE_ACCEPT_NETBINDCHANGE;
+		else if(iterator->Control == ServiceControl::NetBindDisable)		accept |= SERVICE_ACCEPT_NETBINDCHANGE;
+		else if(iterator->Control == ServiceControl::HardwareProfileChange)	accept |= SERVICE_ACCEPT_HARDWAREPROFILECHANGE;
+		else if(iterator->Control == ServiceControl::PowerEvent)			accept |= SERVICE_ACCEPT_POWEREVENT;
+		else if(iterator->Control == ServiceControl::SessionChange)			accept |= SERVICE_ACCEPT_SESSIONCHANGE;
+		else if(iterator->Control == ServiceControl::PreShutdown)			accept |= SERVICE_ACCEPT_PRESHUTDOWN;
+		else if(iterator->Control == ServiceControl::TimeChange)			accept |= SERVICE_ACCEPT_TIMECHANGE;
+		else if(iterator->Control == ServiceControl::TriggerEvent)			accept |= SERVICE_ACCEPT_TRIGGEREVENT;
+		else if(iterator->Control == ServiceControl::UserModeReboot)		accept |= SERVICE_ACCEPT_USERMODEREBOOT;
+	}
+
+	// If there are any svctl parameters in the service class, auto-accept PARAMCHANGE
+	IterateParameters([&](const tstring&, parameter_base&) { accept |= SERVICE_ACCEPT_PARAMCHANGE; });
+
+	// If there are any PRESHUTDOWN flush functions registered, auto-accept PRESHUTDOWN
+	{
+		std::lock_guard<std::mutex> critsec(m_flusherslock);
+		if(!m_flushers.empty()) accept |= SERVICE_ACCEPT_PRESHUTDOWN;
+	}
+
+	return accept;						// Return the generated bitmask
+}
+
+//-----------------------------------------------------------------------------
+// service::GetCheckpointInterval (private)
+//
+// Derives the automatic checkpoint interval from a pending status wait hint
+//
+// Arguments:
+//
+//	waithint	- Wait hint reported with the pending status
+
+uint32_t service::GetCheckpointInterval(uint32_t waithint) const
+{
+	// Report at least four checkpoints within the wait hint, but never more often than
+	// the minimum interval or less often than the standard interval
+	uint32_t interval = waithint / 4;
+
+	if(interval < MINIMUM_CHECKPOINT_INTERVAL) return MINIMUM_CHECKPOINT_INTERVAL;
+	return (interval > PENDING_CHECKPOINT_INTERVAL) ? PENDING_CHECKPOINT_INTERVAL : interval;
+}
+
+//-----------------------------------------------------------------------------
+// service::GetControlCounters (private)
+//
+// Gets the statistics for a service control code, creating them if necessary
+//
+// Arguments:
+//
+//	control		- Service control code
+
+service::control_counters* service::GetControlCounters(ServiceControl control)
+{
+	auto& slot = m_controlcounters[static_cast<uint32_t>(control) & 0xFF];
+
+	control_counters* counters = slot.load(std::memory_order_acquire);
+	if(counters) return counters;
+
+	// Allocate the statistics for this control; if another thread beat this one to it, use theirs
+	control_counters* created = new control_counters();
+	if(slot.compare_exchange_strong(counters, created, std::memory_order_acq_rel)) return created;
+
+	delete created;
+	return counters;
+}
+
+//-----------------------------------------------------------------------------
+// service::GetControlStatistics (protected)
+//
+// Gets a snapshot of the statistics recorded for a service control code
+//
+// Arguments:
+//
+//	control		- Service control code
+
+service::control_statistics service::GetControlStatistics(ServiceControl control)
+{
+	control_statistics stats;
+	zero_init(stats);
+
+	const control_counters* counters = m_controlcounters[static_cast<uint32_t>(control) & 0xFF].load(std::memory_order_acquire);
+	if(counters == nullptr) return stats;
+
+	stats.Invocations = counters->Invocations.load(std::memory_order_relaxed);
+	stats.Errors = counters->Errors.load(std::memory_order_relaxed);
+	stats.HandlerP50 = counters->HandlerTime.Percentile(50.0);
+	stats.HandlerP99 = counters->HandlerTime.Percentile(99.0);
+	stats.HandlerMax = counters->HandlerTime.Max;
+	stats.LockWaitP50 = counters->LockWait.Percentile(50.0);
+	stats.LockWaitP99 = counters->LockWait.Percentile(99.0);
+	stats.LockWaitMax = counters->LockWait.Max;
+
+	return stats;
+}
+
+//-----------------------------------------------------------------------------
+// service::GetStopGroupDeadline (protected, virtual)
+//
+// Gets the deadline declared for a stop group
+//
+// Arguments:
+//
+//	group		- Stop group number
+
+uint32_t service::GetStopGroupDeadline(uint32_t group) const
+{
+	// Default implementation has no stop group deadlines
+	UNREFERENCED_PARAMETER(group);
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// service::getHandlers (protected, virtual)
+//
+// Gets the collection of service-specific control handlers
+
+const control_handler_table& service::getHandlers(void) const
+{
+	// The default implementation has no handlers; this results in a service that
+	// can be started but otherwise will not respond to any controls, including STOP
+	static control_handler_table nohandlers;
+	return nohandlers;
+}
+
+
+//-----------------------------------------------------------------------------
+// service::getReadiness (protected)
+//
+// Gets the current service readiness level
+
+ServiceReadiness service::getReadiness(void)
+{
+	// A service that hasn't reported SERVICE_RUNNING yet, or has started to stop, is not ready
+	if(!m_warmupstarted.load() || m_stopsource.IsCancellationRequested) return ServiceReadiness::NotReady;
+
+	return (m_warmsignal.Wait(0)) ? ServiceReadiness::Warm : ServiceReadiness::Ready;
+}
+
+//-----------------------------------------------------------------------------
+// service::GetListener (protected)
+//
+// Gets a listening socket kept open by the service host
+//
+// Arguments:
+//
+//	name		- Name of the listening socket
+//	socket		- On success, receives the listening socket
+
+bool service::GetListener(const tchar_t* name, uintptr_t& socket) const
+{
+	if(name == nullptr) throw winexception(E_INVALIDARG);
+
+	// Without a listener registry the service has to create its own listening sockets
+	return (m_listeners) ? m_listeners->Find(name, socket) : false;
+}
+
+//-----------------------------------------------------------------------------
+// service::GetTransitionIndex (private, static)
+//
+// Gets the transition history index for a pending service status
+//
+// Arguments:
+//
+//	status		- Pending service status
+
+int service::GetTransitionIndex(ServiceStatus status)
+{
+	switch(status) {
+
+		case ServiceStatus::StartPending: return 0;
+		case ServiceStatus::StopPending: return 1;
+		case ServiceStatus::PausePending: return 2;
+		case ServiceStatus::ContinuePending: return 3;
+	}
+
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// service::GetWaitHint (private)
+//
+// Derives the wait hint for a pending status from the transition history
+//
+// Arguments:
+//
+//	status		- Pending service status
+
+uint32_t service::GetWaitHint(ServiceStatus status) const
+{
+	uint32_t defaulthint = (status == ServiceStatus::StartPending) ? STARTUP_WAIT_HINT : PENDING_WAIT_HINT;
+
+	int index = GetTransitionIndex(status);
+	if(index < 0) return defaulthint;
+
+	// The fixed wait hints are used until enough transitions have been recorded
+	size_t count = m_history.Count[index];
+	if(count > _countof(m_history.Durations[index])) count = _countof(m_history.Durations[index]);
+	if(count < ADAPTIVE_MINIMUM_SAMPLES) return defaulthint;
+
+	// Find the nearest-rank percentile of the recorded durations
+	std::vector<uint32_t> samples(&m_history.Durations[index][0], &m_history.Durations[index][count]);
+	std::sort(samples.begin(), samples.end());
+	uint32_t percentile = samples[((count * ADAPTIVE_PERCENTILE) + 99) / 100 - 1];
+
+	// Allow 50% headroom over the percentile so that a slow but healthy transition isn't
+	// mistaken for a hung one, without waiting needlessly long on one that is hung
+	uint32_t waithint = percentile + (percentile / 2);
+	return (waithint < MINIMUM_WAIT_HINT) ? MINIMUM_WAIT_HINT : waithint;
+}
+
+//-----------------------------------------------------------------------------
+// service::LoadParameter (private)
+//
+// Default implementation for loading a value from parameter storage
+//
+// Arguments:
+//
+//	handle		- Handle returned from OpenParameterStore
+//	name		- Parameter value name
+//	format		- Expected parameter value format
+//	buffer		- Buffer to receive the parameter value
+//	length		- Length of the buffer
+
+size_t service::LoadParameter(void* handle, const tchar_t* name, ServiceParameterFormat format, void* buffer, size_t length)
+{
+	DWORD cb = static_cast<DWORD>(length);
+
+	// Pass all arguments onto RegGetValue(), no special processing is necessary
+	LSTATUS result = RegGetValue(reinterpret_cast<HKEY>(handle), nullptr, name, static_cast<DWORD>(format), nullptr, buffer, &cb);
+	if(result != ERROR_SUCCESS) throw winexception(result);
+
+	return static_cast<size_t>(cb);			// Return required/used buffer size
+}
+
+//-----------------------------------------------------------------------------
+// service::MarkPhase (protected)
+//
+// Marks the beginning of a lifecycle phase, which also marks the end of the previous one
+//
+// Arguments:
+//
+//	phase		- Name of the phase
+
+void service::MarkPhase(const tchar_t* phase)
+{
+	if(phase == nullptr) phase = _T("");
+
+	uint64_t offset = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_timelinestart).count();
+
+	std::unique_lock<std::mutex> critsec(m_timelinelock);
+
+	if(!m_timeline.empty()) m_timeline.back().Duration = offset - m_timeline.back().Start;
+
+	timeline_entry entry = { phase, offset, 0 };
+	m_timeline.push_back(std::move(entry));
+
+	critsec.unlock();
+
+	// Report the phase to the service host, if it's interested
+	if(m_timelinefunc) m_timelinefunc(phase, offset);
+}
+
+//-----------------------------------------------------------------------------
+// service::OnPauseGateOverrun (protected, virtual)
+//
+// Invoked when registered worker threads have not parked at the pause gate in time
+//
+// Arguments:
+//
+//	unparked	- Number of registered worker threads that have not parked
+//	timeout		- Time that was allowed for the threads to park, in milliseconds
+
+void service::OnPauseGateOverrun(uint32_t unparked, uint32_t timeout)
+{
+	// Default implementation does nothing; the threads will park when they reach the gate
+	UNREFERENCED_PARAMETER(unparked);
+	UNREFERENCED_PARAMETER(timeout);
+}
+
+//-----------------------------------------------------------------------------
+// service::OnPreShutdownFlushed (protected, virtual)
+//
+// Invoked when the PRESHUTDOWN flush has completed or the budget has expired
+//
+// Arguments:
+//
+//	flushed		- Total number of bytes reported as flushed
+//	abandoned	- Total number of estimated bytes that were not flushed
+//	elapsed		- Time spent flushing, in milliseconds
+
+void service::OnPreShutdownFlushed(uint64_t flushed, uint64_t abandoned, uint32_t elapsed)
+{
+	// Default implementation does nothing
+	UNREFERENCED_PARAMETER(flushed);
+	UNREFERENCED_PARAMETER(abandoned);
+	UNREFERENCED_PARAMETER(elapsed);
+}
+
+//-----------------------------------------------------------------------------
+// service::OnProgressStalled (protected, virtual)
+//
+// Invoked when explicitly reported progress has stalled during a pending status
+//
+// Arguments:
+//
+//	status		- Current pending service status
+//	step		- Most recently reported step
+//	total		- Most recently reported total number of steps
+
+void service::OnProgressStalled(ServiceStatus status, uint32_t step, uint32_t total)
+{
+	// Default implementation does nothing; the checkpoint is no longer advanced
+	UNREFERENCED_PARAMETER(status);
+	UNREFERENCED_PARAMETER(step);
+	UNREFERENCED_PARAMETER(total);
+}
+
+//-----------------------------------------------------------------------------
+// service::OnStopHandlerOverrun (protected, virtual)
+//
+// Invoked when a grouped Stop handler has overrun the group deadline
+//
+// Arguments:
+//
+//	name		- Name of the Stop handler function
+//	group		- Stop group the handler belongs to
+//	deadline	- Group deadline in milliseconds
+
+void service::OnStopHandlerOverrun(const tchar_t* name, uint32_t group, uint32_t deadline)
+{
+	// Default implementation does nothing; the handler will still be waited for
+	UNREFERENCED_PARAMETER(name);
+	UNREFERENCED_PARAMETER(group);
+	UNREFERENCED_PARAMETER(deadline);
+}
+
+//-----------------------------------------------------------------------------
+// service::OpenParameterStore (private)
+//
+// Default implementation for opening parameter storage; uses the registry
+//
+// Arguments:
+//
+//	servicename		- Name assigned to the service instance
+
+void* service::OpenParameterStore(const tchar_t* servicename)
+{
+	HKEY hkey = nullptr;
+
+	// The default implementation for service parameters reads them from the service's Parameters key in HKLM
+	if(RegCreateKeyEx(HKEY_LOCAL_MACHINE, (tstring(_T("System\\CurrentControlSet\\Services\\")) + servicename + _T("\\Parameters")).c_str(), 
+		0, nullptr, 0, KEY_READ | KEY_WRITE, nullptr, &hkey, nullptr) != ERROR_SUCCESS) return nullptr;
+
+	// The default SaveParameter() can only write to a registry key opened here
+	m_registrystore = true;
+	return hkey;
+}
+
+//-----------------------------------------------------------------------------
+// service::Pause
+//
+// Pauses the service
+//
+// Arguments:
+//
+//	NONE
+
+DWORD service::Pause(void)
+{
+	std::unique_lock<named_recursive_mutex> critsec(m_statuslock);
+
+	// Service has to be in a status of RUNNING to accept this control
+	if(m_status != ServiceStatus::Running) return ERROR_CALL_NOT_IMPLEMENTED;
+	
+	// Set the service status to PAUSE_PENDING
+	try { SetStatus(ServiceStatus::PausePending); }
+	catch(...) { Abort(std::current_exception()); }
+
+	try {
+
+		// Invoke all of the PAUSE handlers prior to setting the service to PAUSED
+		for(const auto& handler : Handlers) if(handler->Control == ServiceControl::Pause) handler->Invoke(this, 0, nullptr);
+
+		// The status lock is released while waiting for the worker threads so that a task or worker
+		// can still report progress or request a stop; PAUSE_PENDING rejects any other control
+		critsec.unlock();
+
+		// Pause the thread pool; this waits for any tasks that are currently executing
+		m_executor.Pause();
+
+		// Close the pause gate; this waits for all registered worker threads to park, but a worker
+		// that never reaches the gate cannot hold the service in PAUSE_PENDING indefinitely
+		uint32_t unparked = m_pausegate.Close(PAUSE_GATE_TIMEOUT);
+		if(unparked) OnPauseGateOverrun(unparked, PAUSE_GATE_TIMEOUT);
+
+		// The instance may have been aborted by another thread while the lock was released
+		critsec.lock();
+		if(m_aborted || (m_status != ServiceStatus::PausePending)) return ERROR_SUCCESS;
+
+		SetStatus(ServiceStatus::Paused);
+
+		// The thread pool is paused, PAUSE continuations are queued to a pool of their own
+		SubmitContinuations(ServiceControl::Pause);
+	}
+
+	catch(...) { Abort(std::current_exception()); }
+
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// service::PreShutdownFlush (private)
+//
+// Runs the registered PRESHUTDOWN flush functions in parallel on a dedicated
+// thread pool, dividing the remaining budget among them
+//
+// Arguments:
+//
+//	NONE
+
+void service::PreShutdownFlush(void)
+{
+	// flush_state
+	//
+	// State shared with the flush tasks, which may outlive this function if they overrun
+	struct flush_state
+	{
+		std::mutex								lock;
+		std::condition_variable					changed;
+		std::vector<bool>						completed;
+		std::vector<uint64_t>					flushed;
+	};
+
+	auto started = std::chrono::steady_clock::now();
+	std::vector<flusher> flushers;
+
+	{
+		std::lock_guard<std::mutex> critsec(m_flusherslock);
+		for(const auto& iterator : m_flushers) flushers.push_back(iterator.second);
+	}
+
+	if(flushers.empty()) return;
+
+	// Higher priority flushes are queued first so they get to the worker threads first
+	std::stable_sort(flushers.begin(), flushers.end(), [](const flusher& lhs, const flusher& rhs) { return lhs.Priority > rhs.Priority; });
+
+	// Weight each flush by the product of its priority and estimated size; the product is calculated
+	// in floating point since it can exceed the range of a 64-bit integer
+	std::vector<uint64_t> estimates;
+	std::vector<double> weights;
+	double totalweight = 0;
+
+	for(const auto& flush : flushers) {
+
+		uint64_t estimate = 0;
+		try { if(flush.Estimate) estimate = flush.Estimate(); }
+		catch(...) { estimate = 0; }
+
+		estimates.push_back(estimate);
+		weights.push_back(static_cast<double>(estimate) * ((flush.Priority) ? flush.Priority : 1));
+		totalweight += weights.back();
+	}
+
+	// Split whatever remains of the budget after the estimates across the flushes in proportion to their
+	// weights, or evenly if nothing was estimated.  Every flush gets at least the minimum budget
+	uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count());
+	uint32_t remaining = (elapsed < m_preshutdownbudget) ? m_preshutdownbudget - static_cast<uint32_t>(elapsed) : 0;
+
+	std::vector<uint32_t> budgets;
+	for(const auto& weight : weights) {
+
+		double share = (totalweight > 0) ? weight / totalweight : 1.0 / weights.size();
+		uint32_t budget = static_cast<uint32_t>(remaining * share);
+		budgets.push_back((budget < MINIMUM_FLUSH_BUDGET) ? MINIMUM_FLUSH_BUDGET : budget);
+	}
+
+	auto state = std::make_shared<flush_state>();
+	state->completed.assign(flushers.size(), false);
+	state->flushed.assign(flushers.size(), 0);
+
+	std::vector<std::shared_ptr<cancellation_source>> sources;
+	std::vector<bool> queued(flushers.size(), false);
+
+	// The flushes run on their own thread pool with a worker for each of them, so they neither wait
+	// behind work queued to the service thread pool nor depend on whether the service is paused
+	m_flushexecutor.Resize(static_cast<uint32_t>(flushers.size()));
+	auto flushstart = std::chrono::steady_clock::now();
+
+	for(size_t index = 0; index < flushers.size(); index++) {
+
+		sources.push_back(std::make_shared<cancellation_source>());
+
+		flush_func flush = flushers[index].Flush;
+		cancellation_token token = sources.back()->Token;
+		uint32_t budget = budgets[index];
+
+		// A flush that cannot be queued is abandoned immediately rather than waited for
+		try {
+
+			m_flushexecutor.Submit([=]() -> void {
+
+				uint64_t flushed = 0;
+				try { flushed = flush(token, budget); }
+				catch(...) { flushed = 0; }
+
+				std::lock_guard<std::mutex> critsec(state->lock);
+				state->completed[index] = true;
+				state->flushed[index] = flushed;
+				state->changed.notify_all();
+			});
+
+			queued[index] = true;
+		}
+
+		catch(winexception&) { /* DO NOTHING */ }
+	}
+
+	// Wait for each flush in order of increasing budget, cancelling any that overrun their share
+	std::vector<size_t> order;
+	for(size_t index = 0; index < flushers.size(); index++) if(queued[index]) order.push_back(index);
+	std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) { return budgets[lhs] < budgets[rhs]; });
+
+	for(const auto& index : order) {
+
+		bool completed = false;
+
+		{
+			std::unique_lock<std::mutex> critsec(state->lock);
+			completed = state->changed.wait_until(critsec, flushstart + std::chrono::milliseconds(budgets[index]), [&]() { return state->completed[index]; });
+		}
+
+		if(!completed) sources[index]->Cancel();
+	}
+
+	// Tally the results; a flush that never completed abandons its entire estimate
+	uint64_t flushed = 0, abandoned = 0;
+
+	{
+		std::lock_guard<std::mutex> critsec(state->lock);
+
+		for(size_t index = 0; index < flushers.size(); index++) {
+
+			flushed += state->flushed[index];
+			if(!state->completed[index]) abandoned += estimates[index];
+			else if(estimates[index] > state->flushed[index]) abandoned += estimates[index] - state->flushed[index];
+		}
+	}
+
+	OnPreShutdownFlushed(flushed, abandoned, static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count()));
+}
+
+//-----------------------------------------------------------------------------
+// service::QueueWarmup (private)
+//
+// Queues a single warm-up task to the service thread pool
+//
+// Arguments:
+//
+//	task		- Warm-up task to be queued
+
+void service::QueueWarmup(task_func task)
+{
+	// The warm-up task is skipped if the service has started to stop before it runs
+	auto complete = [=]() -> void {
+
+		std::lock_guard<std::mutex> critsec(m_warmuplock);
+		if(--m_warmupcount == 0) m_warmsignal.Set();
+	};
+
+	// If the thread pool has already been drained, the task is discarded
+	try {
+
+		m_executor.Submit([=]() -> void {
+
+			try { if(!m_stopsource.IsCancellationRequested) task(); }
+			catch(...) { complete(); throw; }
+
+			complete();
+		});
+	}
+
+	catch(winexception&) { complete(); }
+}
+
+//-----------------------------------------------------------------------------
+// service::RecordTransition (private)
+//
+// Records the duration of a completed transition and saves the history
+//
+// Arguments:
+//
+//	status		- Pending service status that has completed
+//	duration	- Duration of the pending status in milliseconds
+
+void service::RecordTransition(ServiceStatus status, uint32_t duration)
+{
+	std::lock_guard<named_recursive_mutex> critsec(m_statuslock);
+
+	int index = GetTransitionIndex(status);
+	if(index < 0) return;
+
+	// Durations are recorded into a circular buffer, overwriting the oldest one
+	m_history.Durations[index][m_history.Count[index] % _countof(m_history.Durations[index])] = duration;
+	++m_history.Count[index];
+
+	// Writing to the parameter store can be slow, the history is saved later without the status lock held
+	m_historydirty = true;
+}
+
+//-----------------------------------------------------------------------------
+// service::Recover (private, static)
+//
+// Replaces an aborted service instance when in-process recovery is enabled.  The control
+// handler is replaced so that the failed instance no longer receives controls, the instance
+// is destroyed in the background within a bounded time, and SERVICE_START_PENDING is reported
+// until the recovery delay has elapsed
+//
+// Arguments:
+//
+//	instance		- Service instance that has returned from Main()
+//	servicename		- Name of the service
+//	context			- Service runtime context information and callbacks
+//	attempt			- Number of consecutive recovery attempts; updated
+
+bool service::Recover(std::shared_ptr<service> instance, const tchar_t* servicename, const service_context& context, uint32_t& attempt)
+{
+	// Only an instance that aborted and unwound for in-process recovery is replaced
+	if(!instance->m_aborted) return false;
+
+	DWORD exitcode = instance->m_abortcode;
+	uint32_t cleanup = instance->RECOVERY_CLEANUP_TIMEOUT;
+	uint32_t interval = instance->PENDING_CHECKPOINT_INTERVAL;
+	uint32_t waithint = instance->PENDING_WAIT_HINT;
+
+	// An instance that ran for long enough after reaching SERVICE_RUNNING before it failed starts the backoff over
+	std::chrono::steady_clock::time_point runningstart = instance->m_runningstart;
+	if((runningstart != std::chrono::steady_clock::time_point()) &&
+		((std::chrono::steady_clock::now() - runningstart) >= std::chrono::milliseconds(instance->RECOVERY_RESET_INTERVAL))) attempt = 0;
+
+	// The delay doubles for each consecutive attempt, up to the maximum
+	bool recover = (attempt < instance->m_recoveryattempts);
+	uint32_t delay = static_cast<uint32_t>(std::min(static_cast<uint64_t>(instance->MAXIMUM_RECOVERY_DELAY),
+		static_cast<uint64_t>(instance->m_recoverydelay) << std::min(attempt, 16U)));
+
+	// Replace the control handler so the failed instance no longer receives controls; only INTERROGATE
+	// is accepted until the new instance registers its own handler
+	LPHANDLER_FUNCTION_EX handler = [](DWORD control, DWORD, void*, void*) -> DWORD {
+		return (control == SERVICE_CONTROL_INTERROGATE) ? ERROR_SUCCESS : ERROR_SERVICE_CANNOT_ACCEPT_CTRL; };
+	SERVICE_STATUS_HANDLE statushandle = context.RegisterHandlerFunc(servicename, handler, nullptr);
+
+	SERVICE_STATUS status;
+	zero_init(status).dwServiceType = static_cast<DWORD>(context.ProcessType);
+
+	// The dependency tracker outlives the instance; it has to be told if the service is not coming back
+	dependency_tracker* dependencies = instance->m_dependencies;
+	tstring name = instance->m_servicename;
+
+	// Destroy the failed instance in the background; it's abandoned if that takes longer than the cleanup time
+	auto destroyed = std::make_shared<signal<signal_type::ManualReset>>();
+	std::thread([destroyed, instance = std::move(instance)]() mutable { instance.reset(); destroyed->Set(); }).detach();
+
+	// Out of attempts: the service stops with the exit code of the failure once the instance is gone
+	if(!recover || (statushandle == 0)) {
+
+		destroyed->Wait(cleanup);
+
+		status.dwCurrentState = SERVICE_STOPPED;
+		status.dwWin32ExitCode = exitcode;
+		if(statushandle) context.SetStatusFunc(statushandle, &status);
+		if(dependencies) dependencies->SetStatus(name, ServiceStatus::Stopped);
+
+		return false;
+	}
+
+	++attempt;
+	if(context.ReportRecoveryFunc) context.ReportRecoveryFunc(exitcode, attempt, delay);
+
+	// Report SERVICE_START_PENDING and advance the checkpoint until the instance has been destroyed
+	// (or abandoned) and the delay has elapsed
+	status.dwCurrentState = SERVICE_START_PENDING;
+	status.dwCheckPoint = 1;
+	status.dwWaitHint = waithint;
+	context.SetStatusFunc(statushandle, &status);
+
+	auto abandon = std::chrono::steady_clock::now() + std::chrono::milliseconds(cleanup);
+	while(!destroyed->Wait(interval) && (std::chrono::steady_clock::now() < abandon)) {
+
+		++status.dwCheckPoint;
+		context.SetStatusFunc(statushandle, &status);
+	}
+
+	auto restart = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+	for(auto now = std::chrono::steady_clock::now(); now < restart; now = std::chrono::steady_clock::now()) {
+
+		std::this_thread::sleep_for(std::min(std::chrono::duration_cast<std::chrono::milliseconds>(restart - now), std::chrono::milliseconds(interval)));
+
+		++status.dwCheckPoint;
+		context.SetStatusFunc(statushandle, &status);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// service::RegisterFlush (protected)
+//
+// Registers a function to flush buffered data when PRESHUTDOWN is received
+//
+// Arguments:
+//
+//	priority	- Flush priority; higher priority flushes are started first
+//	estimate	- Function that estimates the number of bytes to be flushed
+//	flush		- Function that flushes the buffered data
+
+uint32_t service::RegisterFlush(uint32_t priority, flush_estimate_func estimate, flush_func flush)
+{
+	if(!flush) throw winexception(ERROR_INVALID_PARAMETER);
+
+	std::lock_guard<std::mutex> critsec(m_flusherslock);
+
+	uint32_t cookie = m_nextflusher++;
+	flusher entry = { priority, estimate, flush };
+	m_flushers.insert(std::make_pair(cookie, entry));
+
+	return cookie;
+}
+
+//-----------------------------------------------------------------------------
+// service::ReloadParameters
+//
+// Reloads the values for all bound parameter member variables
+//
+// Arguments:
+//
+//	NONE
+
+void service::ReloadParameters(void)
+{
+	// Iterate each parameter and reload it's value from storage; this is done on the calling thread
+	// since the service-defined PARAMCHANGE handlers need to see the updated values
+	IterateParameters([=](const tstring& name, parameter_base& param) {
+
+		SVCTL_TRACE("ParameterLoadBegin", TraceLoggingValue(name.c_str(), "Name"));
+		bool loaded = param.TryLoad();
+		SVCTL_TRACE("ParameterLoadEnd", TraceLoggingValue(name.c_str(), "Name"), TraceLoggingBoolean(loaded, "Loaded"));
+		UNREFERENCED_PARAMETER(name);
+		UNREFERENCED_PARAMETER(loaded);
+	});
+
+	m_recorder->Record(flight_event::ParametersReloaded);
+}
+
+//-----------------------------------------------------------------------------
+// service::ReportProgress
+//
+// Reports explicit progress during a pending service status
+//
+// Arguments:
+//
+//	step		- Current step
+//	total		- Total number of steps, or zero if unknown
+//	waithint	- Wait hint for the next step in milliseconds, or zero to leave unchanged
+
+void service::ReportProgress(uint32_t step, uint32_t total, uint32_t waithint)
+{
+	if((total != 0) && (step > total)) throw winexception(ERROR_INVALID_PARAMETER);
+
+	// This does not acquire the status lock so that progress can be reported from any thread,
+	// the pending status worker thread is responsible for actually reporting the new checkpoint
+	{
+		std::lock_guard<std::mutex> critsec(m_progresslock);
+
+		++m_progress.Sequence;
+		m_progress.Step = step;
+		m_progress.Total = total;
+		m_progress.WaitHint = waithint;
+	}
+
+	m_progresssignal.Set();
+}
+
+//-----------------------------------------------------------------------------
+// service::RetainListener (protected)
+//
+// Hands a listening socket created by the service over to the service host, which keeps it
+// open while the service is restarted.  The service must not close the socket
+//
+// Arguments:
+//
+//	name		- Name of the listening socket
+//	socket		- Listening socket
+
+void service::RetainListener(const tchar_t* name, uintptr_t socket)
+{
+	if(name == nullptr) throw winexception(E_INVALIDARG);
+
+	// The service host has to provide a registry to keep the socket open
+	if(!m_listeners) throw winexception(ERROR_NOT_SUPPORTED);
+	m_listeners->Add(name, socket);
+}
+
+//-----------------------------------------------------------------------------
+// service::SaveFlightRecorder (protected)
+//
+// Saves a binary dump of the flight recorder to the parameter store
+//
+// Arguments:
+//
+//	NONE
+
+void service::SaveFlightRecorder(void)
+{
+	std::lock_guard<std::mutex> critsec(m_paramstorelock);
+
+	// The dump can only be saved while the parameter store is open
+	if(!m_paramhandle || !m_paramsaver) return;
+
+	// A parameter store that the service cannot write to is skipped
+	std::vector<uint8_t> dump = m_recorder->Dump();
+	try { m_paramsaver(m_paramhandle, FLIGHT_RECORDER_PARAMETER, ServiceParameterFormat::Binary, dump.data(), dump.size()); }
+	catch(winexception& ex) { if(ex.code() != ERROR_NOT_SUPPORTED) throw; }
+}
+
+//-----------------------------------------------------------------------------
+// service::SaveParameter (private)
+//
+// Default implementation for saving a value to parameter storage
+//
+// Arguments:
+//
+//	handle		- Handle returned from OpenParameterStore
+//	name		- Parameter value name
+//	format		- Parameter value format
+//	buffer		- Buffer containing the parameter value
+//	length		- Length of the buffer
+
+void service::SaveParameter(void* handle, const tchar_t* name, ServiceParameterFormat format, const void* buffer, size_t length)
+{
+	DWORD type = REG_BINARY;
+
+	// A service that provides its own parameter store has to provide its own SaveParameter() as well
+	if(!m_registrystore) throw winexception(ERROR_NOT_SUPPORTED);
+
+	// ServiceParameterFormat is a set of RegGetValue() flags, convert it into a registry data type
+	switch(format) {
+
+		case ServiceParameterFormat::DWord: type = REG_DWORD; break;
+		case ServiceParameterFormat::MultiString: type = REG_MULTI_SZ; break;
+		case ServiceParameterFormat::QWord: type = REG_QWORD; break;
+		case ServiceParameterFormat::String: type = REG_SZ; break;
+	}
+
+	LSTATUS result = RegSetValueEx(reinterpret_cast<HKEY>(handle), name, 0, type, reinterpret_cast<const BYTE*>(buffer), static_cast<DWORD>(length));
+	if(result != ERROR_SUCCESS) throw winexception(result);
+}
+
+//-----------------------------------------------------------------------------
+// service::Main
+//
+// Service instance entry point
+//
+// Arguments:
+//
+//	argc				- Number of command line arguments
+//	argv				- Array of command line argument strings
+//	context				- Service runtime context information and callbacks
+
+void service::Main(int argc, tchar_t** argv, const service_context& context)
+{
+	using namespace std::placeholders;
+
+	void* paramhandle = nullptr;					// Service parameters handle
+
+	_ASSERTE(context.RegisterHandlerFunc);
+	if(!context.RegisterHandlerFunc) throw winexception(ERROR_INVALID_PARAMETER);
+
+	_ASSERTE(context.SetStatusFunc);
+	if(!context.SetStatusFunc) throw winexception(ERROR_INVALID_PARAMETER);
+
+	// Use the service host's flight recorder if it provided one
+	if(context.FlightRecorder) m_recorder = context.FlightRecorder;
+
+	// In-process dependencies are tracked by name when the service host provides a tracker
+	m_servicename = argv[0];
+	m_dependencies = context.Dependencies;
+
+	// Listening sockets kept open by the service host are available to OnStart()
+	m_listeners = context.Listeners;
+
+	// Start the lifecycle timeline; phases are optionally reported to the service host as well
+	m_timelinestart = std::chrono::steady_clock::now();
+	m_timelinefunc = context.ReportPhaseFunc;
+	MarkPhase(_T("RegisterHandler"));
+
+	// Define a static HandlerEx callback that calls back into this service instance; SHUTDOWN and PRESHUTDOWN
+	// are broadcast to every service in the process when the service host provides a broadcaster
+	LPHANDLER_FUNCTION_EX handler = [](DWORD control, DWORD eventtype, void* eventdata, void* context) -> DWORD {
+
+		service* instance = reinterpret_cast<service*>(context);
+		if(instance->m_shutdown && shutdown_broadcaster::IsBroadcastControl(static_cast<ServiceControl>(control)))
+			return instance->m_shutdown->Broadcast(instance->m_servicename, static_cast<ServiceControl>(control), eventtype, eventdata);
+
+		DWORD result = ERROR_PROCESS_ABORTED;
+		instance->Unwindable([&]() { result = instance->ControlHandler(static_cast<ServiceControl>(control), eventtype, eventdata); });
+		return result; };
+
+	// Register a service control handler for this service instance
+	SERVICE_STATUS_HANDLE statushandle = context.RegisterHandlerFunc(argv[0], handler, this);
+	if(statushandle == 0) throw winexception();
+
+	// Allow broadcast controls to be sent to this service on behalf of any service in the process.  The
+	// service control manager only sends the controls to services that accept them, the broadcast must not
+	// invoke the handlers of any other service
+	m_shutdown = context.ShutdownBroadcaster;
+	if(m_shutdown) m_shutdown->Attach(m_servicename, [=](ServiceControl control, DWORD eventtype, void* eventdata) -> DWORD {
+
+		DWORD accept = (control == ServiceControl::Shutdown) ? SERVICE_ACCEPT_SHUTDOWN : SERVICE_ACCEPT_PRESHUTDOWN;
+		if((AcceptedControls & accept) != accept) return ERROR_CALL_NOT_IMPLEMENTED;
+
+		DWORD result = ERROR_PROCESS_ABORTED;
+		Unwindable([&]() { result = ControlHandler(control, eventtype, eventdata); });
+		return result;
+	});
+
+	// Explicit progress is optionally reported to the service host as well as the SCM
+	m_progressfunc = context.ReportProgressFunc;
+
+	// Define a status reporting function that uses the handle and process type defined above
+	m_statusfunc = [=](SERVICE_STATUS& status) -> void {
+
+		_ASSERTE(statushandle != 0);
+		m_recorder->Record(flight_event::StatusReported, status.dwCurrentState, status.dwCheckPoint, status.dwWaitHint);
+		if(status.dwCheckPoint) SVCTL_TRACE("Checkpoint", TraceLoggingUInt32(status.dwCurrentState, "Status"), TraceLoggingUInt32(status.dwCheckPoint, "CheckPoint"),
+			TraceLoggingUInt32(status.dwWaitHint, "WaitHint"));
+		status.dwServiceType = static_cast<DWORD>(context.ProcessType);
+		if(!context.SetStatusFunc(statushandle, &status)) throw winexception();
+	};
+
+	try {
+
+		// Open the parameter storage for this instance before reporting SERVICE_START_PENDING so that
+		// the wait hint can be derived from the transition history; START_PENDING must still be
+		// reported before the service is stopped if this fails
+		MarkPhase(_T("OpenParameterStore"));
+		try { paramhandle = (context.OpenParameterStore) ? context.OpenParameterStore(argv[0]) : OpenParameterStore(argv[0]); }
+		catch(...) { SetStatus(ServiceStatus::StartPending); throw; }
+
+		load_parameter_func paramloader = (context.LoadParameter) ? context.LoadParameter : std::bind(&service::LoadParameter, this, _1, _2, _3, _4, _5);
+
+		// Load the transition history; if it's missing or the wrong size start with an empty one
+		if(paramhandle) {
+
+			std::lock_guard<named_recursive_mutex> critsec(m_statuslock);
+
+			try { if(paramloader(paramhandle, TRANSITION_HISTORY_PARAMETER, ServiceParameterFormat::Binary, &m_history, sizeof(transition_history)) != sizeof(transition_history)) m_history = transition_history(); }
+			catch(...) { m_history = transition_history(); }
+
+			std::lock_guard<std::mutex> storecritsec(m_paramstorelock);
+			m_paramhandle = paramhandle;
+			m_paramsaver = (context.SaveParameter) ? context.SaveParameter : std::bind(&service::SaveParameter, this, _1, _2, _3, _4, _5);
+		}
+
+		// Service is starting; report SERVICE_START_PENDING
+		SetStatus(ServiceStatus::StartPending);
+
+		// Bind and load all of the service parameters
+		MarkPhase(_T("LoadParameters"));
+		IterateParameters([=](const tstring& name, parameter_base& param) {
+
+			param.Bind(paramhandle, name.c_str(), paramloader);
+
+			SVCTL_TRACE("ParameterLoadBegin", TraceLoggingValue(name.c_str(), "Name"));
+			bool loaded = param.TryLoad();
+			SVCTL_TRACE("ParameterLoadEnd", TraceLoggingValue(name.c_str(), "Name"), TraceLoggingBoolean(loaded, "Loaded"));
+			UNREFERENCED_PARAMETER(loaded);
+		});
+
+		// Size the thread pool from the parameter store; if not present the number of processors is used
+		if(paramhandle) {
+
+			uint32_t poolsize = 0;
+			try { paramloader(paramhandle, THREADPOOL_SIZE_PARAMETER, ServiceParameterFormat::DWord, &poolsize, sizeof(uint32_t)); }
+			catch(...) { poolsize = 0; }
+
+			m_executor.Resize(poolsize);
+
+			// Read the PRESHUTDOWN flush budget from the parameter store; if not present use the default
+			uint32_t budget = 0;
+			try { paramloader(paramhandle, PRESHUTDOWN_TIMEOUT_PARAMETER, ServiceParameterFormat::DWord, &budget, sizeof(uint32_t)); }
+			catch(...) { budget = 0; }
+
+			if(budget) m_preshutdownbudget = budget;
+
+			// In-process recovery is only enabled if the number of attempts has been set in the parameter store
+			try { paramloader(paramhandle, RECOVERY_ATTEMPTS_PARAMETER, ServiceParameterFormat::DWord, &m_recoveryattempts, sizeof(uint32_t)); }
+			catch(...) { m_recoveryattempts = 0; }
+
+			uint32_t delay = 0;
+			try { paramloader(paramhandle, RECOVERY_DELAY_PARAMETER, ServiceParameterFormat::DWord, &delay, sizeof(uint32_t)); }
+			catch(...) { delay = 0; }
+
+			if(delay) m_recoverydelay = delay;
+
+			// Read the limit on the time to wait for in-process dependencies; if not present use the default
+			uint32_t dependencytimeout = 0;
+			try { paramloader(paramhandle, DEPENDENCY_TIMEOUT_PARAMETER, ServiceParameterFormat::DWord, &dependencytimeout, sizeof(uint32_t)); }
+			catch(...) { dependencytimeout = 0; }
+
+			if(dependencytimeout) m_dependencytimeout = dependencytimeout;
+		}
+
+		// Wait for the in-process services this service depends on to be running
+		bool stopped = false;
+		if(m_dependencies) {
+
+			MarkPhase(_T("WaitForDependencies"));
+			stopped = !WaitForDependencies();
+		}
+
+		// A service that was stopped while it was waiting for its dependencies is never started
+		if(stopped) SetStatus(ServiceStatus::Stopped);
+		else {
+
+			// Invoke derived service class startup code
+			MarkPhase(_T("OnStart"));
+			OnStart(argc, argv);
+
+			// Allow the service to be stopped before any of the in-process services it depends on
+			if(m_dependencies) m_dependencies->Attach(m_servicename, [=]() { Unwindable([=]() { Stop(); }); });
+
+			// Service is now running; queue any warm-up tasks registered by OnStart() and wait for
+			// the event indicating SERVICE_STOPPED has been set
+			MarkPhase(_T("SetRunning"));
+			SetStatus(ServiceStatus::Running);
+			m_runningstart = std::chrono::steady_clock::now();
+			SaveTransitionHistory();
+			StartWarmup();
+			MarkPhase(_T("Running"));
+			m_stopsignal.Wait();
+		}
+	}
+
+	// Set the service to STOPPED on an unhandled winexception, translating ERROR_SUCCESS into ERROR_SERVICE_SPECIFIC.
+	// If the exception thrown is unknown use a generic ERROR_UNHANDLED_EXCEPTION as the stop code
+	catch(winexception& ex) { TrySetStatus(ServiceStatus::Stopped, (ex.code() != ERROR_SUCCESS) ? ex.code() : ERROR_SERVICE_SPECIFIC_ERROR); }
+	catch(...) { TrySetStatus(ServiceStatus::Stopped, ERROR_UNHANDLED_EXCEPTION); }
+
+	// Wait for any stop requested on behalf of a service this service depends on to return
+	if(m_dependencies) m_dependencies->Detach(m_servicename);
+
+	// Wait for any broadcast control sent on behalf of another service to return
+	if(m_shutdown) m_shutdown->Detach(m_servicename);
+
+	// Save the transition history a final time, unbind all of the service parameters and close the parameter storage
+	MarkPhase(_T("CloseParameterStore"));
+	SaveTransitionHistory();
+	{
+		std::lock_guard<std::mutex> critsec(m_paramstorelock);
+		m_paramhandle = nullptr;
+	}
+
+	IterateParameters([](const tstring&, parameter_base& param) { param.Unbind(); });
+	if(context.CloseParameterStore) context.CloseParameterStore(paramhandle);
+	else CloseParameterStore(paramhandle);
+
+	// Close the timeline and write it to the debugger output
+	MarkPhase(_T("Exit"));
+	DumpTimeline();
+}
+
+//-----------------------------------------------------------------------------
+// service::SaveTransitionHistory (private)
+//
+// Saves the transition history to the parameter store if it has changed
+//
+// Arguments:
+//
+//	NONE
+
+void service::SaveTransitionHistory(void)
+{
+	transition_history history;
+
+	// Take a copy of the history under the status lock, but write it without holding that lock
+	{
+		std::lock_guard<named_recursive_mutex> critsec(m_statuslock);
+
+		if(!m_historydirty) return;
+		history = m_history;
+		m_historydirty = false;
+	}
+
+	std::lock_guard<std::mutex> critsec(m_paramstorelock);
+	if(!m_paramhandle || !m_paramsaver) return;
+
+	// The history is only advisory; failure to persist it is not a reason to fail the service
+	try { m_paramsaver(m_paramhandle, TRANSITION_HISTORY_PARAMETER, ServiceParameterFormat::Binary, &history, sizeof(transition_history)); }
+	catch(...) { /* DO NOTHING */ }
+}
+
+//-----------------------------------------------------------------------------
+// service::SetNonPendingStatus (private)
+//
+// Sets a non-pending service status
+//
+// Arguments:
+//
+//	status				- New service status to set
+//	win32exitcode		- Win32 service exit code for ServiceStatus::Stopped (see documentation)
+//	serviceexitcode		- Service specific exit code for ServiceStatus::Stopped (see documentation)
+
+void service::SetNonPendingStatus(ServiceStatus status, uint32_t win32exitcode, uint32_t serviceexitcode)
+{
+	std::lock_guard<named_recursive_mutex> critsec(m_statuslock);
+
+	_ASSERTE(m_statusfunc);							// Needs to be set
+	_ASSERTE(!m_statusworker.joinable());			// Should not be running
+
+	// Create and initialize a new SERVICE_STATUS for this operation
+	SERVICE_STATUS newstatus;
+	newstatus.dwServiceType = 0;		// <-- Set by m_statusfunc
+	newstatus.dwCurrentState = static_cast<DWORD>(status);
+	newstatus.dwControlsAccepted = (status == ServiceStatus::Stopped) ? 0 : AcceptedControls;
+	newstatus.dwWin32ExitCode = (status == ServiceStatus::Stopped) ? win32exitcode : ERROR_SUCCESS;
+	newstatus.dwServiceSpecificExitCode = (status == ServiceStatus::Stopped) ? serviceexitcode : ERROR_SUCCESS;
+	newstatus.dwCheckPoint = 0;
+	newstatus.dwWaitHint = 0;
+
+	m_statusfunc(newstatus);						// Set the non-pending status
+}
+
+//-----------------------------------------------------------------------------
+// service::SetPendingStatus (private)
+//
+// Sets an automatically checkpointed pending service status
+//
+// Arguments:
+//
+//	status				- Pending service status to set
+
+void service::SetPendingStatus(ServiceStatus status)
+{
+	std::lock_guard<named_recursive_mutex> critsec(m_statuslock);
+
+	_ASSERTE(m_statusfunc);							// Needs to be set
+	_ASSERTE(!m_statusworker.joinable());			// Should not be running
+
+	// Block all controls during SERVICE_START_PENDING and SERVICE_STOP_PENDING, otherwise only block
+	// controls that would result in a service status change while a status change is pending
+	DWORD accept = ((status == ServiceStatus::StartPending) || (status == ServiceStatus::StopPending)) ? 0 
+		: (AcceptedControls & ~(SERVICE_ACCEPT_STOP | SERVICE_ACCEPT_PAUSE_CONTINUE | SERVICE_ACCEPT_SHUTDOWN));
+
+	// Set the initial pending status before launching the worker thread
+	SERVICE_STATUS newstatus;
+	newstatus.dwServiceType = 0;			// <-- Set by m_statusfunc
+	newstatus.dwCurrentState = static_cast<DWORD>(status);
+	newstatus.dwControlsAccepted = accept;
+	newstatus.dwWin32ExitCode = ERROR_SUCCESS;
+	newstatus.dwServiceSpecificExitCode = ERROR_SUCCESS;
+	newstatus.dwCheckPoint = 1;
+	newstatus.dwWaitHint = GetWaitHint(status);
+	m_statusfunc(newstatus);
+
+	// Automatic checkpoints are reported more frequently for shorter wait hints
+	uint32_t interval = GetCheckpointInterval(newstatus.dwWaitHint);
+
+	// Discard any progress reported during a previous pending status
+	{
+		std::lock_guard<std::mutex> progresscritsec(m_progresslock);
+		m_progress = progress();
+		m_progresssignal.Reset();
+	}
+
+	// Kick off a new worker thread to manage the automatic checkpoint operation
+	m_statusworker = std::move(std::thread([=]() {
+
+		try {
+
+			// Copy the previous SERVICE_STATUS into a structure on the thread's stack
+			SERVICE_STATUS pendingstatus = newstatus;
+
+			uint32_t sequence = 0;							// Last reported progress sequence
+			bool stalled = false;							// Flag if stall has been reported
+			auto lastprogress = std::chrono::steady_clock::now();
+
+			// Until signaled, report the pending status with an incremented checkpoint; once the service
+			// has reported explicit progress the checkpoint is only incremented when it does so again
+			while(signal_base::WaitAny({ m_statussignal, m_progresssignal }, interval) != WAIT_OBJECT_0) {
+
+				progress current;
+				{
+					std::lock_guard<std::mutex> progresscritsec(m_progresslock);
+					current = m_progress;
+				}
+
+				// Explicit progress: report the new checkpoint and wait hint
+				if(current.Sequence != sequence) {
+
+					sequence = current.Sequence;
+					stalled = false;
+					lastprogress = std::chrono::steady_clock::now();
+
+					++pendingstatus.dwCheckPoint;
+					if(current.WaitHint) pendingstatus.dwWaitHint = current.WaitHint;
+					m_statusfunc(pendingstatus);
+
+					if(m_progressfunc) m_progressfunc(status, current.Step, current.Total, pendingstatus.dwWaitHint);
+				}
+
+				// Automatic progress: nothing has been reported explicitly
+				else if(sequence == 0) {
+
+					++pendingstatus.dwCheckPoint;
+					m_statusfunc(pendingstatus);
+				}
+
+				// Explicit progress that has not advanced within the wait hint has stalled
+				else if(!stalled && (std::chrono::steady_clock::now() - lastprogress) > std::chrono::milliseconds(pendingstatus.dwWaitHint)) {
+
+					stalled = true;
+					OnProgressStalled(status, current.Step, current.Total);
+				}
+			}
+		}
+
+		// Copy any worker thread exceptions into the m_statusexception member variable,
+		// this can be checked on the next call to SetStatus()
+		catch(...) { m_statusexception = std::current_exception(); }
+	}));
+}
+
+//-----------------------------------------------------------------------------
+// service::SetStatus (private)
+//
+// Sets a new service status; pending vs. non-pending is handled automatically
+//
+// Arguments:
+//
+//	status			- New service status to set
+//	win32exitcode	- Win32 specific exit code for ServiceStatus::Stopped (see documentation)
+//	serviceexitcode	- Service-specific exit code for ServiceStatus::Stopped (see documentation)
+
+void service::SetStatus(ServiceStatus status, uint32_t win32exitcode, uint32_t serviceexitcode)
+{
+	std::lock_guard<named_recursive_mutex> critsec(m_statuslock);
+
+	// Check for a duplicate status; pending states are managed automatically
+	if(status == m_status) return;
+
+	SVCTL_TRACE("SetStatus", TraceLoggingUInt32(static_cast<uint32_t>(m_status), "PreviousStatus"), TraceLoggingUInt32(static_cast<uint32_t>(status), "Status"),
+		TraceLoggingUInt32(win32exitcode, "Win32ExitCode"), TraceLoggingUInt32(serviceexitcode, "ServiceExitCode"));
+
+	// Check for a pending service state operation
+	if(m_statusworker.joinable()) {
+
+		// Cancel the pending state checkpoint thread by signaling it and waiting for it to exit
+		m_statussignal.Set();
+		m_statusworker.join();
+		m_statussignal.Reset();
+
+		// Check for the presence of an exception from the worker thread and rethrow it
+		if(m_statusexception) std::rethrow_exception(m_statusexception);
+	}
+
+	// Record how long a successful transition took to complete; a service that stops with
+	// an error, or a transition that was aborted, isn't representative of a healthy one
+	if((GetTransitionIndex(m_status) >= 0) && (GetTransitionIndex(status) < 0) && (win32exitcode == ERROR_SUCCESS))
+		RecordTransition(m_status, static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_transitionstart).count()));
+
+	// Invoke the proper status helper based on the type of status being set
+	switch(status) {
+
+		// Pending status codes
+		case ServiceStatus::StartPending:
+		case ServiceStatus::StopPending:
+		case ServiceStatus::ContinuePending:
+		case ServiceStatus::PausePending:
+			SetPendingStatus(status);
+			break;
+
+		// Non-pending status codes without an exit status
 		case ServiceStatus::Running:
 		case ServiceStatus::Paused:
 			SetNonPendingStatus(status);
 			break;
 
-		// Non-pending status codes that report exit status
-		case ServiceStatus::Stopped:
-			SetNonPendingStatus(status, win32exitcode, serviceexitcode);
-			break;
+		// Non-pending status codes that report exit status
+		case ServiceStatus::Stopped:
+			SetNonPendingStatus(status, win32exitcode, serviceexitcode);
+			break;
+
+		// Invalid status code
+		default: throw winexception(E_INVALIDARG);
+	}
+	
+	m_status = status;						// Service status has been changed		
+	if(GetTransitionIndex(status) >= 0) m_transitionstart = std::chrono::steady_clock::now();
+
+	if(m_dependencies) m_dependencies->SetStatus(m_servicename, status);
+}
+
+//-----------------------------------------------------------------------------
+// service::StartWarmup (private)
+//
+// Queues the warm-up tasks registered during OnStart() to the service thread pool
+//
+// Arguments:
+//
+//	NONE
+
+void service::StartWarmup(void)
+{
+	std::vector<task_func> tasks;
+
+	{
+		std::lock_guard<std::mutex> critsec(m_warmuplock);
+
+		m_warmupstarted.store(true);
+		tasks.swap(m_warmuptasks);
+
+		// The service is already warm if no warm-up tasks were registered
+		if(m_warmupcount == 0) m_warmsignal.Set();
+	}
+
+	for(auto& task : tasks) QueueWarmup(std::move(task));
+}
+
+//-----------------------------------------------------------------------------
+// service::Stop
+//
+// Stops the service
+//
+// Arguments:
+//
+//	win32exitcode		- Win32 service exit code
+//	serviceexitcode		- Service specific exit code
+
+DWORD service::Stop(DWORD win32exitcode, DWORD serviceexitcode)
+{
+	std::unique_lock<named_recursive_mutex> critsec(m_statuslock);
+
+	// A service that is still waiting for its in-process dependencies is stopped by interrupting the
+	// wait; Main() then reports SERVICE_STOPPED without invoking OnStart()
+	if((m_status == ServiceStatus::StartPending) && m_dependencywait) { m_stopsource.Cancel(); return ERROR_SUCCESS; }
+
+	// Service cannot be stopped unless it's RUNNING or PAUSED, this could cause
+	// potential race conditions in the derived service class; better to block it
+	if(m_status != ServiceStatus::Running && m_status != ServiceStatus::Paused) return ERROR_CALL_NOT_IMPLEMENTED;
+
+	// An instance that aborted for in-process recovery is about to be replaced
+	if(m_aborted) return ERROR_CALL_NOT_IMPLEMENTED;
+
+	// Set the service status to STOP_PENDING
+	MarkPhase(_T("SetStopPending"));
+	try { SetStatus(ServiceStatus::StopPending); }
+	catch(...) { Abort(std::current_exception()); }
+
+	// The status lock is released while the service winds down so that handlers, tasks and worker threads
+	// can still report progress or call Stop() themselves; STOP_PENDING rejects any other control
+	critsec.unlock();
+
+	// Stop the in-process services that depend on this service while it is still fully available
+	if(m_dependencies) {
+
+		MarkPhase(_T("StopDependents"));
+		m_dependencies->StopDependents(m_servicename);
+	}
+
+	// Trigger the stop token, release any parked worker threads and resume the thread pool prior to
+	// invoking the STOP handlers, otherwise a worker could never be joined if the service was paused
+	// and grouped STOP handlers would be held in the thread pool queues
+	m_stopsource.Cancel();
+	m_pausegate.Open();
+	m_executor.Resume();
+
+	try {
+
+		// Invoke all of the STOP handlers prior to setting the service to STOPPED
+		InvokeStopHandlers();
+
+		// Queue any STOP continuations and wait for all tasks queued to the thread pool to complete
+		MarkPhase(_T("DrainThreadPool"));
+		SubmitContinuations(ServiceControl::Stop);
+		m_executor.Drain();
+
+		// Wait for any PRESHUTDOWN flush that overran its budget and was cancelled, and for any PAUSE
+		// continuation, to return
+		m_flushexecutor.Drain();
+		m_pauseexecutor.Drain();
+
+		// The instance may have been aborted by another thread while the lock was released
+		critsec.lock();
+		if(m_aborted) return ERROR_SUCCESS;
+
+		MarkPhase(_T("SetStopped"));
+		SetStatus(ServiceStatus::Stopped, win32exitcode, serviceexitcode);
+	}
+
+	catch(...) { Abort(std::current_exception()); }
+
+	m_stopsignal.Set();				// Signal the exit from the main thread
+
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// service::SubmitContinuations (private)
+//
+// Queues the one-shot tasks registered for a control to the service thread pool
+//
+// Arguments:
+//
+//	control		- Service control that has been processed
+
+void service::SubmitContinuations(ServiceControl control)
+{
+	std::vector<task_func> tasks;
+
+	// Remove the tasks from the collection under the lock, but submit them outside of it
+	{
+		std::lock_guard<std::mutex> critsec(m_continuationslock);
+
+		auto range = m_continuations.equal_range(control);
+		for(auto iterator = range.first; iterator != range.second; iterator++) tasks.push_back(std::move(iterator->second));
+		m_continuations.erase(range.first, range.second);
+	}
+
+	// PAUSE continuations run while the service thread pool is paused; a single thread is enough
+	// for them since they are expected to be brief (this has no effect once it has been created)
+	thread_pool& executor = (control == ServiceControl::Pause) ? m_pauseexecutor : m_executor;
+	if(control == ServiceControl::Pause) m_pauseexecutor.Resize(1);
+
+	// If the thread pool has already been drained the tasks are silently discarded
+	for(auto& task : tasks) {
+
+		try { executor.Submit(std::move(task)); }
+		catch(winexception&) { /* DO NOTHING */ }
+	}
+}
+
+//-----------------------------------------------------------------------------
+// service::SubmitOnControl (protected)
+//
+// Queues a one-shot task to the service thread pool the next time a control
+// has been processed
+//
+// Arguments:
+//
+//	control		- Service control to wait for
+//	task		- Task to be executed
+
+void service::SubmitOnControl(ServiceControl control, task_func task)
+{
+	// INTERROGATE is never dispatched to the service
+	if(control == ServiceControl::Interrogate) throw winexception(ERROR_INVALID_PARAMETER);
+	if(!task) throw winexception(ERROR_INVALID_PARAMETER);
+
+	std::lock_guard<std::mutex> critsec(m_continuationslock);
+	m_continuations.insert(std::make_pair(control, std::move(task)));
+}
+
+//-----------------------------------------------------------------------------
+// service::SubmitWarmup (protected)
+//
+// Registers a warm-up task to be executed on the service thread pool
+//
+// Arguments:
+//
+//	task		- Warm-up task to be executed
+
+void service::SubmitWarmup(task_func task)
+{
+	if(!task) throw winexception(ERROR_INVALID_PARAMETER);
+
+	std::unique_lock<std::mutex> critsec(m_warmuplock);
+
+	// The service is no longer warm while there are outstanding warm-up tasks
+	if(m_warmupcount++ == 0) m_warmsignal.Reset();
+
+	// Tasks registered before SERVICE_RUNNING are held until it has been reported
+	if(!m_warmupstarted.load()) { m_warmuptasks.push_back(std::move(task)); return; }
+
+	critsec.unlock();
+	QueueWarmup(std::move(task));
+}
+
+//-----------------------------------------------------------------------------
+// service::TrySetStatus (private)
+//
+// Exception-safe version of SetStatus(), should only be used when an exception
+// cannot be dealt with, like when stopping the service from another exception
+//
+// Arguments:
+//
+//	status			- New service status to set
+//	win32exitcode	- Win32 specific exit code for ServiceStatus::Stopped (see documentation)
+//	serviceexitcode	- Service-specific exit code for ServiceStatus::Stopped (see documentation)
+
+bool service::TrySetStatus(ServiceStatus status, uint32_t win32exitcode, uint32_t serviceexitcode)
+{
+	// Attempt to change the service status and just eat any thrown exceptions
+	try { SetStatus(status, win32exitcode, serviceexitcode); }
+	catch(...) { return false; }
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// service::Unwindable (private)
+//
+// Invokes a function that Abort() can unwind rather than hang when in-process recovery
+// is enabled; used wherever a thread enters the service from the service host
+//
+// Arguments:
+//
+//	func		- Function to be invoked
+
+bool service::Unwindable(std::function<void(void)> func)
+{
+	++t_abortframes;
+
+	try { func(); }
+	catch(abort_exception&) { --t_abortframes; return false; }
+	catch(...) { --t_abortframes; throw; }
+
+	--t_abortframes;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// service::UnregisterFlush (protected)
+//
+// Removes a function registered with RegisterFlush
+//
+// Arguments:
+//
+//	cookie		- Cookie returned from RegisterFlush
+
+void service::UnregisterFlush(uint32_t cookie)
+{
+	std::lock_guard<std::mutex> critsec(m_flusherslock);
+	m_flushers.erase(cookie);
+}
+
+//-----------------------------------------------------------------------------
+// service::WaitForDependencies (private)
+//
+// Waits for the in-process services this service depends on to be running; returns
+// false if the service was stopped while it was waiting
+//
+// Arguments:
+//
+//	NONE
+
+bool service::WaitForDependencies(void)
+{
+	{
+		std::lock_guard<named_recursive_mutex> critsec(m_statuslock);
+		m_dependencywait = true;
+	}
+
+	// The wait is interrupted by the stop token, and fails if it takes longer than the timeout
+	bool available = false;
+	try { available = m_dependencies->WaitForDependencies(m_servicename, m_stopsource.Token, m_dependencytimeout); }
+	catch(...) {
+
+		std::lock_guard<named_recursive_mutex> critsec(m_statuslock);
+		m_dependencywait = false;
+		throw;
+	}
+
+	// Stop() cancels the token while holding the status lock, so once the flag has been cleared under the
+	// same lock a stop request has either been seen here or is rejected like any other during START_PENDING
+	std::lock_guard<named_recursive_mutex> critsec(m_statuslock);
+	m_dependencywait = false;
+
+	return available && !m_stopsource.Token.IsCancellationRequested;
+}
+
+//-----------------------------------------------------------------------------
+// service::WaitForWarm (protected)
+//
+// Waits for all warm-up tasks to complete
+//
+// Arguments:
+//
+//	timeout		- Amount of time, in milliseconds, to wait
+
+bool service::WaitForWarm(uint32_t timeout)
+{
+	// Warm-up tasks that were skipped because the service is stopping still set the signal
+	return m_warmsignal.Wait(timeout) && !m_stopsource.IsCancellationRequested;
+}
+
+//-----------------------------------------------------------------------------
+// svctl::service_harness
+//-----------------------------------------------------------------------------
+
+// g_consoleharness
+//
+// Harness receiving console control events; SetConsoleCtrlHandler does not accept a context
+static service_harness* g_consoleharness = nullptr;
+
+// g_consolelock
+//
+// Protects g_consoleharness.  SetConsoleCtrlHandler(FALSE) does not wait for a handler that is
+// already running, so the handler holds this while it uses the harness
+static std::mutex g_consolelock;
+
+//-----------------------------------------------------------------------------
+// service_harness Constructor
+//
+// Arguments:
+//
+//	NONE
+
+service_harness::service_harness()
+{
+	// Initialize the SERVICE_STATUS to the default state
+	zero_init(m_status).dwCurrentState = static_cast<DWORD>(ServiceStatus::Stopped);
+
+	// Console events that would terminate the process stop the service, Ctrl+Break reloads the parameters
+	m_consolemap[CTRL_C_EVENT] = ServiceControl::Stop;
+	m_consolemap[CTRL_BREAK_EVENT] = ServiceControl::ParameterChange;
+	m_consolemap[CTRL_CLOSE_EVENT] = ServiceControl::Stop;
+	m_consolemap[CTRL_SHUTDOWN_EVENT] = ServiceControl::Stop;
+}
+
+//-----------------------------------------------------------------------------
+// service_harness Destructor
+
+service_harness::~service_harness()
+{
+	DisableConsoleControls();
+
+	// If the main service thread is still active, it needs to be detached
+	// (There doesn't appear to be a legitimate way to also kill it)
+	if(m_mainthread.joinable()) m_mainthread.detach();
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::AppendToMultiStringBuffer (private)
+//
+// Appends a single string to an existing REG_MULTI_SZ buffer or terminates the
+// buffer by appending a final NULL if nullptr has been specified for string
+//
+// Arguments:
+//
+//	buffer		- Parameter byte data buffer
+//	string		- String to append to the buffer, or nullptr to terminate
+
+std::vector<uint8_t>& service_harness::AppendToMultiStringBuffer(std::vector<uint8_t>& buffer, const tchar_t* string)
+{
+	// Calculate the length of the data to be appended to the buffer and get current position
+	size_t length = (string) ? ((_tcslen(string) + 1) * sizeof(tchar_t)) : sizeof(tchar_t);
+	size_t pos = buffer.size();
+
+	// Allocate sufficient space in the buffer to hold the new data
+	buffer.resize(buffer.size() + length);
+
+	// If a string was provided, copy that and the NUL terminator into the buffer.  Otherwise,
+	// append a single NULL by zeroing out the additional space reserved above
+	if(string) memcpy_s(buffer.data() + pos, buffer.size() - pos, string, length);
+	else memset(buffer.data() + pos, 0, length);
+
+	return buffer;
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::CheckWaitHint (private)
+//
+// Records a violation if the wait hint of a pending status has expired without
+// the checkpoint advancing; must be called with m_statuslock held
+//
+// Arguments:
+//
+//	now			- Current time
+
+bool service_harness::CheckWaitHint(std::chrono::steady_clock::time_point now)
+{
+	if(m_checkpointexpired) return false;
+	if(now <= GetWaitHintDeadline()) return true;
+
+	m_checkpointexpired = true;
+	RecordViolation(violation_type::WaitHintExpired, static_cast<ServiceControl>(0), static_cast<ServiceStatus>(m_status.dwCurrentState),
+		static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - m_checkpointtime).count()), m_status.dwWaitHint + m_strictgrace);
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::CloseParameterStoreFunc (private)
+//
+// Function invoked by the service to close parameter storage
+//
+// Arguments:
+//
+//	handle		- Handle provided by OpenParameterStore
+
+void service_harness::CloseParameterStoreFunc(void* handle)
+{
+	UNREFERENCED_PARAMETER(handle);
+	_ASSERTE(handle == reinterpret_cast<void*>(this));
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::ConsoleControlHandler (private, static)
+//
+// HandlerRoutine registered with SetConsoleCtrlHandler; queues the event for the
+// console bridge thread rather than invoking the service on the system's thread
+//
+// Arguments:
+//
+//	ctrltype	- Console control event type
+
+BOOL WINAPI service_harness::ConsoleControlHandler(DWORD ctrltype)
+{
+	// The process is terminated as soon as this returns for close, logoff and shutdown events;
+	// wait for those to be processed so that the service has a chance to stop cleanly
+	signal<signal_type::ManualReset> completed;
+	bool wait = (ctrltype == CTRL_CLOSE_EVENT) || (ctrltype == CTRL_LOGOFF_EVENT) || (ctrltype == CTRL_SHUTDOWN_EVENT);
+
+	{
+		// DisableConsoleControls() cannot clear the harness, and the harness cannot be destroyed, until
+		// the event has been queued; the bridge thread releases any queued events when it's stopped
+		std::lock_guard<std::mutex> globalcritsec(g_consolelock);
+
+		service_harness* harness = g_consoleharness;
+		if(harness == nullptr) return FALSE;
+
+		std::lock_guard<std::mutex> critsec(harness->m_consolelock);
+
+		// Unmapped events and events raised while the bridge is stopping get the default processing
+		if(harness->m_consolestop || (harness->m_consolemap.find(ctrltype) == harness->m_consolemap.end())) return FALSE;
+
+		console_event event = { ctrltype, std::chrono::steady_clock::now(), (wait) ? &completed : nullptr };
+		harness->m_consoleevents.push_back(event);
+		harness->m_consolechanged.notify_one();
+	}
+
+	if(wait) completed.Wait();
+	return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::ConsoleMain (private)
+//
+// Entry point for the console bridge thread; forwards queued console control
+// events to the service through SendControl()
+//
+// Arguments:
+//
+//	NONE
+
+void service_harness::ConsoleMain(void)
+{
+	std::unique_lock<std::mutex> critsec(m_consolelock);
+
+	while(true) {
+
+		m_consolechanged.wait(critsec, [&]() { return m_consolestop || !m_consoleevents.empty(); });
+
+		// Events still queued when the bridge is stopped are released without being forwarded
+		if(m_consolestop) {
+
+			for(auto& event : m_consoleevents) if(event.Completed) event.Completed->Set();
+			m_consoleevents.clear();
+			return;
+		}
+
+		console_event event = m_consoleevents.front();
+		m_consoleevents.pop_front();
+		ServiceControl control = m_consolemap[event.CtrlType];
+
+		critsec.unlock();
+
+		// Forward the control through the same path as any other control sent to the service.  An event
+		// that will terminate the process also waits for a stop to complete; either can throw, in strict
+		// mode or when the service stops with an error, which is counted as a failure to forward it
+		DWORD result = ERROR_SUCCESS;
+		try {
+
+			result = SendControl(control);
+			m_consolelatency.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - event.Raised).count());
+			if((result == ERROR_SUCCESS) && event.Completed && (control == ServiceControl::Stop)) WaitForStatus(ServiceStatus::Stopped);
+		}
+
+		catch(winexception& ex) { result = (ex.code() != ERROR_SUCCESS) ? ex.code() : ERROR_SERVICE_SPECIFIC_ERROR; }
+		catch(...) { result = ERROR_UNHANDLED_EXCEPTION; }
+
+		if(result != ERROR_SUCCESS) m_consolefailures.fetch_add(1, std::memory_order_relaxed);
+
+		// The console handler thread is always released, otherwise the process could not terminate
+		if(event.Completed) event.Completed->Set();
+
+		critsec.lock();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::Continue
+//
+// Sends SERVICE_CONTROL_CONTINUE to the service, throws an exception if the
+// service does not accept the control or stops prematurely
+//
+// Arguments:
+//
+//	NONE
+
+void service_harness::Continue(void)
+{
+	DWORD result = SendControl(ServiceControl::Continue);
+	if(result != ERROR_SUCCESS) throw winexception(result);
+
+	WaitForStatus(ServiceStatus::Running);
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::DisableConsoleControls
+//
+// Stops forwarding console control events to the service
+//
+// Arguments:
+//
+//	NONE
+
+void service_harness::DisableConsoleControls(void)
+{
+	// Once the harness has been cleared under the lock no console handler can still be using it
+	{
+		std::lock_guard<std::mutex> critsec(g_consolelock);
+		if(g_consoleharness != this) return;
+		g_consoleharness = nullptr;
+	}
+
+	SetConsoleCtrlHandler(ConsoleControlHandler, FALSE);
+
+	// Stop the console bridge thread and wait for it to exit
+	{
+		std::lock_guard<std::mutex> critsec(m_consolelock);
+		m_consolestop = true;
+		m_consolechanged.notify_all();
+	}
+
+	if(m_consolethread.joinable()) m_consolethread.join();
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::DisableStrictMode
+//
+// Stops enforcing the service control manager timing and status transition rules
+//
+// Arguments:
+//
+//	NONE
+
+void service_harness::DisableStrictMode(void)
+{
+	std::lock_guard<named_mutex> critsec(m_statuslock);
+	m_strict = false;
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::EnableConsoleControls
+//
+// Forwards console control events to the service as service controls
+//
+// Arguments:
+//
+//	NONE
+
+void service_harness::EnableConsoleControls(void)
+{
+	// Only one harness in the process can receive the console control events
+	{
+		std::lock_guard<std::mutex> critsec(g_consolelock);
+		if(g_consoleharness == this) return;
+		if(g_consoleharness != nullptr) throw winexception(ERROR_ALREADY_REGISTERED);
+		g_consoleharness = this;
+	}
+
+	// Start the console bridge thread before the handler is registered
+	m_consolestop = false;
+	m_consolethread = std::thread(&service_harness::ConsoleMain, this);
+
+	if(!SetConsoleCtrlHandler(ConsoleControlHandler, TRUE)) {
+
+		DWORD result = GetLastError();
+		DisableConsoleControls();
+		throw winexception(result);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::EnableStrictMode
+//
+// Enforces the service control manager timing and status transition rules
+//
+// Arguments:
+//
+//	handlertimeout	- Milliseconds allowed for a control handler to return
+//	waithintgrace	- Additional milliseconds allowed beyond each reported wait hint
+
+void service_harness::EnableStrictMode(uint32_t handlertimeout, uint32_t waithintgrace)
+{
+	std::lock_guard<named_mutex> critsec(m_statuslock);
+
+	m_strict = true;
+	m_strictlimit = handlertimeout;
+	m_strictgrace = waithintgrace;
+
+	// Enforce the current wait hint from now on rather than from when it was reported
+	m_checkpointtime = std::chrono::steady_clock::now();
+	m_checkpointexpired = false;
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::getCanContinue
+//
+// Determines if the service can be continued
+
+bool service_harness::getCanContinue(void)
+{
+	std::lock_guard<named_mutex> critsec(m_statuslock);
+
+	// If the service is not running, it cannot be controlled at all
+	if(!m_mainthread.joinable()) return false;
+
+	// The service can be continued if it's in a PAUSED state and accepts the control
+	return ((static_cast<ServiceStatus>(m_status.dwCurrentState) == ServiceStatus::Paused) && 
+		ServiceControlAccepted(ServiceControl::Continue, m_status.dwControlsAccepted));
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::getCanPause
+//
+// Determines if the service can be paused
+
+bool service_harness::getCanPause(void)
+{
+	std::lock_guard<named_mutex> critsec(m_statuslock);
+
+	// If the service is not running, it cannot be controlled at all
+	if(!m_mainthread.joinable()) return false;
+
+	// The service can be paused if it's in a RUNNING state and accepts the control
+	return ((static_cast<ServiceStatus>(m_status.dwCurrentState) == ServiceStatus::Running) && 
+		ServiceControlAccepted(ServiceControl::Pause, m_status.dwControlsAccepted));
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::getCanStop
+//
+// Determines if the service can be stopped
+
+bool service_harness::getCanStop(void)
+{
+	std::lock_guard<named_mutex> critsec(m_statuslock);
+
+	// If the service is not running, it cannot be controlled at all
+	if(!m_mainthread.joinable()) return false;
+
+	// The service can be stopped if it's not in a STOPPED or STOP_PENDING state and accepts the control
+	return ((static_cast<ServiceStatus>(m_status.dwCurrentState) != ServiceStatus::Stopped) && 
+		(static_cast<ServiceStatus>(m_status.dwCurrentState) != ServiceStatus::StopPending) &&
+		ServiceControlAccepted(ServiceControl::Stop, m_status.dwControlsAccepted));
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::getConsoleStatistics
+//
+// Gets the statistics for console control events forwarded to the service
+
+service_harness::console_statistics service_harness::getConsoleStatistics(void) const
+{
+	console_statistics stats;
+
+	stats.Events = m_consolelatency.Count;
+	stats.Failures = m_consolefailures.load(std::memory_order_relaxed);
+	stats.LatencyP50 = m_consolelatency.Percentile(50.0);
+	stats.LatencyP99 = m_consolelatency.Percentile(99.0);
+	stats.LatencyMax = m_consolelatency.Max;
+
+	return stats;
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::GetWaitHintDeadline (private)
+//
+// Gets the time by which a pending status must advance its checkpoint; must be
+// called with m_statuslock held
+//
+// Arguments:
+//
+//	NONE
+
+std::chrono::steady_clock::time_point service_harness::GetWaitHintDeadline(void) const
+{
+	switch(static_cast<ServiceStatus>(m_status.dwCurrentState)) {
+
+		// Pending status codes must advance the checkpoint within the wait hint
+		case ServiceStatus::StartPending:
+		case ServiceStatus::StopPending:
+		case ServiceStatus::ContinuePending:
+		case ServiceStatus::PausePending:
+			return m_checkpointtime + std::chrono::milliseconds(static_cast<int64_t>(m_status.dwWaitHint) + m_strictgrace);
+
+		// Non-pending status codes have no deadline
+		default: return std::chrono::steady_clock::time_point::max();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::IsLegalTransition (private, static)
+//
+// Determines if a service status change is allowed by the service control manager
+//
+// Arguments:
+//
+//	from		- Current service status
+//	to			- New service status
+
+bool service_harness::IsLegalTransition(ServiceStatus from, ServiceStatus to)
+{
+	// Reporting the same status again is allowed until the service has stopped
+	if(from == to) return (from != ServiceStatus::Stopped);
+
+	switch(from) {
+
+		case ServiceStatus::StartPending:		return (to == ServiceStatus::Running) || (to == ServiceStatus::StopPending) || (to == ServiceStatus::Stopped);
+		case ServiceStatus::Running:			return (to == ServiceStatus::PausePending) || (to == ServiceStatus::StopPending) || (to == ServiceStatus::Stopped);
+		case ServiceStatus::PausePending:		return (to == ServiceStatus::Paused) || (to == ServiceStatus::Running) || (to == ServiceStatus::StopPending) || (to == ServiceStatus::Stopped);
+		case ServiceStatus::Paused:				return (to == ServiceStatus::ContinuePending) || (to == ServiceStatus::StopPending) || (to == ServiceStatus::Stopped);
+		case ServiceStatus::ContinuePending:	return (to == ServiceStatus::Running) || (to == ServiceStatus::Paused) || (to == ServiceStatus::StopPending) || (to == ServiceStatus::Stopped);
+		case ServiceStatus::StopPending:		return (to == ServiceStatus::Stopped);
+
+		// Nothing can follow SERVICE_STOPPED
+		default: return false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::LoadParameterFunc (private)
+//
+// Function invoked by the service to load a parameter value
+//
+// Arguments:
+//
+//	handle		- Handle provided by OpenParameterStore
+//	name		- Name of the parameter to load
+//	format		- Expected parameter data format
+//	buffer		- Destination buffer for the parameter data
+//	length		- Length of the parameter destination buffer
+
+size_t service_harness::LoadParameterFunc(void* handle, const tchar_t* name, ServiceParameterFormat format, void* buffer, size_t length)
+{
+	// The handle provided by OpenParameterStore is fake; it's just the (this) pointer
+	_ASSERTE(handle == reinterpret_cast<void*>(this));
+	if(handle != reinterpret_cast<void*>(this)) throw winexception(ERROR_INVALID_PARAMETER);
+
+	std::lock_guard<named_recursive_mutex> critsec(m_paramlock);
+
+	// If a buffer has been provided, initialize it to all zeros
+	if(buffer) memset(buffer, 0, length);
+
+	// Locate the parameter in the collection --> ERROR_FILE_NOT_FOUND if it doesn't exist
+	auto iterator = m_parameters.find(tstring(name));
+	if(iterator == m_parameters.end()) throw winexception(ERROR_FILE_NOT_FOUND);
+
+	// Check the data type against the stored value --> ERROR_UNSUPPORTED_TYPE if doesn't match
+	if(iterator->second.first != format) throw winexception(ERROR_UNSUPPORTED_TYPE);
+
+	if(buffer) {
+			
+		// check the buffer length and copy the data --> ERROR_MORE_DATA if insufficient
+		if(length < iterator->second.second.size()) throw winexception(ERROR_MORE_DATA);
+		else memcpy_s(buffer, length, iterator->second.second.data(), iterator->second.second.size());
+	}
+
+	return iterator->second.second.size();			// Return the size of the parameter value in bytes
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::MapConsoleEvent
+//
+// Changes the service control sent in response to a console control event
+//
+// Arguments:
+//
+//	ctrltype	- Console control event type (CTRL_C_EVENT, CTRL_BREAK_EVENT, etc)
+//	control		- Service control to send; can be a custom control code (128-255)
+
+void service_harness::MapConsoleEvent(DWORD ctrltype, ServiceControl control)
+{
+	std::lock_guard<std::mutex> critsec(m_consolelock);
+	m_consolemap[ctrltype] = control;
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::OpenParameterStoreFunc (private)
+//
+// Function invoked by the contained service to open parameter storage (no-op)
+//
+// Arguments:
+//
+//	servicename		- Name of the service instance
+
+void* service_harness::OpenParameterStoreFunc(const tchar_t* servicename)
+{
+	UNREFERENCED_PARAMETER(servicename);
+
+	// A handle isn't necessary for the local parameter store, use (this)
+	return reinterpret_cast<void*>(this); 
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::Pause
+//
+// Sends SERVICE_CONTROL_PAUSE to the service, throws an exception if the
+// service does not accept the control or stops prematurely
+//
+// Arguments:
+//
+//	NONE
+
+void service_harness::Pause(void)
+{
+	DWORD result = SendControl(ServiceControl::Pause);
+	if(result != ERROR_SUCCESS) throw winexception(result);
+
+	WaitForStatus(ServiceStatus::Paused);
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::RecordViolation (private)
+//
+// Records a strict mode violation and writes it to the debugger output; must be
+// called with m_statuslock held
+//
+// Arguments:
+//
+//	type		- Rule that was broken
+//	control		- Control being handled, if any
+//	newstatus	- Status the service attempted to set, if any
+//	elapsed		- Milliseconds taken
+//	limit		- Milliseconds allowed
+
+void service_harness::RecordViolation(violation_type type, ServiceControl control, ServiceStatus newstatus, uint32_t elapsed, uint32_t limit)
+{
+	violation entry = { type, control, static_cast<ServiceStatus>(m_status.dwCurrentState), newstatus, elapsed, limit,
+		(m_timeline.empty()) ? tstring() : m_timeline.back().Phase };
+
+	const tchar_t* name = (type == violation_type::IllegalTransition) ? _T("illegal status transition") :
+		(type == violation_type::WaitHintExpired) ? _T("wait hint expired") : _T("handler timeout");
+
+	tchar_t line[256];
+	_sntprintf_s(line, _countof(line), _TRUNCATE, _T("strict mode violation: %s control=%u status=%u newstatus=%u elapsed=%u ms limit=%u ms phase=%s\n"),
+		name, static_cast<uint32_t>(entry.Control), static_cast<uint32_t>(entry.Status), static_cast<uint32_t>(entry.NewStatus), elapsed, limit, entry.Phase.c_str());
+	OutputDebugString(line);
+
+	m_violations.push_back(std::move(entry));
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::RegisterHandlerFunc (private)
+//
+// Function invoked by the service to register it's control handler
+//
+// Arguments:
+//
+//	servicename		- Name assigned to the service instance
+//	handler			- Pointer to the service's HandlerEx() callback
+//	context			- HandlerEx() callback context pointer
+
+SERVICE_STATUS_HANDLE service_harness::RegisterHandlerFunc(LPCTSTR servicename, LPHANDLER_FUNCTION_EX handler, LPVOID context)
+{
+	_ASSERTE(handler != nullptr);
+	UNREFERENCED_PARAMETER(servicename);
+
+	// A service instance that is restarted in place registers again while controls can still be sent,
+	// the handler and its context are replaced together; its status starts over
+	std::lock_guard<named_mutex> critsec(m_statuslock);
+
+	m_handler = handler;					// Store the handler function pointer
+	m_context = context;					// Store the handler context pointer
+	m_statusreported = false;
+
+	// Return the address of this harness instance as a pseudo SERVICE_STATUS_HANDLE for the service
+	return reinterpret_cast<SERVICE_STATUS_HANDLE>(this);
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::ReportPhaseFunc (private)
+//
+// Function invoked by the service to report a lifecycle phase
+//
+// Arguments:
+//
+//	phase		- Name of the phase
+//	offset		- Microseconds since the service was started
+
+void service_harness::ReportPhaseFunc(const tchar_t* phase, uint64_t offset)
+{
+	std::lock_guard<named_mutex> critsec(m_statuslock);
+
+	if(!m_timeline.empty()) m_timeline.back().Duration = offset - m_timeline.back().Start;
+
+	timeline_entry entry = { phase, offset, 0 };
+	m_timeline.push_back(std::move(entry));
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::ReportProgressFunc (private)
+//
+// Function invoked by the service to report explicit progress
+//
+// Arguments:
+//
+//	status		- Pending status the progress is being reported for
+//	step		- Reported step
+//	total		- Reported total number of steps
+//	waithint	- Wait hint reported to the service control manager
+
+void service_harness::ReportProgressFunc(ServiceStatus status, uint32_t step, uint32_t total, uint32_t waithint)
+{
+	std::lock_guard<named_mutex> critsec(m_statuslock);
+
+	progress entry = { status, step, total, waithint, 
+		static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_started).count()) };
+	m_progress.push_back(entry);
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::ReportRecoveryFunc (private)
+//
+// Function invoked when the service is being restarted in place after it aborted
+//
+// Arguments:
+//
+//	exitcode	- Exit code of the failure
+//	attempt		- Consecutive recovery attempt
+//	delay		- Delay before the new service instance is started
+
+void service_harness::ReportRecoveryFunc(DWORD exitcode, uint32_t attempt, uint32_t delay)
+{
+	std::lock_guard<named_mutex> critsec(m_statuslock);
+
+	recovery entry = { exitcode, attempt, delay, false, 0 };
+	m_recoveries.push_back(entry);
+	m_recoverystart = std::chrono::steady_clock::now();
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::SaveParameterFunc (private)
+//
+// Function invoked by the contained service to save a parameter value
+//
+// Arguments:
+//
+//	handle		- Handle returned from OpenParameterStoreFunc
+//	name		- Name of the parameter to save
+//	format		- Parameter data format
+//	buffer		- Parameter data
+//	length		- Length of the parameter data
+
+void service_harness::SaveParameterFunc(void* handle, const tchar_t* name, ServiceParameterFormat format, const void* buffer, size_t length)
+{
+	// The handle provided by OpenParameterStore is fake; it's just the (this) pointer
+	_ASSERTE(handle == reinterpret_cast<void*>(this));
+	if(handle != reinterpret_cast<void*>(this)) throw winexception(ERROR_INVALID_PARAMETER);
+
+	SetParameter(tstring(name), format, buffer, length);
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::SendControl
+//
+// Sends a control to the service
+//
+// Arguments:
+//
+//	control		- Control to be sent to the service
+//	eventtype	- Specifies a control-specific event type code (uncommon)
+//	eventdata	- Specifies control-specific event data (uncommon)
+
+DWORD service_harness::SendControl(ServiceControl control, DWORD eventtype, void* eventdata)
+{
+	std::unique_lock<named_mutex> critsec(m_statuslock);
+
+	// If the main service thread is not running, that's the same result as SERVICE_STOPPED
+	if(!m_mainthread.joinable()) return ERROR_SERVICE_NOT_ACTIVE;
+
+	// Certain service statuses prevent the service from being controlled at all, see ControlService() on MSDN
+	switch(static_cast<ServiceStatus>(m_status.dwCurrentState)) {
+
+		// SERVICE_STOPPED and SERVICE_STOP_PENDING never allow for a new control to be sent
+		case ServiceStatus::Stopped : return ERROR_SERVICE_NOT_ACTIVE;
+		case ServiceStatus::StopPending: return ERROR_SERVICE_CANNOT_ACCEPT_CTRL;
+
+		// SERVICE_START_PENDING only allows SERVICE_CONTROL_STOP
+		case ServiceStatus::StartPending : 
+			if(control != ServiceControl::Stop) return ERROR_SERVICE_CANNOT_ACCEPT_CTRL;
+			// fall-through
+
+		// Check the requested control against the service's current accepted controls mask
+		default: if(!ServiceControlAccepted(control, m_status.dwControlsAccepted)) return ERROR_INVALID_SERVICE_CONTROL;
+	}
+
+	bool strict = m_strict;
+	uint32_t limit = m_strictlimit;
+
+	// The handler and its context are replaced when the service is recovered in place; use the pair
+	// that was registered when the control was accepted
+	LPHANDLER_FUNCTION_EX handler = m_handler;
+	void* context = m_context;
+
+	// Unlock the status critical section and invoke the service's handler directly
+	critsec.unlock();
+
+	auto start = std::chrono::steady_clock::now();
+	DWORD result = handler(static_cast<DWORD>(control), eventtype, eventdata, context);
+	if(!strict) return result;
+
+	// In strict mode a handler that exceeds the limit fails the control, as it would with the service control manager
+	uint32_t elapsed = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+	if(elapsed <= limit) return result;
+
+	critsec.lock();
+	RecordViolation(violation_type::HandlerTimeout, control, static_cast<ServiceStatus>(m_status.dwCurrentState), elapsed, limit);
+
+	return ERROR_SERVICE_REQUEST_TIMEOUT;
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::ServiceControlAccepted (private, static)
+//
+// Checks a ServiceControl against a SERVICE_ACCEPT_XXXX mask
+//
+// Arguments:
+//
+//	control			- Service control code to be checked
+//	mask			- SERVICE_ACCEPT_XXXX mask to check control against
+
+bool service_harness::ServiceControlAccepted(ServiceControl control, DWORD mask)
+{
+	switch(control) {
+		
+		case ServiceControl::Stop:					return ((mask & SERVICE_ACCEPT_STOP) == SERVICE_ACCEPT_STOP);
+		case ServiceControl::Pause:					return ((mask & SERVICE_ACCEPT_PAUSE_CONTINUE) == SERVICE_ACCEPT_PAUSE_CONTINUE);
+		case ServiceControl::Continue:				return ((mask & SERVICE_ACCEPT_PAUSE_CONTINUE) == SERVICE_ACCEPT_PAUSE_CONTINUE);
+		case ServiceControl::Interrogate:			return true;
+		case ServiceControl::Shutdown:				return ((mask & SERVICE_ACCEPT_SHUTDOWN) == SERVICE_ACCEPT_SHUTDOWN);
+		case ServiceControl::ParameterChange:		return ((mask & SERVICE_ACCEPT_PARAMCHANGE) == SERVICE_ACCEPT_PARAMCHANGE);
+		case ServiceControl::NetBindAdd:			return ((mask & SERVICE_ACCEPT_NETBINDCHANGE) == SERVICE_ACCEPT_NETBINDCHANGE);
+		case ServiceControl::NetBindRemove:			return ((mask & SERVICE_ACCEPT_NETBINDCHANGE) == SERVICE_ACCEPT_NETBINDCHANGE);
+		case ServiceControl::NetBindEnable:			return ((mask & SERVICE_ACCEPT_NETBINDCHANGE) == SERVICE_ACCEPT_NETBINDCHANGE);
+		case ServiceControl::NetBindDisable:		return ((mask & SERVICE_ACCEPT_NETBINDCHANGE) == SERVICE_ACCEPT_NETBINDCHANGE);
+		case ServiceControl::DeviceEvent:			return false;
+		case ServiceControl::HardwareProfileChange:	return ((mask & SERVICE_ACCEPT_HARDWAREPROFILECHANGE) == SERVICE_ACCEPT_HARDWAREPROFILECHANGE);
+		case ServiceControl::PowerEvent:			return ((mask & SERVICE_ACCEPT_POWEREVENT) == SERVICE_ACCEPT_POWEREVENT);
+		case ServiceControl::SessionChange:			return ((mask & SERVICE_ACCEPT_SESSIONCHANGE) == SERVICE_ACCEPT_SESSIONCHANGE);
+		case ServiceControl::PreShutdown:			return ((mask & SERVICE_ACCEPT_PRESHUTDOWN) == SERVICE_ACCEPT_PRESHUTDOWN);
+		case ServiceControl::TimeChange:			return ((mask & SERVICE_ACCEPT_TIMECHANGE) == SERVICE_ACCEPT_TIMECHANGE);
+		case ServiceControl::TriggerEvent:			return ((mask & SERVICE_ACCEPT_TRIGGEREVENT) == SERVICE_ACCEPT_TRIGGEREVENT);
+		case ServiceControl::UserModeReboot:		return ((mask & SERVICE_ACCEPT_USERMODEREBOOT) == SERVICE_ACCEPT_USERMODEREBOOT);
+
+		// Allow any user-defined controls (128-255) to be passed to the service regardless of accept mask		
+		default: return ((static_cast<int>(control) >= 128) && (static_cast<int>(control) <= 255));
+	}
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::SetParameter
+//
+// Sets a string-based parameter key/value pair
+//
+// Arguments:
+//
+//	name		- Name of the parameter to set
+//	value		- Value to assign to the parameter
+
+void service_harness::SetParameter(const resstring& name, const tchar_t* value)
+{
+	// If a non-null string pointer was provided, set it, otherwise set a blank string instead
+	if(value) SetParameter(name, ServiceParameterFormat::String, value, (_tcslen(value) + 1) * sizeof(tchar_t));
+	else SetParameter(name, ServiceParameterFormat::String, _T("\0"), sizeof(tchar_t));
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::SetParameter
+//
+// Sets a string-based parameter key/value pair
+//
+// Arguments:
+//
+//	name		- Name of the parameter to set
+//	value		- Value to assign to the parameter
+
+void service_harness::SetParameter(const resstring& name, const tstring& value)
+{
+	// Set the parameter using the const tchar_t pointer for the string, include the null terminator
+	SetParameter(name, ServiceParameterFormat::String, value.c_str(), (value.length() + 1) * sizeof(tchar_t));
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::SetParameter (private)
+//
+// Internal implementation of SetParameter, accepts the type and raw data
+//
+// Arguments:
+//
+//	name		- Parameter name
+//	format		- Parameter format
+//	value		- Pointer to the parameter data
+//	length		- Length, in bytes, of the parameter data
+
+void service_harness::SetParameter(const tstring& name, ServiceParameterFormat format, const void* value, size_t length)
+{
+	_ASSERTE(value);
+	_ASSERTE(length > 0);
+
+	// Use pointers to the data as the iterators for constructing the vector<>
+	const uint8_t* begin = reinterpret_cast<const uint8_t*>(value);
+	const uint8_t* end = begin + length;
+
+	// Insert or replace the parameter value in the collection
+	SetParameter(name, format, std::vector<uint8_t>(begin, end));
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::SetParameter (private)
+//
+// Internal implementation of SetParameter, accepts the type and raw data
+//
+// Arguments:
+//
+//	name		- Parameter name
+//	format		- Parameter format
+//	value		- Parameter data as a vector<> rvalue reference
+
+void service_harness::SetParameter(const tstring& name, ServiceParameterFormat format, std::vector<uint8_t>&& value)
+{
+	if(name.length() == 0) throw winexception(ERROR_INVALID_PARAMETER);
+
+	std::lock_guard<named_recursive_mutex> critsec(m_paramlock);
+	m_parameters[name] = parameter_value(format, std::move(value));
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::SetStatusFunc (private)
+//
+// Function invoked by the service to report a change in status
+//
+// Arguments:
+//
+//	handle		- Handle returned by RegisterHandlerFunc
+//	status		- New status being reported by the service
+
+BOOL service_harness::SetStatusFunc(SERVICE_STATUS_HANDLE handle, LPSERVICE_STATUS status)
+{
+	std::unique_lock<named_mutex> critsec(m_statuslock);
+
+	// Ensure that the handle provided is actually the address of this harness instance
+	_ASSERTE(reinterpret_cast<service_harness*>(handle) == this);
+	if(reinterpret_cast<service_harness*>(handle) != this) { SetLastError(ERROR_INVALID_HANDLE); return FALSE; }
+
+	if(m_strict) {
+
+		auto now = std::chrono::steady_clock::now();
+		ServiceStatus current = static_cast<ServiceStatus>(m_status.dwCurrentState);
+		ServiceStatus next = static_cast<ServiceStatus>(status->dwCurrentState);
+
+		// The first status reported must be SERVICE_START_PENDING or SERVICE_STOPPED, after which
+		// the status can only change in the ways the service control manager allows
+		bool legal = (m_statusreported) ? IsLegalTransition(current, next) : ((next == ServiceStatus::StartPending) || (next == ServiceStatus::Stopped));
+		if(!legal) {
+
+			RecordViolation(violation_type::IllegalTransition, static_cast<ServiceControl>(0), next, 0, 0);
+			SetLastError(ERROR_INVALID_DATA);
+			return FALSE;
+		}
+
+		// A pending status must have advanced before its wait hint expired
+		if(m_statusreported) CheckWaitHint(now);
+
+		// The wait hint starts over whenever the status changes or the checkpoint advances
+		if((next != current) || (status->dwCheckPoint > m_status.dwCheckPoint)) {
+
+			m_checkpointtime = now;
+			m_checkpointexpired = false;
+		}
+	}
+
+	m_statusreported = true;
+
+	m_status = *status;						// Copy the new SERVICE_STATUS
+	m_statuschanged.notify_all();			// Notify the status has been changed
+
+	// A service that is being restarted in place has recovered once it's running again
+	if((status->dwCurrentState == SERVICE_RUNNING) && !m_recoveries.empty() && !m_recoveries.back().Recovered) {
+
+		m_recoveries.back().Recovered = true;
+		m_recoveries.back().Elapsed = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_recoverystart).count());
+	}
+
+	return TRUE;
+};
+
+//-----------------------------------------------------------------------------
+// service_harness::Start (private)
+//
+// Starts the service
+//
+// Arguments:
+//
+//	argvector		- vector<> of command line argument strings
+
+void service_harness::Start(std::vector<tstring>& argvector)
+{
+	using namespace std::placeholders;
+
+	// If the main thread has already been created, the service has already been started
+	if(m_mainthread.joinable()) throw winexception(ERROR_SERVICE_ALREADY_RUNNING);
+
+	// Always reset the SERVICE_STATUS and progress back to defaults before starting the service
+	{
+		std::lock_guard<named_mutex> critsec(m_statuslock);
+
+		zero_init(m_status).dwCurrentState = static_cast<DWORD>(ServiceStatus::Stopped);
+		m_progress.clear();
+		m_timeline.clear();
+		m_violations.clear();
+		m_recoveries.clear();
+		m_started = std::chrono::steady_clock::now();
+		m_statusreported = false;
+		m_checkpointexpired = false;
+	}
+
+	// There is an expectation that argv[0] is set to the service name
+	if((argvector.size() == 0) || (argvector[0].length() == 0)) throw winexception(E_INVALIDARG);
+
+	// Create the main service thread and launch it
+	m_mainthread = std::move(std::thread([=]() {
+
+		// Create a copy of the arguments vector local to this thread so it won't be destroyed
+		// prematurely, and convert it into an argv-style array of generic text string pointers
+		std::vector<tstring> arguments(argvector);
+		std::vector<tchar_t*> argv;
+		for(const auto& arg: arguments) argv.push_back(const_cast<tchar_t*>(arg.c_str()));
+		argv.push_back(nullptr);
+
+		// Create the context for the service by binding this instance's member functions
+		service_context context = { 
+			ServiceProcessType::Unique,
+			std::bind(&service_harness::RegisterHandlerFunc, this, _1, _2, _3),
+			std::bind(&service_harness::SetStatusFunc, this, _1, _2),
+			std::bind(&service_harness::OpenParameterStoreFunc, this, _1),
+			std::bind(&service_harness::LoadParameterFunc, this, _1, _2, _3, _4, _5),
+			std::bind(&service_harness::CloseParameterStoreFunc, this, _1),
+			std::bind(&service_harness::ReportProgressFunc, this, _1, _2, _3, _4),
+			std::bind(&service_harness::SaveParameterFunc, this, _1, _2, _3, _4, _5),
+			std::bind(&service_harness::ReportPhaseFunc, this, _1, _2),
+			&m_flightrecorder,
+			nullptr,
+			nullptr,
+			std::bind(&service_harness::ReportRecoveryFunc, this, _1, _2, _3),
+			&m_listeners
+		};
+
+		// Launch the service with the specified command line arguments and instance context
+		LaunchService(static_cast<int>(argv.size() - 1), argv.data(), context);
+	}));
+
+	// Wait up to 30 seconds for the service to set SERVICE_START_PENDING
+	if(!WaitForStatus(ServiceStatus::StartPending, 30000)) throw winexception(ERROR_SERVICE_REQUEST_TIMEOUT);
+
+	// Wait indefinitely for the service to set SERVICE_RUNNING
+	WaitForStatus(ServiceStatus::Running);
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::Stop
+//
+// Sends SERVICE_CONTROL_STOP to the service, throws an exception if the
+// service does not accept the control or stops prematurely
+//
+// Arguments:
+//
+//	NONE
+
+void service_harness::Stop(void)
+{
+	DWORD result = SendControl(ServiceControl::Stop);
+	if(result != ERROR_SUCCESS) throw winexception(result);
+
+	WaitForStatus(ServiceStatus::Stopped);
+}
+
+//-----------------------------------------------------------------------------
+// service_harness::WaitForStatus
+//
+// Waits for the service to reach the specified status
+//
+// Arguments:
+//
+//	status		- Service status to wait for
+//	timeout		- Amount of time, in milliseconds, to wait before failing
+
+bool service_harness::WaitForStatus(ServiceStatus status, uint32_t timeout)
+{
+	std::unique_lock<named_mutex> critsec(m_statuslock);
+
+	// Wait for the condition variable to be trigged with the service status caller is looking for, or if
+	// the service has stopped unexpectedly due to an unhandled exception caught in ServiceMain()
+	auto predicate = [=]()
+	{
+		return (static_cast<ServiceStatus>(m_status.dwCurrentState) == status) ||
+			((static_cast<ServiceStatus>(m_status.dwCurrentState) == ServiceStatus::Stopped) && (m_status.dwWin32ExitCode != ERROR_SUCCESS));
+	};
+
+	bool result = false;
+	if(!m_strict) result = m_statuschanged.wait_until(critsec, std::chrono::system_clock::now() + std::chrono::milliseconds(timeout), predicate);
+
+	// In strict mode also wake up when the wait hint of a pending status expires, the service control
+	// manager gives up on a service that does not advance its checkpoint within the wait hint
+	else {
+
+		auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+		while(!(result = predicate())) {
+
+			auto now = std::chrono::steady_clock::now();
+			if(!CheckWaitHint(now)) throw winexception(ERROR_SERVICE_REQUEST_TIMEOUT);
+			if(now >= until) break;
+
+			m_statuschanged.wait_until(critsec, std::min(until, GetWaitHintDeadline()));
+		}
+	}
+
+	// If the service has stopped (regardless of the reason), wait for the main thread to terminate.  The
+	// service still reports lifecycle phases after SERVICE_STOPPED, which requires the status lock, so the
+	// thread is taken out under the lock and joined after it has been released
+	std::thread mainthread;
+	if(static_cast<ServiceStatus>(m_status.dwCurrentState) == ServiceStatus::Stopped) mainthread = std::move(m_mainthread);
+
+	DWORD exitcode = m_status.dwWin32ExitCode;
+	critsec.unlock();
+
+	if(mainthread.joinable()) mainthread.join();
+
+	// If an error was generated by the service, throw that as an exception to the caller
+	if(exitcode != ERROR_SUCCESS) throw winexception(exitcode);
+
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+// svctl::shutdown_broadcaster
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// shutdown_broadcaster Destructor
+
+shutdown_broadcaster::~shutdown_broadcaster()
+{
+	// The handler threads are detached; wait for any that are still running to return
+	std::unique_lock<std::mutex> critsec(m_lock);
+	m_changed.wait(critsec, [&]() -> bool { return m_running == 0; });
+}
+
+//-----------------------------------------------------------------------------
+// shutdown_broadcaster::Attach
+//
+// Sets the function used to invoke the control handler of a service
+//
+// Arguments:
+//
+//	name		- Name of the service
+//	handler		- Function that invokes the service control handler
+
+void shutdown_broadcaster::Attach(const tstring& name, std::function<DWORD(ServiceControl control, DWORD eventtype, void* eventdata)> handler)
+{
+	std::lock_guard<std::mutex> critsec(m_lock);
+
+	// A service that is started again is no longer part of any previous broadcast
+	node& target = m_nodes[name];
+	target.Handler = std::move(handler);
+	target.Outcomes.clear();
+}
+
+//-----------------------------------------------------------------------------
+// shutdown_broadcaster::Broadcast
+//
+// Starts a broadcast of SHUTDOWN or PRESHUTDOWN unless the service is already part of
+// one, and waits for the broadcast to complete or for the budget to expire
+//
+// Arguments:
+//
+//	name		- Name of the service that received the control
+//	control		- Control received by the service
+//	eventtype	- Control-specific event type
+//	eventdata	- Control-specific event data
+
+DWORD shutdown_broadcaster::Broadcast(const tstring& name, ServiceControl control, DWORD eventtype, void* eventdata)
+{
+	std::unique_lock<std::mutex> critsec(m_lock);
+
+	auto found = m_nodes.find(name);
+	if(found == m_nodes.end()) return ERROR_SERVICE_NOT_ACTIVE;
+
+	// The first service to receive the control invokes the handlers of every attached service that
+	// has not already received it; the others find themselves part of that broadcast and just wait
+	if(found->second.Outcomes.find(control) == found->second.Outcomes.end()) {
+
+		uint64_t broadcast = ++m_broadcasts;
+		auto started = std::chrono::steady_clock::now();
+		auto deadline = started + std::chrono::milliseconds(m_budget);
+
+		for(auto& iterator : m_nodes) {
+
+			node* target = &iterator.second;
+			if(target->Outcomes.find(control) != target->Outcomes.end()) continue;
+
+			result pending = { broadcast, iterator.first, control, ERROR_SERVICE_REQUEST_TIMEOUT, 0, false };
+			target->Outcomes[control] = { broadcast, deadline, false, ERROR_SERVICE_REQUEST_TIMEOUT };
+			m_results.push_back(std::move(pending));
+			target->Active++;
+			m_running++;
+
+			// Every handler gets a thread of its own, so that a handler still running from a previous
+			// broadcast cannot hold up this one.  Detach() waits for Active to reach zero, the node
+			// remains valid for the thread
+			tstring servicename = iterator.first;
+			std::thread([=]() {
+
+				DWORD code = ERROR_UNHANDLED_EXCEPTION;
+				try { code = target->Handler(control, eventtype, eventdata); }
+				catch(...) { /* DO NOTHING */ }
+
+				uint32_t elapsed = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count());
+
+				std::lock_guard<std::mutex> critsec(m_lock);
+
+				// The service may have been restarted and become part of a newer broadcast meanwhile
+				auto completed = target->Outcomes.find(control);
+				if((completed != target->Outcomes.end()) && (completed->second.Broadcast == broadcast)) {
+
+					completed->second.Completed = true;
+					completed->second.Result = code;
+				}
+
+				// The results may have been cleared while the handler was running
+				auto entry = std::find_if(m_results.begin(), m_results.end(), [&](const result& candidate) -> bool {
+					return (candidate.Broadcast == broadcast) && (candidate.Control == control) && (_tcsicmp(candidate.Name.c_str(), servicename.c_str()) == 0);
+				});
+
+				if(entry != m_results.end()) {
+
+					entry->Result = code;
+					entry->Elapsed = elapsed;
+					entry->Completed = true;
+				}
+
+				target->Active--;
+				m_running--;
+				m_changed.notify_all();
+			}).detach();
+		}
+	}
+
+	// Wait for every handler in the broadcast to return, or for the budget to expire; the
+	// service cannot be detached while it's waiting
+	found->second.Active++;
+
+	uint64_t broadcast = found->second.Outcomes[control].Broadcast;
+	m_changed.wait_until(critsec, found->second.Outcomes[control].Deadline, [&]() -> bool {
+
+		for(const auto& iterator : m_nodes) {
+
+			auto state = iterator.second.Outcomes.find(control);
+			if((state != iterator.second.Outcomes.end()) && (state->second.Broadcast == broadcast) && !state->second.Completed) return false;
+		}
+
+		return true;
+	});
+
+	found->second.Active--;
+	m_changed.notify_all();
+
+	// A handler that has not returned within the budget is left to run on its thread
+	const outcome& own = found->second.Outcomes[control];
+	return (own.Completed) ? own.Result : ERROR_SERVICE_REQUEST_TIMEOUT;
+}
+
+//-----------------------------------------------------------------------------
+// shutdown_broadcaster::ClearResults
+//
+// Discards the results of previous broadcasts
+//
+// Arguments:
+//
+//	NONE
+
+void shutdown_broadcaster::ClearResults(void)
+{
+	std::lock_guard<std::mutex> critsec(m_lock);
+	m_results.clear();
+}
+
+//-----------------------------------------------------------------------------
+// shutdown_broadcaster::Detach
+//
+// Removes the handler function for a service, waiting for any invocation of it to return
+//
+// Arguments:
+//
+//	name		- Name of the service
+
+void shutdown_broadcaster::Detach(const tstring& name)
+{
+	std::unique_lock<std::mutex> critsec(m_lock);
+
+	auto found = m_nodes.find(name);
+	if(found == m_nodes.end()) return;
+
+	m_changed.wait(critsec, [&]() -> bool { return found->second.Active == 0; });
+	m_nodes.erase(found);
+}
+
+//-----------------------------------------------------------------------------
+// shutdown_broadcaster::SetBudget
+//
+// Sets the process-wide time limit for a broadcast
+//
+// Arguments:
+//
+//	budget		- Time limit, in milliseconds
+
+void shutdown_broadcaster::SetBudget(uint32_t budget)
+{
+	std::lock_guard<std::mutex> critsec(m_lock);
+	m_budget = budget;
+}
+
+//-----------------------------------------------------------------------------
+// svctl::signal_base
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// signal_base::Register (private)
+//
+// Registers a wait block with this signal
+//
+// Arguments:
+//
+//	block		- Wait block to be registered
+
+void signal_base::Register(wait_block* block)
+{
+	std::lock_guard<std::mutex> critsec(m_lock);
+
+	m_waitblocks.push_back(block);
+	++m_waiters;
+}
+
+//-----------------------------------------------------------------------------
+// signal_base::Set
+//
+// Sets the signal to a signaled state
+//
+// Arguments:
+//
+//	NONE
+
+void signal_base::Set(void)
+{
+	// Set the signaled state; if there are no registered waiters this is all that
+	// needs to be done.  A waiter that registers after this check will observe the
+	// state change before it blocks (both operations are sequentially consistent)
+	m_signaled.store(true);
+	if(m_waiters.load() == 0) return;
+
+	// Wake up every registered waiter; with an AutomaticReset signal only one of
+	// them will successfully consume the signal, the rest will go back to waiting
+	std::lock_guard<std::mutex> critsec(m_lock);
+	for(const auto& block : m_waitblocks) {
+
+		std::lock_guard<std::mutex> blockcritsec(block->lock);
+		block->changed.notify_one();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// signal_base::TryAcquire (private)
+//
+// Tests the signaled state of the object without blocking; an AutomaticReset
+// signal is reset as part of a successful test
+//
+// Arguments:
+//
+//	NONE
+
+bool signal_base::TryAcquire(void)
+{
+	if(m_type == signal_type::ManualReset) return m_signaled.load();
+
+	bool expected = true;
+	return m_signaled.compare_exchange_strong(expected, false);
+}
+
+//-----------------------------------------------------------------------------
+// signal_base::Unregister (private)
+//
+// Removes a wait block from this signal
+//
+// Arguments:
+//
+//	block		- Wait block to be removed
+
+void signal_base::Unregister(wait_block* block)
+{
+	std::lock_guard<std::mutex> critsec(m_lock);
+
+	for(auto iterator = m_waitblocks.begin(); iterator != m_waitblocks.end(); iterator++) {
+
+		if(*iterator != block) continue;
+
+		m_waitblocks.erase(iterator);
+		--m_waiters;
+		break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// signal_base::WaitAny (static)
+//
+// Waits for any one of a collection of signals to be set
+//
+// Arguments:
+//
+//	signals		- Collection of signals to wait on
+//	timeout		- Timeout value, in milliseconds, or INFINITE
+
+DWORD signal_base::WaitAny(std::initializer_list<std::reference_wrapper<signal_base>> signals, uint32_t timeout)
+{
+	// Convert the references into an array of pointers for the internal version
+	std::vector<signal_base*> pointers;
+	for(const auto& signal : signals) pointers.push_back(&signal.get());
+
+	return WaitAny(pointers.data(), pointers.size(), timeout);
+}
+
+//-----------------------------------------------------------------------------
+// signal_base::WaitAny (private, static)
+//
+// Waits for any one of an array of signals to be set
+//
+// Arguments:
+//
+//	signals		- Array of signals to wait on
+//	count		- Number of signals in the array
+//	timeout		- Timeout value, in milliseconds, or INFINITE
+
+DWORD signal_base::WaitAny(signal_base* const* signals, size_t count, uint32_t timeout)
+{
+	_ASSERTE(signals && count);
+
+	// Fast path: check each signal before going through the effort of blocking
+	for(size_t index = 0; index < count; index++) if(signals[index]->TryAcquire()) return WAIT_OBJECT_0 + static_cast<DWORD>(index);
+	if(timeout == 0) return WAIT_TIMEOUT;
+
+	// Calculate the deadline for the wait against the monotonic clock
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+	// Register a wait block with each signal.  This has to happen before the block's lock
+	// is acquired below, Set() acquires the signal lock first and then the block lock
+	wait_block block;
+	for(size_t index = 0; index < count; index++) signals[index]->Register(&block);
+
+	DWORD result = WAIT_TIMEOUT;
+	{
+		std::unique_lock<std::mutex> critsec(block.lock);
+
+		while(result == WAIT_TIMEOUT) {
+
+			// Test each signal in order, the first one that is set satisfies the wait
+			for(size_t index = 0; index < count; index++)
+				if(signals[index]->TryAcquire()) { result = WAIT_OBJECT_0 + static_cast<DWORD>(index); break; }
+
+			if(result != WAIT_TIMEOUT) break;
+
+			// Wait for one of the signals to wake up this block or for the timeout to elapse
+			if(timeout == INFINITE) block.changed.wait(critsec);
+			else if(block.changed.wait_until(critsec, deadline) == std::cv_status::timeout) {
+
+				// One last check for a signal that was set right as the timeout elapsed
+				for(size_t index = 0; index < count; index++)
+					if(signals[index]->TryAcquire()) { result = WAIT_OBJECT_0 + static_cast<DWORD>(index); break; }
+
+				break;
+			}
+		}
+	}
+
+	// Remove the wait block from each of the signals before it goes out of scope
+	for(size_t index = 0; index < count; index++) signals[index]->Unregister(&block);
+
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+// svctl::thread_pool
+//-----------------------------------------------------------------------------
+
+// t_currentpool / t_currentworker
+//
+// Identifies the thread pool and worker queue associated with the calling thread
+static __declspec(thread) const thread_pool* t_currentpool = nullptr;
+static __declspec(thread) size_t t_currentworker = 0;
+
+//-----------------------------------------------------------------------------
+// thread_pool Constructor
+//
+// Arguments:
+//
+//	NONE
 
-		// Invalid status code
-		default: throw winexception(E_INVALIDARG);
-	}
-	
-	m_status = status;						// Service status has been changed		
+thread_pool::thread_pool() : m_active(0), m_drained(false), m_executed(0), m_faults(0), m_steals(0), m_submitted(0),
+	m_idle(0), m_next(0), m_paused(false), m_pending(0), m_size(0), m_stopping(false)
+{
 }
 
 //-----------------------------------------------------------------------------
-// service::Stop
+// thread_pool::Drain
 //
-// Stops the service
+// Waits for all queued tasks to complete and terminates the worker threads
 //
 // Arguments:
 //
-//	win32exitcode		- Win32 service exit code
-//	serviceexitcode		- Service specific exit code
+//	NONE
 
-DWORD service::Stop(DWORD win32exitcode, DWORD serviceexitcode)
+void thread_pool::Drain(void)
 {
-	std::lock_guard<std::recursive_mutex> critsec(m_statuslock);
-
-	// Service cannot be stopped unless it's RUNNING or PAUSED, this could cause
-	// potential race conditions in the derived service class; better to block it
-	if(m_status != ServiceStatus::Running && m_status != ServiceStatus::Paused) return ERROR_CALL_NOT_IMPLEMENTED;
-
-	// Set the service status to STOP_PENDING
-	try { SetStatus(ServiceStatus::StopPending); }
-	catch(...) { Abort(std::current_exception()); }
+	// Release any paused worker threads and instruct them to exit once the queues are empty;
+	// the timer lock is held so that no delayed task can be queued after this point
+	{
+		std::lock_guard<std::mutex> timercritsec(m_timerlock);
+		std::lock_guard<std::mutex> idlecritsec(m_idlelock);
+
+		m_paused.store(false);
+		m_stopping.store(true);
+		m_timers.clear();
+
+		m_idlechanged.notify_all();
+		m_timerchanged.notify_all();
+	}
 
-	try {
+	// If this is being called from a task, the calling worker thread cannot be joined.  Wait
+	// for everything else to complete; the worker will exit after the task returns and will
+	// be joined when Drain() is called again from the destructor
+	if(IsWorkerThread()) {
 
-		// Invoke all of the STOP handlers prior to setting the service to STOPPED
-		for(const auto& handler : Handlers) if(handler->Control == ServiceControl::Stop) handler->Invoke(this, 0, nullptr);
-		SetStatus(ServiceStatus::Stopped, win32exitcode, serviceexitcode);
+		std::unique_lock<std::mutex> idlecritsec(m_idlelock);
+		m_idlechanged.wait(idlecritsec, [=]() { return (m_pending.load() == 0) && (m_active.load() <= 1); });
+		return;
 	}
 
-	catch(...) { Abort(std::current_exception()); }
-
-	m_stopsignal.Set();				// Signal the exit from the main thread
+	// Join all of the worker threads; they will not exit until the queues are empty
+	std::lock_guard<std::mutex> critsec(m_workerslock);
+	if(m_drained) return;
 
-	return ERROR_SUCCESS;
+	if(m_timerthread.joinable()) m_timerthread.join();
+	for(const auto& worker : m_workers) if(worker->thread.joinable()) worker->thread.join();
+	m_drained = true;
 }
 
 //-----------------------------------------------------------------------------
-// service::TrySetStatus (private)
+// thread_pool::Enqueue (private)
 //
-// Exception-safe version of SetStatus(), should only be used when an exception
-// cannot be dealt with, like when stopping the service from another exception
+// Pushes a task onto a worker queue and wakes an idle worker thread
 //
 // Arguments:
 //
-//	status			- New service status to set
-//	win32exitcode	- Win32 specific exit code for ServiceStatus::Stopped (see documentation)
-//	serviceexitcode	- Service-specific exit code for ServiceStatus::Stopped (see documentation)
+//	index		- Index of the worker queue to receive the task
+//	task		- Task to be executed
 
-bool service::TrySetStatus(ServiceStatus status, uint32_t win32exitcode, uint32_t serviceexitcode)
+void thread_pool::Enqueue(size_t index, task_func&& task)
 {
-	// Attempt to change the service status and just eat any thrown exceptions
-	try { SetStatus(status, win32exitcode, serviceexitcode); }
-	catch(...) { return false; }
+	// Count the task before it's pushed; a worker scanning the queues can dequeue it and
+	// decrement m_pending as soon as it becomes visible
+	++m_submitted;
+	++m_pending;
+
+	{
+		std::lock_guard<std::mutex> critsec(m_workers[index]->lock);
+		m_workers[index]->queue.push_back(std::move(task));
+	}
 
-	return true;
+	// Only bother with the idle lock if there are worker threads waiting for work; a worker
+	// that becomes idle after this check will see the updated m_pending before it blocks
+	if(m_idle.load() > 0) {
+
+		std::lock_guard<std::mutex> critsec(m_idlelock);
+		m_idlechanged.notify_all();
+	}
 }
 
 //-----------------------------------------------------------------------------
-// svctl::service_harness
-//-----------------------------------------------------------------------------
+// thread_pool::getMetrics
+//
+// Gets a snapshot of the thread pool counters
+
+thread_pool::metrics thread_pool::getMetrics(void) const
+{
+	metrics snapshot;
+
+	snapshot.QueueDepth = m_pending.load();
+	snapshot.Active = m_active.load();
+	snapshot.Threads = static_cast<uint32_t>(m_workers.size());
+	snapshot.Submitted = m_submitted.load();
+	snapshot.Executed = m_executed.load();
+	snapshot.Steals = m_steals.load();
+	snapshot.Faults = m_faults.load();
+
+	return snapshot;
+}
 
 //-----------------------------------------------------------------------------
-// service_harness Constructor
+// thread_pool::IsWorkerThread (private)
+//
+// Determines if the calling thread is one of this pool's worker threads
 //
 // Arguments:
 //
 //	NONE
 
-service_harness::service_harness()
+bool thread_pool::IsWorkerThread(void) const
 {
-	// Initialize the SERVICE_STATUS to the default state
-	zero_init(m_status).dwCurrentState = static_cast<DWORD>(ServiceStatus::Stopped);
+	return (t_currentpool == this);
 }
 
 //-----------------------------------------------------------------------------
-// service_harness Destructor
+// thread_pool::Pause
+//
+// Prevents the worker threads from starting new tasks and waits for any
+// currently executing tasks to complete
+//
+// Arguments:
+//
+//	NONE
 
-service_harness::~service_harness()
+void thread_pool::Pause(void)
 {
-	// If the main service thread is still active, it needs to be detached
-	// (There doesn't appear to be a legitimate way to also kill it)
-	if(m_mainthread.joinable()) m_mainthread.detach();
+	std::unique_lock<std::mutex> critsec(m_idlelock);
+	if(m_stopping.load()) return;
+
+	m_paused.store(true);
+
+	// Wait for the active tasks to complete, not counting the calling thread if it's a worker
+	size_t self = (IsWorkerThread()) ? 1 : 0;
+	m_idlechanged.wait(critsec, [=]() { return m_active.load() <= self; });
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::AppendToMultiStringBuffer (private)
+// thread_pool::Resize
 //
-// Appends a single string to an existing REG_MULTI_SZ buffer or terminates the
-// buffer by appending a final NULL if nullptr has been specified for string
+// Sets the number of worker threads to be created by the pool
 //
 // Arguments:
 //
-//	buffer		- Parameter byte data buffer
-//	string		- String to append to the buffer, or nullptr to terminate
+//	threads		- Number of worker threads, or zero for the number of processors
 
-std::vector<uint8_t>& service_harness::AppendToMultiStringBuffer(std::vector<uint8_t>& buffer, const tchar_t* string)
+void thread_pool::Resize(uint32_t threads)
 {
-	// Calculate the length of the data to be appended to the buffer and get current position
-	size_t length = (string) ? ((_tcslen(string) + 1) * sizeof(tchar_t)) : sizeof(tchar_t);
-	size_t pos = buffer.size();
-
-	// Allocate sufficient space in the buffer to hold the new data
-	buffer.resize(buffer.size() + length);
-
-	// If a string was provided, copy that and the NUL terminator into the buffer.  Otherwise,
-	// append a single NULL by zeroing out the additional space reserved above
-	if(string) memcpy_s(buffer.data() + pos, buffer.size() - pos, string, length);
-	else memset(buffer.data() + pos, 0, length);
-
-	return buffer;
+	std::lock_guard<std::mutex> critsec(m_workerslock);
+	if(m_workers.empty()) m_size = threads;
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::CloseParameterStoreFunc (private)
+// thread_pool::Resume
 //
-// Function invoked by the service to close parameter storage
+// Resumes execution of tasks after the pool has been paused
 //
 // Arguments:
 //
-//	handle		- Handle provided by OpenParameterStore
+//	NONE
 
-void service_harness::CloseParameterStoreFunc(void* handle)
+void thread_pool::Resume(void)
 {
-	UNREFERENCED_PARAMETER(handle);
-	_ASSERTE(handle == reinterpret_cast<void*>(this));
+	std::lock_guard<std::mutex> critsec(m_idlelock);
+
+	m_paused.store(false);
+	m_idlechanged.notify_all();
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::Continue
+// thread_pool::StartWorkers (private)
 //
-// Sends SERVICE_CONTROL_CONTINUE to the service, throws an exception if the
-// service does not accept the control or stops prematurely
+// Creates the worker threads if they have not already been created
 //
 // Arguments:
 //
 //	NONE
 
-void service_harness::Continue(void)
+void thread_pool::StartWorkers(void)
 {
-	DWORD result = SendControl(ServiceControl::Continue);
-	if(result != ERROR_SUCCESS) throw winexception(result);
+	std::lock_guard<std::mutex> critsec(m_workerslock);
+	if(m_drained) throw winexception(ERROR_SERVICE_NOT_ACTIVE);
 
-	WaitForStatus(ServiceStatus::Running);
+	// The worker collection is never modified after this point until the pool is destroyed,
+	// which allows Enqueue() to index into it without holding the lock
+	if(m_workers.empty()) {
+
+		uint32_t size = (m_size) ? m_size : std::thread::hardware_concurrency();
+		if(size == 0) size = 1;
+
+		for(uint32_t count = 0; count < size; count++) m_workers.push_back(std::make_unique<worker>());
+		for(size_t worker = 0; worker < m_workers.size(); worker++)
+			m_workers[worker]->thread = std::thread(&thread_pool::WorkerMain, this, worker);
+	}
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::getCanContinue
+// thread_pool::Submit
 //
-// Determines if the service can be continued
+// Queues a task for execution by the thread pool
+//
+// Arguments:
+//
+//	task		- Task to be executed
 
-bool service_harness::getCanContinue(void)
+void thread_pool::Submit(task_func task)
 {
-	std::lock_guard<std::mutex> critsec(m_statuslock);
+	if(!task) throw winexception(ERROR_INVALID_PARAMETER);
 
-	// If the service is not running, it cannot be controlled at all
-	if(!m_mainthread.joinable()) return false;
+	// Tasks submitted from a worker go to that worker's own queue, tasks from outside the
+	// pool are distributed across the queues round-robin.  A worker is still running, so it
+	// will execute a task it submits even while the pool is draining
+	if(IsWorkerThread()) Enqueue(t_currentworker, std::move(task));
+	else {
 
-	// The service can be continued if it's in a PAUSED state and accepts the control
-	return ((static_cast<ServiceStatus>(m_status.dwCurrentState) == ServiceStatus::Paused) && 
-		ServiceControlAccepted(ServiceControl::Continue, m_status.dwControlsAccepted));
+		StartWorkers();
+
+		// Once the pool has started to drain the workers may already have found the queues empty
+		// and exited; Drain() sets m_stopping under the timer lock, so holding it here ensures that
+		// a task is either refused or counted before the workers can see the pool as stopping
+		std::lock_guard<std::mutex> critsec(m_timerlock);
+		if(m_stopping.load()) throw winexception(ERROR_SERVICE_NOT_ACTIVE);
+
+		Enqueue(m_next++ % m_workers.size(), std::move(task));
+	}
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::getCanPause
+// thread_pool::SubmitAfter
 //
-// Determines if the service can be paused
+// Queues a task for execution by the thread pool after a delay
+//
+// Arguments:
+//
+//	delay		- Delay before the task is queued, in milliseconds
+//	task		- Task to be executed
 
-bool service_harness::getCanPause(void)
+void thread_pool::SubmitAfter(uint32_t delay, task_func task)
 {
-	std::lock_guard<std::mutex> critsec(m_statuslock);
+	if(!task) throw winexception(ERROR_INVALID_PARAMETER);
+	if(delay == 0) return Submit(std::move(task));
 
-	// If the service is not running, it cannot be controlled at all
-	if(!m_mainthread.joinable()) return false;
+	// The worker threads have to exist before the timer thread can queue anything
+	StartWorkers();
 
-	// The service can be paused if it's in a RUNNING state and accepts the control
-	return ((static_cast<ServiceStatus>(m_status.dwCurrentState) == ServiceStatus::Running) && 
-		ServiceControlAccepted(ServiceControl::Pause, m_status.dwControlsAccepted));
+	// Like Submit(), refuse a task that would never be executed; delayed tasks are discarded
+	// as soon as the pool starts to drain rather than once it has finished
+	std::lock_guard<std::mutex> critsec(m_timerlock);
+	if(m_stopping.load()) throw winexception(ERROR_SERVICE_NOT_ACTIVE);
+
+	// The timer thread is created the first time a delayed task is submitted
+	if(!m_timerthread.joinable()) m_timerthread = std::thread(&thread_pool::TimerMain, this);
+
+	m_timers.insert(std::make_pair(std::chrono::steady_clock::now() + std::chrono::milliseconds(delay), std::move(task)));
+	m_timerchanged.notify_one();
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::getCanStop
+// thread_pool::TimerMain (private)
 //
-// Determines if the service can be stopped
+// Entry point for the delayed task timer thread
+//
+// Arguments:
+//
+//	NONE
 
-bool service_harness::getCanStop(void)
+void thread_pool::TimerMain(void)
 {
-	std::lock_guard<std::mutex> critsec(m_statuslock);
+	std::unique_lock<std::mutex> critsec(m_timerlock);
 
-	// If the service is not running, it cannot be controlled at all
-	if(!m_mainthread.joinable()) return false;
+	while(!m_stopping.load()) {
 
-	// The service can be stopped if it's not in a STOPPED or STOP_PENDING state and accepts the control
-	return ((static_cast<ServiceStatus>(m_status.dwCurrentState) != ServiceStatus::Stopped) && 
-		(static_cast<ServiceStatus>(m_status.dwCurrentState) != ServiceStatus::StopPending) &&
-		ServiceControlAccepted(ServiceControl::Stop, m_status.dwControlsAccepted));
+		if(m_timers.empty()) { m_timerchanged.wait(critsec); continue; }
+
+		// Wait for the earliest task to come due; this may be woken early by a new task
+		auto due = m_timers.begin()->first;
+		if(std::chrono::steady_clock::now() < due) { m_timerchanged.wait_until(critsec, due); continue; }
+
+		// Move the task onto a worker queue while the lock is still held, Drain() clears the
+		// delayed task collection under the same lock so nothing is queued after it starts
+		task_func task = std::move(m_timers.begin()->second);
+		m_timers.erase(m_timers.begin());
+		Enqueue(m_next++ % m_workers.size(), std::move(task));
+	}
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::LoadParameterFunc (private)
+// thread_pool::TryDequeue (private)
 //
-// Function invoked by the service to load a parameter value
+// Dequeues a task from the worker's own queue, or steals one from another queue
 //
 // Arguments:
 //
-//	handle		- Handle provided by OpenParameterStore
-//	name		- Name of the parameter to load
-//	format		- Expected parameter data format
-//	buffer		- Destination buffer for the parameter data
-//	length		- Length of the parameter destination buffer
+//	index		- Index of the worker thread looking for a task
+//	task		- Receives the dequeued task
 
-size_t service_harness::LoadParameterFunc(void* handle, const tchar_t* name, ServiceParameterFormat format, void* buffer, size_t length)
+bool thread_pool::TryDequeue(size_t index, task_func& task)
 {
-	// The handle provided by OpenParameterStore is fake; it's just the (this) pointer
-	_ASSERTE(handle == reinterpret_cast<void*>(this));
-	if(handle != reinterpret_cast<void*>(this)) throw winexception(ERROR_INVALID_PARAMETER);
-
-	std::lock_guard<std::recursive_mutex> critsec(m_paramlock);
+	// Check the worker's own queue first; the most recently queued task is the
+	// one most likely to still have its data in this processor's cache
+	{
+		std::lock_guard<std::mutex> critsec(m_workers[index]->lock);
+		if(!m_workers[index]->queue.empty()) {
+
+			task = std::move(m_workers[index]->queue.back());
+			m_workers[index]->queue.pop_back();
+			return true;
+		}
+	}
 
-	// If a buffer has been provided, initialize it to all zeros
-	if(buffer) memset(buffer, 0, length);
+	// Attempt to steal the oldest task from each of the other queues in turn
+	for(size_t offset = 1; offset < m_workers.size(); offset++) {
 
-	// Locate the parameter in the collection --> ERROR_FILE_NOT_FOUND if it doesn't exist
-	auto iterator = m_parameters.find(tstring(name));
-	if(iterator == m_parameters.end()) throw winexception(ERROR_FILE_NOT_FOUND);
+		worker* victim = m_workers[(index + offset) % m_workers.size()].get();
 
-	// Check the data type against the stored value --> ERROR_UNSUPPORTED_TYPE if doesn't match
-	if(iterator->second.first != format) throw winexception(ERROR_UNSUPPORTED_TYPE);
+		std::lock_guard<std::mutex> critsec(victim->lock);
+		if(!victim->queue.empty()) {
 
-	if(buffer) {
-			
-		// check the buffer length and copy the data --> ERROR_MORE_DATA if insufficient
-		if(length < iterator->second.second.size()) throw winexception(ERROR_MORE_DATA);
-		else memcpy_s(buffer, length, iterator->second.second.data(), iterator->second.second.size());
+			task = std::move(victim->queue.front());
+			victim->queue.pop_front();
+			++m_steals;
+			return true;
+		}
 	}
 
-	return iterator->second.second.size();			// Return the size of the parameter value in bytes
+	return false;
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::OpenParameterStoreFunc (private)
+// thread_pool::WorkerMain (private)
 //
-// Function invoked by the contained service to open parameter storage (no-op)
+// Entry point for a thread pool worker thread
 //
 // Arguments:
 //
-//	servicename		- Name of the service instance
+//	index		- Index of the worker thread / queue
 
-void* service_harness::OpenParameterStoreFunc(const tchar_t* servicename)
+void thread_pool::WorkerMain(size_t index)
 {
-	UNREFERENCED_PARAMETER(servicename);
+	t_currentpool = this;
+	t_currentworker = index;
 
-	// A handle isn't necessary for the local parameter store, use (this)
-	return reinterpret_cast<void*>(this); 
+	while(true) {
+
+		// m_active is incremented before dequeuing so that Pause() and Drain() never see
+		// a task that has been removed from a queue but not yet counted as active.  The
+		// paused flag is checked again afterwards in case Pause() was called in between
+		if(!m_paused.load()) {
+
+			task_func task;
+			++m_active;
+
+			bool dequeued = (!m_paused.load()) && TryDequeue(index, task);
+			if(dequeued) {
+
+				--m_pending;
+
+				try { task(); }
+				catch(...) { ++m_faults; }
+
+				task = nullptr;
+				++m_executed;
+			}
+
+			// Pause() and Drain() may be waiting for the active task count to drop
+			--m_active;
+			if(m_paused.load() || m_stopping.load()) {
+
+				std::lock_guard<std::mutex> critsec(m_idlelock);
+				m_idlechanged.notify_all();
+			}
+
+			if(dequeued) continue;
+		}
+
+		// Wait for more work to be queued, for the pool to be resumed or for the pool to stop
+		std::unique_lock<std::mutex> critsec(m_idlelock);
+		++m_idle;
+		m_idlechanged.wait(critsec, [=]() { return m_stopping.load() || (!m_paused.load() && (m_pending.load() > 0)); });
+		--m_idle;
+
+		if(m_stopping.load() && (m_pending.load() == 0)) break;
+	}
+
+	t_currentpool = nullptr;
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::Pause
-//
-// Sends SERVICE_CONTROL_PAUSE to the service, throws an exception if the
-// service does not accept the control or stops prematurely
+// svctl::winexception
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// winexception Constructor
 //
 // Arguments:
 //
-//	NONE
+//	result		- Win32 error code
 
-void service_harness::Pause(void)
+winexception::winexception(DWORD result) : m_code(result)
 {
-	DWORD result = SendControl(ServiceControl::Pause);
-	if(result != ERROR_SUCCESS) throw winexception(result);
+	char_t*				formatted;				// Formatted message
 
-	WaitForStatus(ServiceStatus::Paused);
+	// Invoke FormatMessageA to convert the system error code into an ANSI string; use a lame
+	// generic 'unknown' string for any codes that cannot be looked up successfully
+	if(FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, nullptr, result,
+		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), reinterpret_cast<char_t*>(&formatted), 0, nullptr)) {
+		
+		m_what = formatted;						// Store the formatted message string
+		LocalFree(formatted);					// Release FormatMessage() allocated buffer
+	}
+
+	else m_what = "Unknown Windows status code " + std::to_string(result);
 }
 
+};	// namespace svctl
+
 //-----------------------------------------------------------------------------
-// service_harness::RegisterHandlerFunc (private)
+// ::ServiceTable
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// ServiceTable::Dispatch
 //
-// Function invoked by the service to register it's control handler
+// Dispatches the collection of services to the service control manager
 //
 // Arguments:
 //
-//	servicename		- Name assigned to the service instance
-//	handler			- Pointer to the service's HandlerEx() callback
-//	context			- HandlerEx() callback context pointer
+//	services		- Collection of service_entry objects
 
-SERVICE_STATUS_HANDLE service_harness::RegisterHandlerFunc(LPCTSTR servicename, LPHANDLER_FUNCTION_EX handler, LPVOID context)
+int ServiceTable::Dispatch(void)
 {
-	_ASSERTE(handler != nullptr);
-	UNREFERENCED_PARAMETER(servicename);
+	svctl::dependency_tracker& dependencies = svctl::GetServiceDependencies();
 
-	m_handler = handler;					// Store the handler function pointer
-	m_context = context;					// Store the handler context pointer
+	// Convert the collection into a table of SERVICE_TABLE_ENTRY structures and declare the
+	// in-process dependencies between the services before any of them can be started
+	std::vector<SERVICE_TABLE_ENTRY> table;
+	for(size_t index = 0; index < vector::size(); index++) {
+
+		const svctl::service_table_entry& entry = vector::at(index);
+		table.push_back( { const_cast<LPTSTR>(entry.Name), entry.ServiceMain } );
+		dependencies.Add(entry.Name, entry.Dependencies);
+	}
+
+	try { dependencies.Validate(); }
+	catch(svctl::winexception& ex) { return static_cast<int>(ex.code()); }
+
+	table.push_back( { nullptr, nullptr } );		// Table needs to end with NULLs
+
+	// Attempt to start the service control dispatcher
+	if(!StartServiceCtrlDispatcher(table.data())) return static_cast<int>(GetLastError());
 
-	// Return the address of this harness instance as a pseudo SERVICE_STATUS_HANDLE for the service
-	return reinterpret_cast<SERVICE_STATUS_HANDLE>(this);
+	return 0;
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::SendControl
-//
-// Sends a control to the service
+// ::ServiceTableHarness
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// ServiceTableHarness Constructor
 //
 // Arguments:
 //
-//	control		- Control to be sent to the service
-//	eventtype	- Specifies a control-specific event type code (uncommon)
-//	eventdata	- Specifies control-specific event data (uncommon)
+//	table		- Table of services to be run by the harness
 
-DWORD service_harness::SendControl(ServiceControl control, DWORD eventtype, void* eventdata)
+ServiceTableHarness::ServiceTableHarness(const ServiceTable& table)
 {
-	std::unique_lock<std::mutex> critsec(m_statuslock);
-
-	// If the main service thread is not running, that's the same result as SERVICE_STOPPED
-	if(!m_mainthread.joinable()) return ERROR_SERVICE_NOT_ACTIVE;
-
-	// Certain service statuses prevent the service from being controlled at all, see ControlService() on MSDN
-	switch(static_cast<ServiceStatus>(m_status.dwCurrentState)) {
+	for(size_t index = 0; index < table.Count; index++) {
 
-		// SERVICE_STOPPED and SERVICE_STOP_PENDING never allow for a new control to be sent
-		case ServiceStatus::Stopped : return ERROR_SERVICE_NOT_ACTIVE;
-		case ServiceStatus::StopPending: return ERROR_SERVICE_CANNOT_ACCEPT_CTRL;
+		const svctl::service_table_entry& tableentry = table[index];
 
-		// SERVICE_START_PENDING only allows SERVICE_CONTROL_STOP
-		case ServiceStatus::StartPending : 
-			if(control != ServiceControl::Stop) return ERROR_SERVICE_CANNOT_ACCEPT_CTRL;
-			// fall-through
+		// Every service needs a harness of its own; they share the dependency tracker and dispatcher
+		std::unique_ptr<entry> item = std::make_unique<entry>();
+		item->Name = tableentry.Name;
+		item->Harness = std::make_unique<entry_harness>(tableentry.LocalMain, &m_dependencies, &m_broadcaster, &m_listeners);
+		m_entries.push_back(std::move(item));
 
-		// Check the requested control against the service's current accepted controls mask
-		default: if(!ServiceControlAccepted(control, m_status.dwControlsAccepted)) return ERROR_INVALID_SERVICE_CONTROL;
+		m_dependencies.Add(tableentry.Name, tableentry.Dependencies);
 	}
 
-	// Unlock the status critical section and invoke the service's handler directly
-	critsec.unlock();
-	return m_handler(static_cast<DWORD>(control), eventtype, eventdata, m_context);
+	m_dependencies.Validate();
+
+	// Controls are delivered to every service in the table on a single thread
+	m_dispatcher = std::thread(&ServiceTableHarness::DispatcherMain, this);
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::ServiceControlAccepted (private, static)
-//
-// Checks a ServiceControl against a SERVICE_ACCEPT_XXXX mask
-//
-// Arguments:
-//
-//	control			- Service control code to be checked
-//	mask			- SERVICE_ACCEPT_XXXX mask to check control against
+// ServiceTableHarness Destructor
 
-bool service_harness::ServiceControlAccepted(ServiceControl control, DWORD mask)
+ServiceTableHarness::~ServiceTableHarness()
 {
-	switch(control) {
-		
-		case ServiceControl::Stop:					return ((mask & SERVICE_ACCEPT_STOP) == SERVICE_ACCEPT_STOP);
-		case ServiceControl::Pause:					return ((mask & SERVICE_ACCEPT_PAUSE_CONTINUE) == SERVICE_ACCEPT_PAUSE_CONTINUE);
-		case ServiceControl::Continue:				return ((mask & SERVICE_ACCEPT_PAUSE_CONTINUE) == SERVICE_ACCEPT_PAUSE_CONTINUE);
-		case ServiceControl::Interrogate:			return true;
-		case ServiceControl::Shutdown:				return ((mask & SERVICE_ACCEPT_SHUTDOWN) == SERVICE_ACCEPT_SHUTDOWN);
-		case ServiceControl::ParameterChange:		return ((mask & SERVICE_ACCEPT_PARAMCHANGE) == SERVICE_ACCEPT_PARAMCHANGE);
-		case ServiceControl::NetBindAdd:			return ((mask & SERVICE_ACCEPT_NETBINDCHANGE) == SERVICE_ACCEPT_NETBINDCHANGE);
-		case ServiceControl::NetBindRemove:			return ((mask & SERVICE_ACCEPT_NETBINDCHANGE) == SERVICE_ACCEPT_NETBINDCHANGE);
-		case ServiceControl::NetBindEnable:			return ((mask & SERVICE_ACCEPT_NETBINDCHANGE) == SERVICE_ACCEPT_NETBINDCHANGE);
-		case ServiceControl::NetBindDisable:		return ((mask & SERVICE_ACCEPT_NETBINDCHANGE) == SERVICE_ACCEPT_NETBINDCHANGE);
-		case ServiceControl::DeviceEvent:			return false;
-		case ServiceControl::HardwareProfileChange:	return ((mask & SERVICE_ACCEPT_HARDWAREPROFILECHANGE) == SERVICE_ACCEPT_HARDWAREPROFILECHANGE);
-		case ServiceControl::PowerEvent:			return ((mask & SERVICE_ACCEPT_POWEREVENT) == SERVICE_ACCEPT_POWEREVENT);
-		case ServiceControl::SessionChange:			return ((mask & SERVICE_ACCEPT_SESSIONCHANGE) == SERVICE_ACCEPT_SESSIONCHANGE);
-		case ServiceControl::PreShutdown:			return ((mask & SERVICE_ACCEPT_PRESHUTDOWN) == SERVICE_ACCEPT_PRESHUTDOWN);
-		case ServiceControl::TimeChange:			return ((mask & SERVICE_ACCEPT_TIMECHANGE) == SERVICE_ACCEPT_TIMECHANGE);
-		case ServiceControl::TriggerEvent:			return ((mask & SERVICE_ACCEPT_TRIGGEREVENT) == SERVICE_ACCEPT_TRIGGEREVENT);
-		case ServiceControl::UserModeReboot:		return ((mask & SERVICE_ACCEPT_USERMODEREBOOT) == SERVICE_ACCEPT_USERMODEREBOOT);
-
-		// Allow any user-defined controls (128-255) to be passed to the service regardless of accept mask		
-		default: return ((static_cast<int>(control) >= 128) && (static_cast<int>(control) <= 255));
+	// Stop the dispatcher thread and wait for it to exit
+	{
+		std::lock_guard<std::mutex> critsec(m_controlslock);
+		m_dispatcherstop = true;
+		m_controlschanged.notify_all();
 	}
+
+	m_dispatcher.join();
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::SetParameter
+// ServiceTableHarness::operator[]
 //
-// Sets a string-based parameter key/value pair
+// Gets the harness for an individual service
 //
 // Arguments:
 //
-//	name		- Name of the parameter to set
-//	value		- Value to assign to the parameter
+//	name		- Name of the service
 
-void service_harness::SetParameter(const resstring& name, const tchar_t* value)
+svctl::service_harness& ServiceTableHarness::operator[](const svctl::resstring& name)
 {
-	// If a non-null string pointer was provided, set it, otherwise set a blank string instead
-	if(value) SetParameter(name, ServiceParameterFormat::String, value, (_tcslen(value) + 1) * sizeof(tchar_t));
-	else SetParameter(name, ServiceParameterFormat::String, _T("\0"), sizeof(tchar_t));
+	return *Find(name).Harness;
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::SetParameter
+// ServiceTableHarness::BroadcastControl
 //
-// Sets a string-based parameter key/value pair
+// Sends a control to every service and waits for all of them to process it
 //
 // Arguments:
 //
-//	name		- Name of the parameter to set
-//	value		- Value to assign to the parameter
+//	control		- Control to be sent to the services
+//	eventtype	- Specifies a control-specific event type code (uncommon)
+//	eventdata	- Specifies control-specific event data (uncommon)
 
-void service_harness::SetParameter(const resstring& name, const tstring& value)
+std::vector<ServiceTableHarness::control_result> ServiceTableHarness::BroadcastControl(ServiceControl control, DWORD eventtype, void* eventdata)
 {
-	// Set the parameter using the const tchar_t pointer for the string, include the null terminator
-	SetParameter(name, ServiceParameterFormat::String, value.c_str(), (value.length() + 1) * sizeof(tchar_t));
+	std::vector<std::future<DWORD>> futures;
+	std::vector<control_result> results;
+
+	// Queue the control for every service before waiting for any of them
+	auto start = std::chrono::steady_clock::now();
+	for(auto& item : m_entries) futures.push_back(QueueControl(*item, control, eventtype, eventdata));
+
+	for(size_t index = 0; index < m_entries.size(); index++) {
+
+		control_result result = { m_entries[index]->Name, futures[index].get(), 0 };
+		result.Elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		results.push_back(std::move(result));
+	}
+
+	return results;
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::SetParameter (private)
+// ServiceTableHarness::DispatcherMain (private)
 //
-// Internal implementation of SetParameter, accepts the type and raw data
+// Entry point for the dispatcher thread; delivers queued controls one at a time
 //
 // Arguments:
 //
-//	name		- Parameter name
-//	format		- Parameter format
-//	value		- Pointer to the parameter data
-//	length		- Length, in bytes, of the parameter data
+//	NONE
 
-void service_harness::SetParameter(const tstring& name, ServiceParameterFormat format, const void* value, size_t length)
+void ServiceTableHarness::DispatcherMain(void)
 {
-	_ASSERTE(value);
-	_ASSERTE(length > 0);
+	std::unique_lock<std::mutex> critsec(m_controlslock);
 
-	// Use pointers to the data as the iterators for constructing the vector<>
-	const uint8_t* begin = reinterpret_cast<const uint8_t*>(value);
-	const uint8_t* end = begin + length;
+	while(true) {
 
-	// Insert or replace the parameter value in the collection
-	SetParameter(name, format, std::vector<uint8_t>(begin, end));
+		m_controlschanged.wait(critsec, [&]() { return m_dispatcherstop || !m_controls.empty(); });
+
+		// Controls still queued when the harness is destroyed are not delivered
+		if(m_dispatcherstop) {
+
+			for(auto& pending : m_controls) pending->Result.set_value(ERROR_SERVICE_NOT_ACTIVE);
+			m_controls.clear();
+			return;
+		}
+
+		std::unique_ptr<pending_control> pending = std::move(m_controls.front());
+		m_controls.pop_front();
+
+		critsec.unlock();
+
+		auto dispatched = std::chrono::steady_clock::now();
+		pending->Target->Delay.Record(std::chrono::duration_cast<std::chrono::microseconds>(dispatched - pending->Queued).count());
+
+		try { pending->Result.set_value(pending->Target->Harness->SendControl(pending->Control, pending->EventType, pending->EventData)); }
+		catch(...) { pending->Result.set_exception(std::current_exception()); }
+
+		pending->Target->Handler.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - dispatched).count());
+
+		critsec.lock();
+	}
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::SetParameter (private)
+// ServiceTableHarness::Find (private)
 //
-// Internal implementation of SetParameter, accepts the type and raw data
+// Locates a service entry by name
 //
 // Arguments:
 //
-//	name		- Parameter name
-//	format		- Parameter format
-//	value		- Parameter data as a vector<> rvalue reference
+//	name		- Name of the service
 
-void service_harness::SetParameter(const tstring& name, ServiceParameterFormat format, std::vector<uint8_t>&& value)
+ServiceTableHarness::entry& ServiceTableHarness::Find(const svctl::tstring& name)
 {
-	if(name.length() == 0) throw winexception(ERROR_INVALID_PARAMETER);
-
-	std::lock_guard<std::recursive_mutex> critsec(m_paramlock);
-	m_parameters[name] = parameter_value(format, std::move(value));
+	for(auto& item : m_entries) if(_tcsicmp(item->Name.c_str(), name.c_str()) == 0) return *item;
+	throw svctl::winexception(ERROR_SERVICE_DOES_NOT_EXIST);
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::SetStatusFunc (private)
-//
-// Function invoked by the service to report a change in status
-//
-// Arguments:
+// ServiceTableHarness::getDispatchStatistics
 //
-//	handle		- Handle returned by RegisterHandlerFunc
-//	status		- New status being reported by the service
+// Gets the statistics for the controls dispatched to each service
 
-BOOL service_harness::SetStatusFunc(SERVICE_STATUS_HANDLE handle, LPSERVICE_STATUS status)
+std::vector<ServiceTableHarness::dispatch_statistics> ServiceTableHarness::getDispatchStatistics(void) const
 {
-	std::unique_lock<std::mutex> critsec(m_statuslock);
+	std::vector<dispatch_statistics> statistics;
 
-	// Ensure that the handle provided is actually the address of this harness instance
-	_ASSERTE(reinterpret_cast<service_harness*>(handle) == this);
-	if(reinterpret_cast<service_harness*>(handle) != this) { SetLastError(ERROR_INVALID_HANDLE); return FALSE; }
+	for(const auto& item : m_entries) {
 
-	m_status = *status;						// Copy the new SERVICE_STATUS
-	m_statuschanged.notify_all();			// Notify the status has been changed
+		dispatch_statistics stats;
 
-	return TRUE;
-};
+		stats.Name = item->Name;
+		stats.Controls = item->Handler.Count;
+		stats.DelayP50 = item->Delay.Percentile(50.0);
+		stats.DelayP99 = item->Delay.Percentile(99.0);
+		stats.DelayMax = item->Delay.Max;
+		stats.HandlerP50 = item->Handler.Percentile(50.0);
+		stats.HandlerP99 = item->Handler.Percentile(99.0);
+		stats.HandlerMax = item->Handler.Max;
+		statistics.push_back(std::move(stats));
+	}
+
+	return statistics;
+}
 
 //-----------------------------------------------------------------------------
-// service_harness::Start (private)
+// ServiceTableHarness::QueueControl (private)
 //
-// Starts the service
+// Queues a control for the dispatcher thread
 //
 // Arguments:
 //
-//	argvector		- vector<> of command line argument strings
+//	target		- Service to receive the control
+//	control		- Control code
+//	eventtype	- Control-specific event type
+//	eventdata	- Control-specific event data
 
-void service_harness::Start(std::vector<tstring>& argvector)
+std::future<DWORD> ServiceTableHarness::QueueControl(entry& target, ServiceControl control, DWORD eventtype, void* eventdata)
 {
-	using namespace std::placeholders;
-
-	// If the main thread has already been created, the service has already been started
-	if(m_mainthread.joinable()) throw winexception(ERROR_SERVICE_ALREADY_RUNNING);
-
-	// Always reset the SERVICE_STATUS back to defaults before starting the service
-	zero_init(m_status).dwCurrentState = static_cast<DWORD>(ServiceStatus::Stopped);
-
-	// There is an expectation that argv[0] is set to the service name
-	if((argvector.size() == 0) || (argvector[0].length() == 0)) throw winexception(E_INVALIDARG);
+	std::unique_ptr<pending_control> pending = std::make_unique<pending_control>();
 
-	// Create the main service thread and launch it
-	m_mainthread = std::move(std::thread([=]() {
+	pending->Target = &target;
+	pending->Control = control;
+	pending->EventType = eventtype;
+	pending->EventData = eventdata;
+	pending->Queued = std::chrono::steady_clock::now();
 
-		// Create a copy of the arguments vector local to this thread so it won't be destroyed
-		// prematurely, and convert it into an argv-style array of generic text string pointers
-		std::vector<tstring> arguments(argvector);
-		std::vector<tchar_t*> argv;
-		for(const auto& arg: arguments) argv.push_back(const_cast<tchar_t*>(arg.c_str()));
-		argv.push_back(nullptr);
+	std::future<DWORD> result = pending->Result.get_future();
 
-		// Create the context for the service by binding this instance's member functions
-		service_context context = { 
-			ServiceProcessType::Unique,
-			std::bind(&service_harness::RegisterHandlerFunc, this, _1, _2, _3),
-			std::bind(&service_harness::SetStatusFunc, this, _1, _2),
-			std::bind(&service_harness::OpenParameterStoreFunc, this, _1),
-			std::bind(&service_harness::LoadParameterFunc, this, _1, _2, _3, _4, _5),
-			std::bind(&service_harness::CloseParameterStoreFunc, this, _1) 
-		};
+	std::lock_guard<std::mutex> critsec(m_controlslock);
+	m_controls.push_back(std::move(pending));
+	m_controlschanged.notify_one();
 
-		// Launch the service with the specified command line arguments and instance context
-		LaunchService(static_cast<int>(argv.size() - 1), argv.data(), context);
-	}));
+	return result;
+}
 
-	// Wait up to 30 seconds for the service to set SERVICE_START_PENDING
-	if(!WaitForStatus(ServiceStatus::StartPending, 30000)) throw winexception(ERROR_SERVICE_REQUEST_TIMEOUT);
+//-----------------------------------------------------------------------------
+// ServiceTableHarness::SendControl
+//
+// Sends a control to a single service through the dispatcher
+//
+// Arguments:
+//
+//	name		- Name of the service
+//	control		- Control to be sent to the service
+//	eventtype	- Specifies a control-specific event type code (uncommon)
+//	eventdata	- Specifies control-specific event data (uncommon)
 
-	// Wait indefinitely for the service to set SERVICE_RUNNING
-	WaitForStatus(ServiceStatus::Running);
+DWORD ServiceTableHarness::SendControl(const svctl::resstring& name, ServiceControl control, DWORD eventtype, void* eventdata)
+{
+	return QueueControl(Find(name), control, eventtype, eventdata).get();
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::Stop
+// ServiceTableHarness::Start
 //
-// Sends SERVICE_CONTROL_STOP to the service, throws an exception if the
-// service does not accept the control or stops prematurely
+// Starts every service in parallel and waits for all of them to reach ServiceStatus::Running.
+// Services that depend on other services in the table wait for them to be running first
 //
 // Arguments:
 //
 //	NONE
 
-void service_harness::Stop(void)
+void ServiceTableHarness::Start(void)
 {
-	DWORD result = SendControl(ServiceControl::Stop);
-	if(result != ERROR_SUCCESS) throw winexception(result);
+	std::vector<std::thread> threads;
+	std::vector<std::exception_ptr> exceptions(m_entries.size());
 
-	WaitForStatus(ServiceStatus::Stopped);
+	m_broadcaster.ClearResults();
+
+	for(size_t index = 0; index < m_entries.size(); index++) {
+
+		threads.emplace_back([=, &exceptions]() {
+
+			try { m_entries[index]->Harness->Start(m_entries[index]->Name); }
+			catch(...) { exceptions[index] = std::current_exception(); }
+		});
+	}
+
+	for(auto& thread : threads) thread.join();
+
+	// Rethrow the first exception, if any of the services failed to start
+	for(const auto& exception : exceptions) if(exception) std::rethrow_exception(exception);
 }
 
 //-----------------------------------------------------------------------------
-// service_harness::WaitForStatus
+// ServiceTableHarness::Stop
 //
-// Waits for the service to reach the specified status
+// Sends ServiceControl::Stop to every service and waits for all of them to stop
 //
 // Arguments:
 //
-//	status		- Service status to wait for
-//	timeout		- Amount of time, in milliseconds, to wait before failing
+//	NONE
 
-bool service_harness::WaitForStatus(ServiceStatus status, uint32_t timeout)
+void ServiceTableHarness::Stop(void)
 {
-	std::unique_lock<std::mutex> critsec(m_statuslock);
+	std::exception_ptr exception;
 
-	// Wait for the condition variable to be trigged with the service status caller is looking for, or if
-	// the service has stopped unexpectedly due to an unhandled exception caught in ServiceMain()
-	bool result = m_statuschanged.wait_until(critsec, std::chrono::system_clock::now() + std::chrono::milliseconds(timeout), [=]() 
-	{ 
-		return (static_cast<ServiceStatus>(m_status.dwCurrentState) == status) || 
-			((static_cast<ServiceStatus>(m_status.dwCurrentState) == ServiceStatus::Stopped) && (m_status.dwWin32ExitCode != ERROR_SUCCESS)); 
-	});
+	// Services that depend on another service are stopped by it; they will reject the control
+	BroadcastControl(ServiceControl::Stop);
 
-	// If the service has stopped (regardless of the reason), wait for the main thread to terminate
-	if(static_cast<ServiceStatus>(m_status.dwCurrentState) == ServiceStatus::Stopped) m_mainthread.join();
+	for(auto& item : m_entries) {
 
-	// If an error was generated by the service, throw that as an exception to the caller
-	if(m_status.dwWin32ExitCode != ERROR_SUCCESS) throw winexception(m_status.dwWin32ExitCode);
+		try { item->Harness->WaitForStatus(ServiceStatus::Stopped); }
+		catch(...) { if(!exception) exception = std::current_exception(); }
+	}
 
-	return result;
+	if(exception) std::rethrow_exception(exception);
 }
 
 //-----------------------------------------------------------------------------
-// svctl::winexception
-//-----------------------------------------------------------------------------
-
-//-----------------------------------------------------------------------------
-// winexception Constructor
+// ServiceTableHarness::WaitForStatus
+//
+// Waits for every service to reach the specified status
 //
 // Arguments:
 //
-//	result		- Win32 error code
+//	status		- Status to wait for
+//	timeout		- Timeout, in milliseconds, for all of the services
 
-winexception::winexception(DWORD result) : m_code(result)
+bool ServiceTableHarness::WaitForStatus(ServiceStatus status, uint32_t timeout)
 {
-	char_t*				formatted;				// Formatted message
+	auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
 
-	// Invoke FormatMessageA to convert the system error code into an ANSI string; use a lame
-	// generic 'unknown' string for any codes that cannot be looked up successfully
-	if(FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, nullptr, result,
-		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), reinterpret_cast<char_t*>(&formatted), 0, nullptr)) {
-		
-		m_what = formatted;						// Store the formatted message string
-		LocalFree(formatted);					// Release FormatMessage() allocated buffer
-	}
+	for(auto& item : m_entries) {
 
-	else m_what = "Unknown Windows status code " + std::to_string(result);
-}
+		uint32_t remaining = timeout;
+		if(timeout != INFINITE) {
 
-};	// namespace svctl
+			auto now = std::chrono::steady_clock::now();
+			remaining = (now >= until) ? 0 : static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count());
+		}
 
-//-----------------------------------------------------------------------------
-// ::ServiceTable
-//-----------------------------------------------------------------------------
+		if(!item->Harness->WaitForStatus(status, remaining)) return false;
+	}
+
+	return true;
+}
 
 //-----------------------------------------------------------------------------
-// ServiceTable::Dispatch
+// ServiceTableHarness::entry_harness::LaunchService (private)
 //
-// Dispatches the collection of services to the service control manager
+// Launches the service by invoking it's LocalMain entry point with a shared process context
 //
 // Arguments:
 //
-//	services		- Collection of service_entry objects
+//	argc		- Number of command line arguments
+//	argv		- Array of command line argument strings
+//	context		- Service context provided by the harness
 
-int ServiceTable::Dispatch(void)
+void ServiceTableHarness::entry_harness::LaunchService(int argc, LPTSTR* argv, const svctl::service_context& context)
 {
-	// Convert the collection into a table of SERVICE_TABLE_ENTRY structures
-	std::vector<SERVICE_TABLE_ENTRY> table;
-	for(size_t index = 0; index < vector::size(); index++) {
-
-		const svctl::service_table_entry& entry = vector::at(index);
-		table.push_back( { const_cast<LPTSTR>(entry.Name), entry.ServiceMain } );
-	}
-
-	table.push_back( { nullptr, nullptr } );		// Table needs to end with NULLs
+	svctl::service_context shared = context;
 
-	// Attempt to start the service control dispatcher
-	if(!StartServiceCtrlDispatcher(table.data())) return static_cast<int>(GetLastError());
+	shared.ProcessType = ServiceProcessType::Shared;
+	shared.Dependencies = m_dependencies;
+	shared.ShutdownBroadcaster = m_broadcaster;
+	shared.Listeners = m_listeners;
 
-	return 0;
+	m_localmain(static_cast<DWORD>(argc), argv, shared);
 }
 
 //-----------------------------------------------------------------------------
-
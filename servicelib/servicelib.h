@@ -30,8 +30,12 @@
 #include <tchar.h>
 
 // Standard Template Library
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <future>
 #include <map>
@@ -127,6 +131,16 @@ enum class ServiceProcessType
 	Interactive					= SERVICE_INTERACTIVE_PROCESS,
 };
 
+// ::ServiceReadiness
+//
+// Strongly typed enumeration of service readiness levels
+enum class ServiceReadiness
+{
+	NotReady					= 0,		// Service is not running or is stopping
+	Ready						= 1,		// Service is running, warm-up tasks are outstanding
+	Warm						= 2,		// Service is running and all warm-up tasks have completed
+};
+
 // ::ServiceStartType
 //
 // Strongy typed enumeration of SERVICE_XXX_START constants
@@ -260,6 +274,12 @@ namespace svctl {
 	// Function used to load a parameter from storage
 	typedef std::function<size_t(void* handle, const tchar_t* name, ServiceParameterFormat format, void* buffer, size_t length)> load_parameter_func;
 
+	// svctl::local_main_func
+	//
+	// Function used to launch a service class with a host-provided service context
+	struct service_context;
+	typedef void(*local_main_func)(DWORD argc, LPTSTR* argv, const service_context& context);
+
 	// svctl::open_paramstore_func
 	//
 	// Function used to open a parameter storage handle
@@ -270,16 +290,57 @@ namespace svctl {
 	// Function used to register a service's control handler callback function
 	typedef std::function<SERVICE_STATUS_HANDLE(LPCTSTR servicename, LPHANDLER_FUNCTION_EX handler, LPVOID context)> register_handler_func;
 
+	// svctl::report_phase_func
+	//
+	// Function used to report a lifecycle phase marker; offset is in microseconds since the service was started
+	typedef std::function<void(const tchar_t* phase, uint64_t offset)> report_phase_func;
+
+	// svctl::report_progress_func
+	//
+	// Function used to report explicit progress during a pending service status
+	typedef std::function<void(ServiceStatus status, uint32_t step, uint32_t total, uint32_t waithint)> report_progress_func;
+
+	// svctl::report_recovery_func
+	//
+	// Function used to report that a service instance aborted and is being restarted in place
+	typedef std::function<void(DWORD exitcode, uint32_t attempt, uint32_t delay)> report_recovery_func;
+
 	// svctl::report_status_func
 	//
 	// Function used to report a service status to the service control manager
 	typedef std::function<void(SERVICE_STATUS& status)> report_status_func;
 
+	// svctl::save_parameter_func
+	//
+	// Function used to save a parameter to storage
+	typedef std::function<void(void* handle, const tchar_t* name, ServiceParameterFormat format, const void* buffer, size_t length)> save_parameter_func;
+
 	// svctl::set_status_func
 	//
 	// Function used to set a service status using the handle returned by the register_handler_func
 	typedef std::function<BOOL(SERVICE_STATUS_HANDLE handle, LPSERVICE_STATUS status)> set_status_func;
 
+	// svctl::task_func
+	//
+	// Function executed asynchronously by svctl::thread_pool
+	typedef std::function<void(void)> task_func;
+
+	// svctl::flight_event
+	//
+	// Constant used to define the type of event recorded by svctl::flight_recorder
+	enum class flight_event : uint16_t
+	{
+		ControlReceived		= 1,		// Code = control, Arg1 = event type
+		ControlCompleted	= 2,		// Code = control, Arg1 = result
+		HandlerEnter		= 3,		// Code = control, Arg1 = handler index
+		HandlerExit			= 4,		// Code = control, Arg1 = handler index, Arg2 = result
+		StopGroupEnter		= 5,		// Arg1 = stop group
+		StopGroupExit		= 6,		// Arg1 = stop group
+		StatusReported		= 7,		// Code = status, Arg1 = checkpoint, Arg2 = wait hint
+		ParametersReloaded	= 8,		// No arguments
+		Abort				= 9,		// Arg1 = win32 exit code
+	};
+
 	// svctl::signal_type
 	//
 	// Constant used to define the type of signal created by svctl::signal<>
@@ -366,289 +427,1205 @@ namespace svctl {
 		static const tstring GetResourceString(unsigned int id, HINSTANCE instance);
 	};
 
-	// svctl::signal
+	// svctl::signal_base
 	//
-	// Wrapper around an unnamed Win32 Event synchronization object
-	template<signal_type _type>
-	class signal
+	// Base class for svctl::signal<>.  The signaled state is kept in an atomic so that
+	// Set, Reset and a wait on an already signaled object never block; waiting threads
+	// only fall back to a condition variable when the signal is not set
+	class signal_base
 	{
 	public:
 
-		// Constructors
-		signal() : signal(false) {}
-		signal(bool signaled)
-		{
-			// Create the underlying Win32 event object
-			m_handle = CreateEvent(nullptr, static_cast<BOOL>(_type), (signaled) ? TRUE : FALSE, nullptr);
-			if(m_handle == nullptr) throw winexception();
-		}
+		// Reset
+		//
+		// Resets the signal to a non-signaled state
+		void Reset(void) { m_signaled.store(false); }
 
-		// Destructor
-		~signal() { CloseHandle(m_handle); }
+		// Set
+		//
+		// Sets the signal; releases a single waiter (AutomaticReset) or all waiters (ManualReset)
+		void Set(void);
 
-		// operator HANDLE()
+		// Wait
 		//
-		// Converts this instance into a HANDLE
-		operator HANDLE() const { return m_handle; }
+		// Waits for the signal to be set; returns false if the timeout (milliseconds) elapsed
+		bool Wait(void) { return Wait(INFINITE); }
+		bool Wait(uint32_t timeout) { signal_base* self = this; return (WaitAny(&self, 1, timeout) == WAIT_OBJECT_0); }
 
-		// Pulse
+		// WaitAny (static)
 		//
-		// Releases any threads waiting on this event object to be signaled
-		void Pulse(void) const { if(!PulseEvent(m_handle)) throw winexception(); }
+		// Waits for any one of a collection of signals to be set.  Returns WAIT_OBJECT_0 plus the
+		// index of the signal that satisfied the wait, or WAIT_TIMEOUT if the timeout elapsed
+		static DWORD WaitAny(std::initializer_list<std::reference_wrapper<signal_base>> signals) { return WaitAny(signals, INFINITE); }
+		static DWORD WaitAny(std::initializer_list<std::reference_wrapper<signal_base>> signals, uint32_t timeout);
 
-		// Reset
+	protected:
+
+		// Constructor / Destructor
+		signal_base(signal_type type, bool signaled) : m_signaled(signaled), m_type(type), m_waiters(0) {}
+		~signal_base()=default;
+
+	private:
+
+		signal_base(const signal_base&)=delete;
+		signal_base& operator=(const signal_base&)=delete;
+
+		// wait_block
 		//
-		// Resets the event to a non-signaled state
-		void Reset(void) const { if(!ResetEvent(m_handle)) throw winexception(); }
+		// Registered with every signal involved in a wait operation so that Set() can wake the waiter
+		struct wait_block
+		{
+			std::mutex					lock;
+			std::condition_variable		changed;
+		};
 
-		// Set
+		// Register
 		//
-		// Sets the event to a signaled state
-		void Set(void) const { if(!SetEvent(m_handle)) throw winexception(); }
+		// Registers a wait block with this signal
+		void Register(wait_block* block);
 
-	private:
+		// TryAcquire
+		//
+		// Tests the signaled state; consumes the signal if this is an AutomaticReset signal
+		bool TryAcquire(void);
 
-		signal(const signal&)=delete;
-		signal& operator=(const signal&)=delete;
+		// Unregister
+		//
+		// Removes a wait block from this signal
+		void Unregister(wait_block* block);
 
-		// m_handle
+		// WaitAny (static)
 		//
-		// Event kernel object handle
-		HANDLE m_handle;
-	};
+		// Internal version of WaitAny, accepts a pointer to an array of signals
+		static DWORD WaitAny(signal_base* const* signals, size_t count, uint32_t timeout);
 
-	// svctl::zero_init
-	//
-	// Handy little wrapper around memset to zero-initialize a structure
-	template <typename _type>
-	_type& zero_init(_type& value) { memset(&value, 0, sizeof(_type)); return value; }
+		// m_lock
+		//
+		// Synchronization object for the collection of wait blocks
+		std::mutex m_lock;
 
-	//
-	// Service Classes
-	//
+		// m_signaled
+		//
+		// Current signaled state
+		std::atomic<bool> m_signaled;
 
-	// svctl::control_handler
+		// m_type
+		//
+		// Type of signal (automatic or manual reset)
+		const signal_type m_type;
+
+		// m_waitblocks
+		//
+		// Collection of wait blocks registered by waiting threads
+		std::vector<wait_block*> m_waitblocks;
+
+		// m_waiters
+		//
+		// Number of registered wait blocks; allows Set() to skip the lock if nobody is waiting
+		std::atomic<uint32_t> m_waiters;
+	};
+
+	// svctl::signal
 	//
-	// Base class for all derived service control handlers
-	class __declspec(novtable) control_handler
+	// Lightweight event synchronization object, see svctl::signal_base
+	template<signal_type _type>
+	class signal : public signal_base
 	{
 	public:
 
+		// Constructors
+		signal() : signal(false) {}
+		signal(bool signaled) : signal_base(_type, signaled) {}
+
 		// Destructor
-		virtual ~control_handler()=default;
+		~signal()=default;
 
-		// Invoke
-		//
-		// Invokes the control handler
-		virtual DWORD Invoke(void* instance, DWORD eventtype, void* eventdata) const = 0;
+	private:
 
-		// Control
-		//
-		// Gets the control code registered for this handler
-		__declspec(property(get=getControl)) ServiceControl Control;
-		ServiceControl getControl(void) const { return m_control; }
+		signal(const signal&)=delete;
+		signal& operator=(const signal&)=delete;
+	};
 
-	protected:
+	// svctl::cancellation_state
+	//
+	// Shared state between a cancellation_source and the tokens it has issued
+	struct cancellation_state
+	{
+		// Cancelled
+		//
+		// Flag indicating that cancellation has been requested
+		std::atomic<bool> Cancelled;
 
-		// Constructor
-		control_handler(ServiceControl control) : m_control(control) {}
+		// Callbacks
+		//
+		// Callbacks to be invoked when cancellation is requested, keyed by cookie
+		std::map<uint32_t, std::function<void(void)>> Callbacks;
 
-	private:
+		// Lock
+		//
+		// Synchronization object for the callback collection
+		std::mutex Lock;
 
-		control_handler(const control_handler&)=delete;
-		control_handler& operator=(const control_handler&)=delete;
+		// NextCookie
+		//
+		// Next cookie value to assign to a registered callback
+		uint32_t NextCookie;
 
-		// m_control
+		// Signal
 		//
-		// ServiceControl code registered for this handler
-		const ServiceControl m_control;
-	};
+		// Signal set when cancellation has been requested
+		signal<signal_type::ManualReset> Signal;
 
-	// svctl::control_handler_table
-	//
-	// Typedef to clean up this declaration.  The control handler table is implemented
-	// as a vector of unique pointers to control_handler instances ...
-	typedef std::vector<std::unique_ptr<svctl::control_handler>> control_handler_table;
+		// Constructor
+		cancellation_state() : Cancelled(false), NextCookie(1) {}
+	};
 
-	// svctl::service_table_entry
+	// svctl::cancellation_token
 	//
-	// Defines a name and entry point for Service-derived class
-	class service_table_entry
+	// Cooperative cancellation token issued by a cancellation_source; cheap to copy
+	class cancellation_token
 	{
+	friend class cancellation_source;
 	public:
 
-		// Copy Constructor
-		service_table_entry(const service_table_entry&)=default;
+		// Constructors
+		cancellation_token() : m_state(std::make_shared<cancellation_state>()) {}
+		cancellation_token(const cancellation_token&)=default;
 
 		// Assignment Operator
-		service_table_entry& operator=(const service_table_entry&)=default;
+		cancellation_token& operator=(const cancellation_token&)=default;
 
-		// SERVICE_TABLE_ENTRY typecasting operator
-		operator SERVICE_TABLE_ENTRY() const { return { const_cast<tchar_t*>(m_name.c_str()), m_servicemain }; }
+		// Register
+		//
+		// Registers a callback to be invoked when cancellation is requested; if cancellation
+		// has already been requested the callback is invoked immediately and 0 is returned
+		uint32_t Register(std::function<void(void)> callback) const;
 
-		// Name
+		// Unregister
 		//
-		// Gets the service name
-		__declspec(property(get=getName)) const tchar_t* Name;
-		const tchar_t* getName(void) const { return m_name.c_str(); }
+		// Removes a previously registered callback
+		void Unregister(uint32_t cookie) const;
 
-		// ServiceMain
+		// Wait
 		//
-		// Gets the address of the service::ServiceMain function
-		__declspec(property(get=getServiceMain)) const LPSERVICE_MAIN_FUNCTION ServiceMain;
-		const LPSERVICE_MAIN_FUNCTION getServiceMain(void) const { return m_servicemain; }
+		// Waits for cancellation to be requested; returns false if the timeout elapsed first
+		bool Wait(void) const { return m_state->Signal.Wait(); }
+		bool Wait(uint32_t timeout) const { return m_state->Signal.Wait(timeout); }
 
-	protected:
+		// IsCancellationRequested
+		//
+		// Determines if cancellation has been requested
+		__declspec(property(get=getIsCancellationRequested)) bool IsCancellationRequested;
+		bool getIsCancellationRequested(void) const { return m_state->Cancelled.load(); }
 
-		// Instance constructors
-		service_table_entry(tstring name, const LPSERVICE_MAIN_FUNCTION servicemain) : 
-			m_name(name), m_servicemain(servicemain) {}
+		// Signal
+		//
+		// Exposes the cancellation signal, for use with signal_base::WaitAny
+		__declspec(property(get=getSignal)) signal_base& Signal;
+		signal_base& getSignal(void) const { return m_state->Signal; }
 
 	private:
 
-		// m_name
-		//
-		// The service name
-		tstring m_name;
+		// Instance Constructor
+		explicit cancellation_token(const std::shared_ptr<cancellation_state>& state) : m_state(state) {}
 
-		// m_servicemain
+		// m_state
 		//
-		// The service ServiceMain() static entry point
-		LPSERVICE_MAIN_FUNCTION m_servicemain;
+		// Shared cancellation state
+		std::shared_ptr<cancellation_state> m_state;
 	};
 
-	// svctl::parameter_base
+	// svctl::cancellation_source
 	//
-	// Base class for template-specific service parameters
-	class parameter_base
+	// Issues cancellation tokens and requests cancellation.  A source constructed from
+	// a parent token is automatically cancelled along with the parent
+	class cancellation_source
 	{
 	public:
 
-		// Destructor
-		virtual ~parameter_base()=default;
+		// Constructors / Destructor
+		cancellation_source() : m_parentcookie(0), m_state(std::make_shared<cancellation_state>()) {}
+		explicit cancellation_source(const cancellation_token& parent);
+		~cancellation_source();
 
-		// Bind
+		// Cancel
 		//
-		// Binds the parameter to the storage handle and value name
-		void Bind(void* handle, const tchar_t* name, const load_parameter_func& loadfunc);
+		// Requests cancellation of all issued tokens and invokes the registered callbacks
+		void Cancel(void) { Cancel(m_state); }
 
-		// Load
+		// IsCancellationRequested
 		//
-		// Loads the parameter value from storage
-		virtual void Load(void) = 0;
+		// Determines if cancellation has been requested
+		__declspec(property(get=getIsCancellationRequested)) bool IsCancellationRequested;
+		bool getIsCancellationRequested(void) const { return m_state->Cancelled.load(); }
 
-		// TryLoad
+		// Token
 		//
-		// Loads the parameter valye from storage; eats all exceptions
-		bool TryLoad(void);
+		// Gets a cancellation token associated with this source
+		__declspec(property(get=getToken)) cancellation_token Token;
+		cancellation_token getToken(void) const { return cancellation_token(m_state); }
 
-		// Unbind
+	private:
+
+		cancellation_source(const cancellation_source&)=delete;
+		cancellation_source& operator=(const cancellation_source&)=delete;
+
+		// Cancel (static)
 		//
-		// Unbinds the parameter
-		void Unbind(void);
+		// Requests cancellation of a specific cancellation state instance
+		static void Cancel(const std::shared_ptr<cancellation_state>& state);
 
-	protected:
+		// m_parent
+		//
+		// Parent token, if this is a child source
+		std::unique_ptr<cancellation_token> m_parent;
 
-		// Constructor
-		parameter_base()=default;
+		// m_parentcookie
+		//
+		// Cookie for the callback registered with the parent token
+		uint32_t m_parentcookie;
 
-		// IsBound
+		// m_state
 		//
-		// Determines if the parameter has been bound to storage
-		bool IsBound(void);
+		// Shared cancellation state
+		std::shared_ptr<cancellation_state> m_state;
+	};
 
-		// ReadValue<trivial>
+	// svctl::flight_recorder
+	//
+	// Fixed-size lock-free ring buffer of recent service events.  Recording an event is a single
+	// interlocked increment and a handful of relaxed stores; the oldest events are overwritten
+	class flight_recorder
+	{
+	public:
+
+		// svctl::flight_recorder::header
 		//
-		// Generic version of ReadValue for trivial data types
-		template <typename _type> _type ReadValue(ServiceParameterFormat format)
+		// Header of the binary dump format, followed by Count records ordered oldest first
+		struct header
 		{
-			static_assert(std::is_trivial<_type>::value, "data type is not trivial; ReadValue<> must be specialized");
+			uint32_t	Magic;				// HEADER_MAGIC ('SVFR')
+			uint16_t	Version;			// HEADER_VERSION
+			uint16_t	RecordSize;			// sizeof(record)
+			uint64_t	Frequency;			// Timestamp ticks per second
+			uint32_t	ProcessId;			// Process that recorded the events
+			uint32_t	Count;				// Number of records that follow the header
+		};
 
-			_type		value;						// Value to be read from storage
+		// svctl::flight_recorder::record
+		//
+		// Single event in the binary dump format
+		struct record
+		{
+			uint64_t	Sequence;			// Event sequence number, starting at one
+			uint64_t	Timestamp;			// Steady clock timestamp
+			uint32_t	ThreadId;			// Thread that recorded the event
+			uint16_t	Event;				// svctl::flight_event
+			uint16_t	Code;				// Event-specific code
+			uint32_t	Arg1;				// Event-specific argument
+			uint32_t	Arg2;				// Event-specific argument
+		};
 
-			// Attempt to read the binary value from the storage, set data to zeros on failure
-			m_loadfunc(m_handle, m_name.c_str(), format, &value, sizeof(_type));
+		// HEADER_MAGIC
+		//
+		// Value of header::Magic
+		static const uint32_t HEADER_MAGIC = 0x52465653;
 
-			return value;
-		}
+		// HEADER_VERSION
+		//
+		// Value of header::Version
+		static const uint16_t HEADER_VERSION = 1;
 
-		// ReadValue<tstring>
+		// Constructor / Destructor
+		flight_recorder();
+		~flight_recorder()=default;
+
+		// Dump
 		//
-		// Specialization of ReadValue<> for REG_SZ / REG_EXPAND_SZ
-		template <> tstring ReadValue<tstring>(ServiceParameterFormat format)
-		{
-			// Get the length of the buffer required to hold the string
-			size_t length = m_loadfunc(m_handle, m_name.c_str(), format, nullptr, 0);
+		// Generates a binary dump of the recorded events
+		std::vector<uint8_t> Dump(void) const;
 
-			// Special case: if the length of the string is zero, return an empty string
-			if(length == 0) return tstring();
+		// Record
+		//
+		// Records an event
+		void Record(flight_event event, uint32_t code = 0, uint32_t arg1 = 0, uint32_t arg2 = 0);
 
-			// Allocate a local std::vector<> as the backing storage and read the value
-			std::vector<uint8_t> buffer(length);
-			m_loadfunc(m_handle, m_name.c_str(), format, buffer.data(), length);
+	private:
 
-			// Convert the value into a tstring instance
-			return tstring(reinterpret_cast<tchar_t*>(buffer.data()));
-		}
+		flight_recorder(const flight_recorder&)=delete;
+		flight_recorder& operator=(const flight_recorder&)=delete;
 
-		// ReadValue<std::vector<tstring>>
+		// CAPACITY
 		//
-		// Specialization of ReadValue<> for REG_MULTI_SZ
-		template <> std::vector<tstring> ReadValue<std::vector<tstring>>(ServiceParameterFormat format)
+		// Number of events retained by the recorder
+		static const size_t CAPACITY = 512;
+
+		// slot
+		//
+		// Ring buffer slot; Sequence is zero while the slot is being written
+		struct slot
 		{
-			// Get the length of the buffer required to hold the string array
-			size_t length = m_loadfunc(m_handle, m_name.c_str(), format, nullptr, 0);
-			
-			// Special case: if length is zero, return an empty string vector
-			if(length == 0) return std::vector<tstring>();
+			std::atomic<uint64_t>	Sequence;	// Event sequence number
+			std::atomic<uint64_t>	Timestamp;	// Steady clock timestamp
+			std::atomic<uint64_t>	Header;		// Thread id, event and code
+			std::atomic<uint64_t>	Arguments;	// Event arguments
+		};
 
-			// Allocate a local std::vector<> as the backing storage and read the value
-			std::vector<uint8_t> buffer(length);
-			m_loadfunc(m_handle, m_name.c_str(), format, buffer.data(), length);
+		// m_next
+		//
+		// Sequence number of the most recently recorded event
+		std::atomic<uint64_t> m_next;
 
-			// Create a collection of tstring objects, one for each string in the returned array
-			std::vector<tstring> value;
-			const tchar_t* current = reinterpret_cast<const tchar_t*>(buffer.data());
-			while((current) && (*current)) {
+		// m_slots
+		//
+		// Ring buffer of recorded events
+		slot m_slots[CAPACITY];
+	};
 
-				value.push_back(tstring(current));
-				current += _tcslen(current) + 1;
-			}
+	// svctl::latency_histogram
+	//
+	// Lock-free log-linear (HDR-style) histogram of latencies in microseconds.  Each power of
+	// two is divided into eight linear sub-buckets, which bounds the error of any reported
+	// percentile to 12.5%; values of 2^40 microseconds or more are clamped
+	class latency_histogram
+	{
+	public:
 
-			return value;
-		}
+		// Constructor / Destructor
+		latency_histogram();
+		~latency_histogram()=default;
 
-		// m_handle
+		// Percentile
 		//
-		// Bound parameter storage handle
-		void* m_handle = nullptr;
+		// Gets the upper bound of the bucket containing the specified percentile (0-100)
+		uint64_t Percentile(double percentile) const;
 
-		// m_loadfunc
+		// Record
 		//
-		// Function used to load a parameter from storage
-		load_parameter_func m_loadfunc;
+		// Records a single latency value, in microseconds
+		void Record(uint64_t value);
 
-		// m_lock
+		// Count
 		//
-		// Synchronization object
-		std::recursive_mutex m_lock;
+		// Gets the number of recorded values
+		__declspec(property(get=getCount)) uint64_t Count;
+		uint64_t getCount(void) const { return m_count.load(std::memory_order_relaxed); }
 
-		// m_name
+		// Max
 		//
-		// Bound parameter value name
-		tstring m_name;
+		// Gets the largest recorded value
+		__declspec(property(get=getMax)) uint64_t Max;
+		uint64_t getMax(void) const { return m_max.load(std::memory_order_relaxed); }
 
 	private:
 
-		parameter_base(const parameter_base&)=delete;
-		parameter_base& operator=(const parameter_base&)=delete;
-	};
+		latency_histogram(const latency_histogram&)=delete;
+		latency_histogram& operator=(const latency_histogram&)=delete;
 
-	// svctl::parameter
-	//
-	// Service parameter template class
-	//
-	//	_type		- Value type
+		// SUB_BUCKET_BITS
+		//
+		// Number of bits used to select a linear sub-bucket within each power of two
+		static const uint32_t SUB_BUCKET_BITS = 3;
+
+		// MAX_MAGNITUDE
+		//
+		// Largest power of two that is tracked; larger values are clamped
+		static const uint32_t MAX_MAGNITUDE = 39;
+
+		// BUCKET_COUNT
+		//
+		// Total number of buckets in the histogram
+		static const size_t BUCKET_COUNT = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 2) << SUB_BUCKET_BITS;
+
+		// BucketIndex (static)
+		//
+		// Gets the index of the bucket that a value falls into
+		static size_t BucketIndex(uint64_t value);
+
+		// BucketUpperBound (static)
+		//
+		// Gets the largest value that falls into a bucket
+		static uint64_t BucketUpperBound(size_t index);
+
+		// m_buckets
+		//
+		// Bucket counters
+		std::atomic<uint64_t> m_buckets[BUCKET_COUNT];
+
+		// m_count
+		//
+		// Number of recorded values
+		std::atomic<uint64_t> m_count;
+
+		// m_max
+		//
+		// Largest recorded value
+		std::atomic<uint64_t> m_max;
+	};
+
+	// svctl::lock_statistics
+	//
+	// Snapshot of the statistics recorded for a named lock; times are in microseconds
+	struct lock_statistics
+	{
+		tstring		Name;				// Name of the lock
+		uint64_t	Acquisitions;		// Number of times the lock was acquired, including recursively
+		uint64_t	Contentions;		// Number of acquisitions that had to wait for another thread
+		uint64_t	WaitP50;			// Median time spent acquiring the lock
+		uint64_t	WaitP99;			// 99th percentile time spent acquiring the lock
+		uint64_t	WaitMax;			// Longest time spent acquiring the lock
+		uint64_t	HoldP50;			// Median time the lock was held
+		uint64_t	HoldP99;			// 99th percentile time the lock was held
+		uint64_t	HoldMax;			// Longest time the lock was held
+		uint32_t	MaxRecursion;		// Deepest recursive acquisition of the lock
+	};
+
+	// svctl::GetLockStatistics
+	//
+	// Gets a snapshot of the statistics recorded for each named lock; always empty
+	// unless SERVICELIB_LOCK_INSTRUMENTATION has been defined
+	std::vector<lock_statistics> GetLockStatistics(void);
+
+	// svctl::instrumented_mutex<>
+	//
+	// Named wrapper around std::mutex or std::recursive_mutex.  When SERVICELIB_LOCK_INSTRUMENTATION is
+	// defined, the wait time, hold time, recursion depth and contention of every acquisition is recorded
+	// against the name; all locks with the same name share their statistics.  Otherwise the wrapper is
+	// the underlying mutex.  The option changes the layout of the library classes, it must be defined
+	// the same way for the library and for every project that includes this header
+#ifdef SERVICELIB_LOCK_INSTRUMENTATION
+
+	// svctl::lock_counters
+	//
+	// Statistics recorded for a named lock
+	struct lock_counters
+	{
+		std::atomic<uint64_t>	Acquisitions;	// Number of acquisitions
+		std::atomic<uint64_t>	Contentions;	// Number of contended acquisitions
+		std::atomic<uint32_t>	MaxRecursion;	// Deepest recursive acquisition
+		latency_histogram		WaitTime;		// Time spent acquiring the lock
+		latency_histogram		HoldTime;		// Time the lock was held
+
+		lock_counters() : Acquisitions(0), Contentions(0), MaxRecursion(0) {}
+	};
+
+	// svctl::GetLockCounters
+	//
+	// Gets the statistics for a named lock, creating them if necessary
+	lock_counters* GetLockCounters(const tchar_t* name);
+
+	template <class _mutex>
+	class instrumented_mutex
+	{
+	public:
+
+		// Constructor / Destructor
+		explicit instrumented_mutex(const tchar_t* name) : m_counters(GetLockCounters(name)) {}
+		~instrumented_mutex()=default;
+
+		// lock
+		//
+		// Acquires the lock, recording how long it took if it was contended
+		void lock(void)
+		{
+			if(m_mutex.try_lock()) { Acquired(std::chrono::steady_clock::now(), false, 0); return; }
+
+			auto start = std::chrono::steady_clock::now();
+			m_mutex.lock();
+			auto acquired = std::chrono::steady_clock::now();
+
+			Acquired(acquired, true, std::chrono::duration_cast<std::chrono::microseconds>(acquired - start).count());
+		}
+
+		// try_lock
+		//
+		// Attempts to acquire the lock without waiting
+		bool try_lock(void)
+		{
+			if(!m_mutex.try_lock()) return false;
+
+			Acquired(std::chrono::steady_clock::now(), false, 0);
+			return true;
+		}
+
+		// unlock
+		//
+		// Releases the lock, recording how long it was held once it has been fully released
+		void unlock(void)
+		{
+			if(--m_depth == 0) m_counters->HoldTime.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_acquired).count());
+			m_mutex.unlock();
+		}
+
+	private:
+
+		instrumented_mutex(const instrumented_mutex&)=delete;
+		instrumented_mutex& operator=(const instrumented_mutex&)=delete;
+
+		// Acquired
+		//
+		// Records an acquisition of the lock; must be called with the lock held
+		void Acquired(std::chrono::steady_clock::time_point acquired, bool contended, uint64_t wait)
+		{
+			m_counters->Acquisitions.fetch_add(1, std::memory_order_relaxed);
+			if(contended) m_counters->Contentions.fetch_add(1, std::memory_order_relaxed);
+			m_counters->WaitTime.Record(wait);
+
+			if(++m_depth == 1) m_acquired = acquired;
+
+			uint32_t max = m_counters->MaxRecursion.load(std::memory_order_relaxed);
+			while((m_depth > max) && !m_counters->MaxRecursion.compare_exchange_weak(max, m_depth, std::memory_order_relaxed));
+		}
+
+		// m_acquired
+		//
+		// Time at which the lock was acquired by the owning thread; protected by the lock
+		std::chrono::steady_clock::time_point m_acquired;
+
+		// m_counters
+		//
+		// Statistics shared by every lock with the same name
+		lock_counters* const m_counters;
+
+		// m_depth
+		//
+		// Recursion depth of the owning thread; protected by the lock
+		uint32_t m_depth = 0;
+
+		// m_mutex
+		//
+		// Underlying mutex
+		_mutex m_mutex;
+	};
+
+#else
+
+	template <class _mutex>
+	class instrumented_mutex : public _mutex
+	{
+	public:
+
+		// Constructor / Destructor
+		explicit instrumented_mutex(const tchar_t* name) { UNREFERENCED_PARAMETER(name); }
+		~instrumented_mutex()=default;
+
+	private:
+
+		instrumented_mutex(const instrumented_mutex&)=delete;
+		instrumented_mutex& operator=(const instrumented_mutex&)=delete;
+	};
+
+#endif	// SERVICELIB_LOCK_INSTRUMENTATION
+
+	// svctl::named_condition_variable
+	//
+	// Condition variable that can wait on an instrumented_mutex<>.  Even without instrumentation
+	// the mutex is a distinct type derived from the standard one, which std::condition_variable
+	// cannot wait on
+	typedef std::condition_variable_any named_condition_variable;
+
+	// svctl::named_mutex
+	//
+	// Named, optionally instrumented, std::mutex
+	typedef instrumented_mutex<std::mutex> named_mutex;
+
+	// svctl::named_recursive_mutex
+	//
+	// Named, optionally instrumented, std::recursive_mutex
+	typedef instrumented_mutex<std::recursive_mutex> named_recursive_mutex;
+
+	// svctl::flush_estimate_func
+	//
+	// Function used to estimate the number of bytes a PRESHUTDOWN flush needs to write
+	typedef std::function<uint64_t(void)> flush_estimate_func;
+
+	// svctl::flush_func
+	//
+	// Function used to flush buffered data during PRESHUTDOWN; the token is cancelled when the
+	// flush budget, in milliseconds, has expired.  Returns the number of bytes flushed
+	typedef std::function<uint64_t(const cancellation_token& token, uint32_t budget)> flush_func;
+
+	// svctl::pause_gate
+	//
+	// Pause gate that registered worker threads pass through at safe points.  Passing an
+	// open gate is a single atomic load; passing a closed gate parks the worker thread
+	// until the gate is opened again
+	class pause_gate
+	{
+	public:
+
+		// Constructor / Destructor
+		pause_gate() : m_closed(false), m_parked(0), m_registered(0) {}
+		~pause_gate()=default;
+
+		// Close
+		//
+		// Closes the gate and waits for all registered worker threads to park, or for the timeout
+		// (milliseconds) to elapse.  Returns the number of registered threads that have not parked
+		uint32_t Close(void) { return Close(INFINITE); }
+		uint32_t Close(uint32_t timeout);
+
+		// Open
+		//
+		// Opens the gate and releases any parked worker threads
+		void Open(void);
+
+		// Pass
+		//
+		// Passes through the gate, blocking the calling thread while the gate is closed
+		void Pass(void) { if(m_closed.load(std::memory_order_acquire)) Park(); }
+
+		// Register
+		//
+		// Registers the calling worker thread with the gate; a registered thread must call
+		// Pass() periodically and Unregister() before it exits.  A thread can only be
+		// registered with one gate at a time
+		void Register(void);
+
+		// Unregister
+		//
+		// Unregisters the calling worker thread from the gate
+		void Unregister(void);
+
+		// IsClosed
+		//
+		// Determines if the gate is currently closed
+		__declspec(property(get=getIsClosed)) bool IsClosed;
+		bool getIsClosed(void) const { return m_closed.load(); }
+
+	private:
+
+		pause_gate(const pause_gate&)=delete;
+		pause_gate& operator=(const pause_gate&)=delete;
+
+		// Park
+		//
+		// Blocks the calling worker thread until the gate has been opened
+		void Park(void);
+
+		// m_changed
+		//
+		// Condition variable signaled when the gate or the parked count changes
+		std::condition_variable m_changed;
+
+		// m_closed
+		//
+		// Flag indicating that the gate is closed
+		std::atomic<bool> m_closed;
+
+		// m_lock
+		//
+		// Synchronization object for the worker counts
+		std::mutex m_lock;
+
+		// m_parked
+		//
+		// Number of registered worker threads parked at the gate; unregistered threads
+		// that pass through a closed gate are parked but not counted
+		uint32_t m_parked;
+
+		// m_registered
+		//
+		// Number of registered worker threads
+		uint32_t m_registered;
+	};
+
+	// svctl::thread_pool
+	//
+	// Work-stealing thread pool.  Each worker thread owns a task queue with its own lock;
+	// tasks submitted from a worker go onto that worker's queue and idle workers steal
+	// from the other queues, so there is no single queue lock for all threads to contend on
+	class thread_pool
+	{
+	public:
+
+		// svctl::thread_pool::metrics
+		//
+		// Snapshot of the thread pool counters
+		struct metrics
+		{
+			size_t		QueueDepth;			// Tasks waiting to be executed
+			size_t		Active;				// Tasks currently executing
+			uint32_t	Threads;			// Number of worker threads
+			uint64_t	Submitted;			// Total tasks submitted
+			uint64_t	Executed;			// Total tasks executed
+			uint64_t	Steals;				// Tasks executed by a worker other than the one queued to
+			uint64_t	Faults;				// Tasks that threw an exception
+		};
+
+		// Constructor / Destructor
+		thread_pool();
+		~thread_pool() { Drain(); }
+
+		// Drain
+		//
+		// Waits for all queued tasks to complete and terminates the worker threads.  If invoked
+		// from a task the calling worker thread is left to exit after the task returns
+		void Drain(void);
+
+		// IsWorkerThread
+		//
+		// Determines if the calling thread is a worker thread of this pool
+		bool IsWorkerThread(void) const;
+
+		// Pause
+		//
+		// Stops the worker threads from executing new tasks and waits for active tasks to complete
+		void Pause(void);
+
+		// Resize
+		//
+		// Sets the number of worker threads to create; 0 uses the number of processors.
+		// Has no effect once the worker threads have been created
+		void Resize(uint32_t threads);
+
+		// Resume
+		//
+		// Resumes execution of tasks after Pause()
+		void Resume(void);
+
+		// Submit
+		//
+		// Queues a task for execution; worker threads are created on first use.  Tasks should
+		// not throw exceptions, any that are thrown are caught and counted as faults.  Throws
+		// ERROR_SERVICE_NOT_ACTIVE if the pool has started to drain, unless called from a worker
+		// thread of the pool
+		void Submit(task_func task);
+
+		// SubmitAfter
+		//
+		// Queues a task for execution after a delay, in milliseconds.  Delayed tasks that have
+		// not come due by the time the pool starts to drain are discarded; throws
+		// ERROR_SERVICE_NOT_ACTIVE if the pool has started to drain
+		void SubmitAfter(uint32_t delay, task_func task);
+
+		// Metrics
+		//
+		// Gets a snapshot of the thread pool counters
+		__declspec(property(get=getMetrics)) metrics Metrics;
+		metrics getMetrics(void) const;
+
+	private:
+
+		thread_pool(const thread_pool&)=delete;
+		thread_pool& operator=(const thread_pool&)=delete;
+
+		// worker
+		//
+		// Worker thread and task queue
+		struct worker
+		{
+			std::mutex				lock;
+			std::deque<task_func>	queue;
+			std::thread				thread;
+		};
+
+		// Enqueue
+		//
+		// Pushes a task onto a specific worker queue and wakes an idle worker
+		void Enqueue(size_t index, task_func&& task);
+
+		// StartWorkers
+		//
+		// Creates the worker threads if they have not already been created
+		void StartWorkers(void);
+
+		// TimerMain
+		//
+		// Entry point for the delayed task timer thread
+		void TimerMain(void);
+
+		// TryDequeue
+		//
+		// Dequeues a task from the worker's own queue, or steals one from another worker
+		bool TryDequeue(size_t index, task_func& task);
+
+		// WorkerMain
+		//
+		// Entry point for a worker thread
+		void WorkerMain(size_t index);
+
+		// m_active
+		//
+		// Number of tasks currently executing
+		std::atomic<size_t> m_active;
+
+		// m_drained
+		//
+		// Flag indicating that the pool has been drained
+		bool m_drained;
+
+		// m_executed, m_faults, m_steals, m_submitted
+		//
+		// Thread pool counters
+		std::atomic<uint64_t> m_executed;
+		std::atomic<uint64_t> m_faults;
+		std::atomic<uint64_t> m_steals;
+		std::atomic<uint64_t> m_submitted;
+
+		// m_idle
+		//
+		// Number of worker threads waiting for work
+		std::atomic<uint32_t> m_idle;
+
+		// m_idlechanged
+		//
+		// Condition variable used to wake idle worker threads and waiters
+		std::condition_variable m_idlechanged;
+
+		// m_idlelock
+		//
+		// Synchronization object for idle worker threads and pool state changes
+		std::mutex m_idlelock;
+
+		// m_next
+		//
+		// Next queue to receive a task submitted from outside of the pool
+		std::atomic<size_t> m_next;
+
+		// m_paused
+		//
+		// Flag indicating that workers should not start new tasks
+		std::atomic<bool> m_paused;
+
+		// m_pending
+		//
+		// Number of tasks waiting in the queues
+		std::atomic<size_t> m_pending;
+
+		// m_size
+		//
+		// Number of worker threads to create
+		uint32_t m_size;
+
+		// m_stopping
+		//
+		// Flag indicating that the worker threads should exit when the queues are empty
+		std::atomic<bool> m_stopping;
+
+		// m_timerchanged
+		//
+		// Condition variable used to wake the timer thread
+		std::condition_variable m_timerchanged;
+
+		// m_timerlock
+		//
+		// Synchronization object for the delayed task collection
+		std::mutex m_timerlock;
+
+		// m_timers
+		//
+		// Delayed tasks, ordered by due time
+		std::multimap<std::chrono::steady_clock::time_point, task_func> m_timers;
+
+		// m_timerthread
+		//
+		// Delayed task timer thread, created when the first delayed task is submitted
+		std::thread m_timerthread;
+
+		// m_workers
+		//
+		// Worker thread collection
+		std::vector<std::unique_ptr<worker>> m_workers;
+
+		// m_workerslock
+		//
+		// Synchronization object for creating and destroying the worker threads
+		std::mutex m_workerslock;
+	};
+
+	// svctl::zero_init
+	//
+	// Handy little wrapper around memset to zero-initialize a structure
+	template <typename _type>
+	_type& zero_init(_type& value) { memset(&value, 0, sizeof(_type)); return value; }
+
+	//
+	// Service Classes
+	//
+
+	// svctl::control_handler
+	//
+	// Base class for all derived service control handlers
+	class __declspec(novtable) control_handler
+	{
+	public:
+
+		// Destructor
+		virtual ~control_handler()=default;
+
+		// Invoke
+		//
+		// Invokes the control handler
+		virtual DWORD Invoke(void* instance, DWORD eventtype, void* eventdata) const = 0;
+
+		// Control
+		//
+		// Gets the control code registered for this handler
+		__declspec(property(get=getControl)) ServiceControl Control;
+		ServiceControl getControl(void) const { return m_control; }
+
+		// Group
+		//
+		// Gets the stop group for this handler; zero if the handler is not grouped
+		__declspec(property(get=getGroup)) uint32_t Group;
+		uint32_t getGroup(void) const { return m_group; }
+
+		// Name
+		//
+		// Gets the name of the handler function
+		__declspec(property(get=getName)) const tchar_t* Name;
+		const tchar_t* getName(void) const { return (m_name) ? m_name : _T(""); }
+
+	protected:
+
+		// Constructors
+		control_handler(ServiceControl control) : control_handler(control, nullptr, 0) {}
+		control_handler(ServiceControl control, const tchar_t* name, uint32_t group) : 
+			m_control(control), m_group(group), m_name(name) {}
+
+	private:
+
+		control_handler(const control_handler&)=delete;
+		control_handler& operator=(const control_handler&)=delete;
+
+		// m_control
+		//
+		// ServiceControl code registered for this handler
+		const ServiceControl m_control;
+
+		// m_group
+		//
+		// Stop group for this handler
+		const uint32_t m_group;
+
+		// m_name
+		//
+		// Name of the handler function; must be a string literal
+		const tchar_t* const m_name;
+	};
+
+	// svctl::control_handler_table
+	//
+	// Typedef to clean up this declaration.  The control handler table is implemented
+	// as a vector of unique pointers to control_handler instances ...
+	typedef std::vector<std::unique_ptr<svctl::control_handler>> control_handler_table;
+
+	// svctl::stop_group
+	//
+	// Validates a stop group number declared in a service map at compile time; group zero
+	// is reserved for the ungrouped Stop handlers
+	template<uint32_t _group>
+	struct stop_group
+	{
+		static_assert(_group != 0, "Stop group zero is reserved for ungrouped Stop handlers");
+		static const uint32_t value = _group;
+	};
+
+	// svctl::service_table_entry
+	//
+	// Defines a name and entry point for Service-derived class
+	class service_table_entry
+	{
+	public:
+
+		// Copy Constructor
+		service_table_entry(const service_table_entry&)=default;
+
+		// Assignment Operator
+		service_table_entry& operator=(const service_table_entry&)=default;
+
+		// SERVICE_TABLE_ENTRY typecasting operator
+		operator SERVICE_TABLE_ENTRY() const { return { const_cast<tchar_t*>(m_name.c_str()), m_servicemain }; }
+
+		// Dependencies
+		//
+		// Gets the names of the in-process services this service depends on
+		__declspec(property(get=getDependencies)) const std::vector<tstring>& Dependencies;
+		const std::vector<tstring>& getDependencies(void) const { return m_dependencies; }
+
+		// LocalMain
+		//
+		// Gets the address of the service::LocalMain function
+		__declspec(property(get=getLocalMain)) const local_main_func LocalMain;
+		const local_main_func getLocalMain(void) const { return m_localmain; }
+
+		// Name
+		//
+		// Gets the service name
+		__declspec(property(get=getName)) const tchar_t* Name;
+		const tchar_t* getName(void) const { return m_name.c_str(); }
+
+		// ServiceMain
+		//
+		// Gets the address of the service::ServiceMain function
+		__declspec(property(get=getServiceMain)) const LPSERVICE_MAIN_FUNCTION ServiceMain;
+		const LPSERVICE_MAIN_FUNCTION getServiceMain(void) const { return m_servicemain; }
+
+	protected:
+
+		// Instance constructors
+		service_table_entry(tstring name, const LPSERVICE_MAIN_FUNCTION servicemain, const local_main_func localmain) : 
+			m_name(name), m_servicemain(servicemain), m_localmain(localmain) {}
+
+		service_table_entry(tstring name, const LPSERVICE_MAIN_FUNCTION servicemain, const local_main_func localmain, std::vector<tstring>&& dependencies) :
+			m_name(name), m_servicemain(servicemain), m_localmain(localmain), m_dependencies(std::move(dependencies)) {}
+
+	private:
+
+		// m_name
+		//
+		// The service name
+		tstring m_name;
+
+		// m_servicemain
+		//
+		// The service ServiceMain() static entry point
+		LPSERVICE_MAIN_FUNCTION m_servicemain;
+
+		// m_localmain
+		//
+		// The service LocalMain() static entry point
+		local_main_func m_localmain;
+
+		// m_dependencies
+		//
+		// Names of the in-process services this service depends on
+		std::vector<tstring> m_dependencies;
+	};
+
+	// svctl::parameter_base
+	//
+	// Base class for template-specific service parameters
+	class parameter_base
+	{
+	public:
+
+		// Destructor
+		virtual ~parameter_base()=default;
+
+		// Bind
+		//
+		// Binds the parameter to the storage handle and value name
+		void Bind(void* handle, const tchar_t* name, const load_parameter_func& loadfunc);
+
+		// Load
+		//
+		// Loads the parameter value from storage
+		virtual void Load(void) = 0;
+
+		// TryLoad
+		//
+		// Loads the parameter valye from storage; eats all exceptions
+		bool TryLoad(void);
+
+		// Unbind
+		//
+		// Unbinds the parameter
+		void Unbind(void);
+
+	protected:
+
+		// Constructor
+		parameter_base()=default;
+
+		// IsBound
+		//
+		// Determines if the parameter has been bound to storage
+		bool IsBound(void);
+
+		// ReadValue<trivial>
+		//
+		// Generic version of ReadValue for trivial data types
+		template <typename _type> _type ReadValue(ServiceParameterFormat format)
+		{
+			static_assert(std::is_trivial<_type>::value, "data type is not trivial; ReadValue<> must be specialized");
+
+			_type		value;						// Value to be read from storage
+
+			// Attempt to read the binary value from the storage, set data to zeros on failure
+			m_loadfunc(m_handle, m_name.c_str(), format, &value, sizeof(_type));
+
+			return value;
+		}
+
+		// ReadValue<tstring>
+		//
+		// Specialization of ReadValue<> for REG_SZ / REG_EXPAND_SZ
+		template <> tstring ReadValue<tstring>(ServiceParameterFormat format)
+		{
+			// Get the length of the buffer required to hold the string
+			size_t length = m_loadfunc(m_handle, m_name.c_str(), format, nullptr, 0);
+
+			// Special case: if the length of the string is zero, return an empty string
+			if(length == 0) return tstring();
+
+			// Allocate a local std::vector<> as the backing storage and read the value
+			std::vector<uint8_t> buffer(length);
+			m_loadfunc(m_handle, m_name.c_str(), format, buffer.data(), length);
+
+			// Convert the value into a tstring instance
+			return tstring(reinterpret_cast<tchar_t*>(buffer.data()));
+		}
+
+		// ReadValue<std::vector<tstring>>
+		//
+		// Specialization of ReadValue<> for REG_MULTI_SZ
+		template <> std::vector<tstring> ReadValue<std::vector<tstring>>(ServiceParameterFormat format)
+		{
+			// Get the length of the buffer required to hold the string array
+			size_t length = m_loadfunc(m_handle, m_name.c_str(), format, nullptr, 0);
+			
+			// Special case: if length is zero, return an empty string vector
+			if(length == 0) return std::vector<tstring>();
+
+			// Allocate a local std::vector<> as the backing storage and read the value
+			std::vector<uint8_t> buffer(length);
+			m_loadfunc(m_handle, m_name.c_str(), format, buffer.data(), length);
+
+			// Create a collection of tstring objects, one for each string in the returned array
+			std::vector<tstring> value;
+			const tchar_t* current = reinterpret_cast<const tchar_t*>(buffer.data());
+			while((current) && (*current)) {
+
+				value.push_back(tstring(current));
+				current += _tcslen(current) + 1;
+			}
+
+			return value;
+		}
+
+		// m_handle
+		//
+		// Bound parameter storage handle
+		void* m_handle = nullptr;
+
+		// m_loadfunc
+		//
+		// Function used to load a parameter from storage
+		load_parameter_func m_loadfunc;
+
+		// m_lock
+		//
+		// Synchronization object
+		named_recursive_mutex m_lock { _T("parameter::m_lock") };
+
+		// m_name
+		//
+		// Bound parameter value name
+		tstring m_name;
+
+	private:
+
+		parameter_base(const parameter_base&)=delete;
+		parameter_base& operator=(const parameter_base&)=delete;
+	};
+
+	// svctl::parameter
+	//
+	// Service parameter template class
+	//
+	//	_type		- Value type
 	//	_format		- Format flags to pass into load_parameter_func
 	//	_inittype	- Type used with an initializer list
 	//	_zeroinit	- Flag that the type can be zero-initialized by default
@@ -678,7 +1655,7 @@ namespace svctl {
 		// typecasting operator
 		operator _type()
 		{
-			std::lock_guard<std::recursive_mutex> critsec(m_lock);
+			std::lock_guard<named_recursive_mutex> critsec(m_lock);
 			return m_value;
 		}
 
@@ -686,13 +1663,13 @@ namespace svctl {
 		//
 		// Flag if the value has been defaulted or if it has been read from storage
 		__declspec(property(get=getIsDefaulted)) bool IsDefaulted;
-		bool getIsDefaulted(void) const { std::lock_guard<std::recursive_mutex> critsec(m_lock); return m_defaulted; }
+		bool getIsDefaulted(void) const { std::lock_guard<named_recursive_mutex> critsec(m_lock); return m_defaulted; }
 
 		// Value
 		//
 		// Retrieves the value of the parameter; can be used with auto keyword instead of operator()
 		__declspec(property(get=getValue)) _type Value;
-		_type getValue(void) { std::lock_guard<std::recursive_mutex> critsec(m_lock); return m_value; }
+		_type getValue(void) { std::lock_guard<named_recursive_mutex> critsec(m_lock); return m_value; }
 
 	private:
 
@@ -704,7 +1681,7 @@ namespace svctl {
 		// Invoked in respose to a SERVICE_CONTROL_PARAM_CHANGE; loads the value
 		virtual void Load(void)
 		{
-			std::lock_guard<std::recursive_mutex> critsec(m_lock);
+			std::lock_guard<named_recursive_mutex> critsec(m_lock);
 			if(!IsBound()) return;
 
 			// Attempt to read the value from storage, and if successful clear defaulted flag
@@ -723,6 +1700,361 @@ namespace svctl {
 		_type m_value;
 	};
 
+	// svctl::dependency_tracker
+	//
+	// Tracks the in-process dependencies between services hosted by the same process.  A service is started
+	// once every service it depends on is running, and is stopped before any service it depends on is
+	class dependency_tracker
+	{
+	public:
+
+		// Constructor / Destructor
+		dependency_tracker()=default;
+		~dependency_tracker()=default;
+
+		// Add
+		//
+		// Declares a service and the names of the in-process services it depends on
+		void Add(const tstring& name, const std::vector<tstring>& dependencies);
+
+		// Attach
+		//
+		// Sets the function used to stop a service on behalf of a service it depends on
+		void Attach(const tstring& name, std::function<void(void)> stop);
+
+		// Detach
+		//
+		// Removes the stop function for a service, waiting for any invocation of it to return
+		void Detach(const tstring& name);
+
+		// SetStatus
+		//
+		// Records a change in the status of a service
+		void SetStatus(const tstring& name, ServiceStatus status);
+
+		// StopDependents
+		//
+		// Stops every service that depends on a service in parallel on the tracker executor and
+		// waits for them to stop
+		void StopDependents(const tstring& name);
+
+		// Validate
+		//
+		// Verifies that every dependency names a declared service and that there are no cycles
+		void Validate(void) const;
+
+		// WaitForDependencies
+		//
+		// Waits for every service that a service depends on to report SERVICE_RUNNING, or for the
+		// timeout (milliseconds) to elapse.  Returns false if the token was cancelled while waiting
+		bool WaitForDependencies(const tstring& name, const cancellation_token& token, uint32_t timeout);
+
+	private:
+
+		dependency_tracker(const dependency_tracker&)=delete;
+		dependency_tracker& operator=(const dependency_tracker&)=delete;
+
+		// name_compare
+		//
+		// Case-insensitive service name comparison
+		struct name_compare
+		{
+			bool operator() (const tstring& lhs, const tstring& rhs) const { return _tcsicmp(lhs.c_str(), rhs.c_str()) < 0; }
+		};
+
+		// node
+		//
+		// Dependencies and state of a single service
+		struct node
+		{
+			std::vector<tstring>		Dependencies;							// Services this service depends on
+			ServiceStatus				Status = ServiceStatus::Stopped;		// Last reported status
+			bool						Started = false;						// Set once a status has been reported
+			std::function<void(void)>	Stop;									// Function that stops the service
+			bool						StopRequested = false;					// Set once Stop has been invoked
+			uint32_t					Stopping = 0;							// Invocations of Stop in progress
+		};
+
+		// node_collection
+		//
+		// Collection of services, by name
+		using node_collection = std::map<tstring, node, name_compare>;
+
+		// Visit
+		//
+		// Depth-first search used to detect dependency cycles
+		void Visit(const tstring& name, std::map<tstring, int, name_compare>& visited) const;
+
+		// m_changed
+		//
+		// Condition variable set when a service status has changed or a stop has completed
+		std::condition_variable m_changed;
+
+		// m_lock
+		//
+		// Synchronization object
+		mutable std::mutex m_lock;
+
+		// m_nodes
+		//
+		// Declared services and their state
+		node_collection m_nodes;
+
+		// m_executor
+		//
+		// Executor for the stop requests made on behalf of a service; declared last so that
+		// it is drained before the state its tasks refer to is destroyed
+		thread_pool m_executor;
+	};
+
+	// svctl::GetServiceDependencies
+	//
+	// Gets the process-wide dependency tracker used by the services dispatched through a ServiceTable
+	dependency_tracker& GetServiceDependencies(void);
+
+	// svctl::shutdown_broadcaster
+	//
+	// Broadcasts SHUTDOWN and PRESHUTDOWN to every service hosted by the same process.  The first service
+	// to receive the control invokes the handlers of all of them concurrently, each on a thread of its own,
+	// so that the process shuts down in the time taken by the slowest service rather than the sum of them all
+	class shutdown_broadcaster
+	{
+	public:
+
+		// svctl::shutdown_broadcaster::result
+		//
+		// Outcome of a broadcast control for a single service
+		struct result
+		{
+			uint64_t		Broadcast;		// Broadcast the result belongs to
+			tstring			Name;			// Name of the service
+			ServiceControl	Control;		// Control that was broadcast
+			DWORD			Result;			// Result returned by the service's control handler
+			uint32_t		Elapsed;		// Milliseconds from the start of the broadcast to the handler returning
+			bool			Completed;		// Set once the handler has returned
+		};
+
+		// Constructor / Destructor
+		shutdown_broadcaster()=default;
+		~shutdown_broadcaster();
+
+		// Attach
+		//
+		// Sets the function used to invoke the control handler of a service
+		void Attach(const tstring& name, std::function<DWORD(ServiceControl control, DWORD eventtype, void* eventdata)> handler);
+
+		// Broadcast
+		//
+		// Invoked when a service receives SHUTDOWN or PRESHUTDOWN.  Starts a broadcast of the control unless
+		// the service is already part of one, waits for the whole broadcast to complete or for the budget to
+		// expire, and returns the result of the service's own handler
+		DWORD Broadcast(const tstring& name, ServiceControl control, DWORD eventtype, void* eventdata);
+
+		// ClearResults
+		//
+		// Discards the results of previous broadcasts
+		void ClearResults(void);
+
+		// Detach
+		//
+		// Removes the handler function for a service, waiting for any invocation of it to return
+		void Detach(const tstring& name);
+
+		// IsBroadcastControl (static)
+		//
+		// Determines if a service control is broadcast to every service in the process
+		static bool IsBroadcastControl(ServiceControl control) { return (control == ServiceControl::Shutdown) || (control == ServiceControl::PreShutdown); }
+
+		// SetBudget
+		//
+		// Sets the process-wide time limit for a broadcast, in milliseconds
+		void SetBudget(uint32_t budget);
+
+		// Budget
+		//
+		// Gets the process-wide time limit for a broadcast, in milliseconds
+		__declspec(property(get=getBudget)) uint32_t Budget;
+		uint32_t getBudget(void) const { std::lock_guard<std::mutex> critsec(m_lock); return m_budget; }
+
+		// Results
+		//
+		// Gets the outcome of each broadcast control for each service
+		__declspec(property(get=getResults)) std::vector<result> Results;
+		std::vector<result> getResults(void) const { std::lock_guard<std::mutex> critsec(m_lock); return m_results; }
+
+	private:
+
+		shutdown_broadcaster(const shutdown_broadcaster&)=delete;
+		shutdown_broadcaster& operator=(const shutdown_broadcaster&)=delete;
+
+		// SHUTDOWN_BUDGET
+		//
+		// Default time limit for a broadcast, in milliseconds
+		const uint32_t SHUTDOWN_BUDGET = 20000;
+
+		// name_compare
+		//
+		// Case-insensitive service name comparison
+		struct name_compare
+		{
+			bool operator() (const tstring& lhs, const tstring& rhs) const { return _tcsicmp(lhs.c_str(), rhs.c_str()) < 0; }
+		};
+
+		// outcome
+		//
+		// State of a broadcast control for a single service
+		struct outcome
+		{
+			uint64_t								Broadcast;		// Broadcast the service is part of
+			std::chrono::steady_clock::time_point	Deadline;		// Time at which the broadcast budget expires
+			bool									Completed;		// Set once the handler has returned
+			DWORD									Result;			// Result returned by the handler
+		};
+
+		// node
+		//
+		// Handler function and broadcast state of a single service
+		struct node
+		{
+			std::function<DWORD(ServiceControl, DWORD, void*)>	Handler;		// Invokes the service control handler
+			std::map<ServiceControl, outcome>					Outcomes;		// State of each broadcast control
+			uint32_t											Active = 0;		// Invocations of Handler or Broadcast in progress
+		};
+
+		// node_collection
+		//
+		// Collection of services, by name
+		using node_collection = std::map<tstring, node, name_compare>;
+
+		// m_broadcasts
+		//
+		// Number of broadcasts that have been started
+		uint64_t m_broadcasts = 0;
+
+		// m_budget
+		//
+		// Process-wide time limit for a broadcast, in milliseconds
+		uint32_t m_budget = SHUTDOWN_BUDGET;
+
+		// m_changed
+		//
+		// Condition variable set when a handler has returned
+		std::condition_variable m_changed;
+
+		// m_lock
+		//
+		// Synchronization object
+		mutable std::mutex m_lock;
+
+		// m_nodes
+		//
+		// Attached services and their broadcast state
+		node_collection m_nodes;
+
+		// m_results
+		//
+		// Outcome of each broadcast control for each service
+		std::vector<result> m_results;
+
+		// m_running
+		//
+		// Handler threads that have not yet returned
+		uint32_t m_running = 0;
+	};
+
+	// svctl::GetShutdownBroadcaster
+	//
+	// Gets the process-wide shutdown broadcaster used by the services dispatched through a ServiceTable
+	shutdown_broadcaster& GetShutdownBroadcaster(void);
+
+	// svctl::listener_registry
+	//
+	// Listening sockets kept open by the service host on behalf of its services, by name.  Sockets are
+	// passed in by the parent process or handed over by a service, and remain open and accepting into
+	// their backlog while a service is restarted.  Sockets are SOCKET values; the registry does not use
+	// them itself and never closes them
+	class listener_registry
+	{
+	public:
+
+		// Constructor / Destructor
+		listener_registry()=default;
+		~listener_registry()=default;
+
+		// Add
+		//
+		// Adds a listening socket under the specified name; a different socket cannot be added with the same name
+		void Add(const tstring& name, uintptr_t socket);
+
+		// Find
+		//
+		// Looks up a listening socket by name; returns false if there is no socket with the name
+		bool Find(const tstring& name, uintptr_t& socket) const;
+
+		// Inherit
+		//
+		// Adds the listening sockets passed by the parent process in the LISTEN_SOCKETS environment variable,
+		// which is then removed so that they are not passed on again; returns the number of sockets added
+		size_t Inherit(void);
+
+		// Remove
+		//
+		// Removes a listening socket by name, the caller becomes responsible for closing it; returns false if
+		// there is no socket with the name
+		bool Remove(const tstring& name, uintptr_t& socket);
+
+		// Names
+		//
+		// Gets the names of the listening sockets in the registry
+		__declspec(property(get=getNames)) std::vector<tstring> Names;
+		std::vector<tstring> getNames(void) const;
+
+	private:
+
+		listener_registry(const listener_registry&)=delete;
+		listener_registry& operator=(const listener_registry&)=delete;
+
+		// LISTEN_SOCKETS_VARIABLE
+		//
+		// Name of the environment variable listening sockets are passed in by the parent process
+		const tchar_t* LISTEN_SOCKETS_VARIABLE = _T("LISTEN_SOCKETS");
+
+		// name_compare
+		//
+		// Case-insensitive listener name comparison
+		struct name_compare
+		{
+			bool operator() (const tstring& lhs, const tstring& rhs) const { return _tcsicmp(lhs.c_str(), rhs.c_str()) < 0; }
+		};
+
+		// m_listeners
+		//
+		// Listening sockets, by name
+		std::map<tstring, uintptr_t, name_compare> m_listeners;
+
+		// m_lock
+		//
+		// Synchronization object
+		mutable std::mutex m_lock;
+	};
+
+	// svctl::GetListenerRegistry
+	//
+	// Gets the process-wide listener registry used by the services dispatched through a ServiceTable; the
+	// sockets passed by the parent process are added the first time it is accessed
+	listener_registry& GetListenerRegistry(void);
+
+	// svctl::timeline_entry
+	//
+	// Single phase of the service lifecycle timeline; times are in microseconds since the service was
+	// started.  Phases are contiguous, each one ends when the next one begins
+	struct timeline_entry
+	{
+		tstring		Phase;				// Name of the phase
+		uint64_t	Start;				// Time at which the phase began
+		uint64_t	Duration;			// Length of the phase, zero for the final phase
+	};
+
 	// svctl::service_context
 	//
 	// Service runtime context information provided to ServiceMain to
@@ -758,6 +2090,212 @@ namespace svctl {
 		//
 		// Defines the function used to close parameter storage
 		close_paramstore_func CloseParameterStore;
+
+		// ReportProgressFunc
+		//
+		// Optional function invoked when the service reports explicit progress
+		report_progress_func ReportProgressFunc;
+
+		// SaveParameter
+		//
+		// Defines the function used to save a parameter to storage
+		save_parameter_func SaveParameter;
+
+		// ReportPhaseFunc
+		//
+		// Optional function invoked when the service marks a lifecycle phase
+		report_phase_func ReportPhaseFunc;
+
+		// FlightRecorder
+		//
+		// Optional host-owned flight recorder to use in place of the service's own
+		flight_recorder* FlightRecorder;
+
+		// Dependencies
+		//
+		// Optional tracker of the in-process dependencies between the services hosted by the process
+		dependency_tracker* Dependencies;
+
+		// ShutdownBroadcaster
+		//
+		// Optional broadcaster of SHUTDOWN and PRESHUTDOWN to every service hosted by the process
+		shutdown_broadcaster* ShutdownBroadcaster;
+
+		// ReportRecoveryFunc
+		//
+		// Optional function invoked when an aborted service instance is being restarted in place
+		report_recovery_func ReportRecoveryFunc;
+
+		// Listeners
+		//
+		// Optional registry of listening sockets kept open by the service host
+		listener_registry* Listeners;
+	};
+
+	// svctl::instance_pool
+	//
+	// Pool of service class instances constructed ahead of time.  Disabled unless a capacity has been
+	// set, in which case the service entry points take a prewarmed instance from the pool and a
+	// replacement is constructed in the background, off the service start path
+	template <class _derived>
+	class instance_pool
+	{
+	public:
+
+		// svctl::instance_pool::statistics
+		//
+		// Snapshot of the instance pool counters
+		struct statistics
+		{
+			size_t		Capacity;			// Number of instances kept constructed ahead of time
+			size_t		Available;			// Instances constructed and waiting to be acquired
+			uint64_t	Hits;				// Instances acquired from the pool
+			uint64_t	Misses;				// Instances constructed on demand because the pool was empty
+		};
+
+		// Acquire
+		//
+		// Gets an instance of the service class, from the pool if one is available
+		std::unique_ptr<_derived> Acquire(void)
+		{
+			std::unique_ptr<_derived> instance = TryAcquire();
+			return (instance) ? std::move(instance) : std::make_unique<_derived>();
+		}
+
+		// AcquireShared
+		//
+		// Gets a shared instance of the service class, from the pool if one is available
+		std::shared_ptr<_derived> AcquireShared(void)
+		{
+			std::unique_ptr<_derived> instance = TryAcquire();
+			return (instance) ? std::shared_ptr<_derived>(std::move(instance)) : std::make_shared<_derived>();
+		}
+
+		// Get (static)
+		//
+		// Gets the process-wide instance pool for the service class
+		static instance_pool& Get(void)
+		{
+			static instance_pool pool;
+			return pool;
+		}
+
+		// Resize
+		//
+		// Sets the number of instances to keep constructed ahead of time; zero disables the pool
+		void Resize(size_t capacity)
+		{
+			std::vector<std::unique_ptr<_derived>> discarded;		// Destroyed after the lock is released
+			std::lock_guard<std::mutex> critsec(m_lock);
+
+			m_capacity = capacity;
+			while(m_instances.size() > m_capacity) {
+
+				discarded.push_back(std::move(m_instances.back()));
+				m_instances.pop_back();
+			}
+
+			Replenish();
+		}
+
+		// Statistics
+		//
+		// Gets a snapshot of the instance pool counters
+		__declspec(property(get=getStatistics)) statistics Statistics;
+		statistics getStatistics(void) const
+		{
+			std::lock_guard<std::mutex> critsec(m_lock);
+			return { m_capacity, m_instances.size(), m_hits, m_misses };
+		}
+
+	private:
+
+		instance_pool() { m_executor.Resize(1); }
+		~instance_pool() { m_executor.Drain(); }
+
+		instance_pool(const instance_pool&)=delete;
+		instance_pool& operator=(const instance_pool&)=delete;
+
+		// Replenish
+		//
+		// Queues construction of instances until the pool will hold its capacity; m_lock must be held
+		void Replenish(void)
+		{
+			while(m_instances.size() + m_pending < m_capacity) {
+
+				m_pending++;
+				m_executor.Submit([=]() {
+
+					// A constructor that throws leaves the pool short until the next instance is acquired
+					std::unique_ptr<_derived> instance;
+					try { instance = std::make_unique<_derived>(); }
+					catch(...) { /* DO NOTHING */ }
+
+					std::lock_guard<std::mutex> critsec(m_lock);
+
+					m_pending--;
+					if(instance && (m_instances.size() < m_capacity)) m_instances.push_back(std::move(instance));
+				});
+			}
+		}
+
+		// TryAcquire
+		//
+		// Takes a prewarmed instance from the pool and queues construction of its replacement; returns
+		// nullptr if the pool is disabled or empty
+		std::unique_ptr<_derived> TryAcquire(void)
+		{
+			std::unique_ptr<_derived> instance;
+			std::lock_guard<std::mutex> critsec(m_lock);
+
+			if(m_capacity == 0) return nullptr;
+
+			if(m_instances.empty()) m_misses++;
+			else {
+
+				instance = std::move(m_instances.back());
+				m_instances.pop_back();
+				m_hits++;
+			}
+
+			Replenish();
+			return instance;
+		}
+
+		// m_capacity
+		//
+		// Number of instances to keep constructed ahead of time
+		size_t m_capacity = 0;
+
+		// m_executor
+		//
+		// Executor used to construct instances in the background
+		thread_pool m_executor;
+
+		// m_hits
+		//
+		// Number of instances acquired from the pool
+		uint64_t m_hits = 0;
+
+		// m_instances
+		//
+		// Instances constructed and waiting to be acquired
+		std::vector<std::unique_ptr<_derived>> m_instances;
+
+		// m_lock
+		//
+		// Synchronization object
+		mutable std::mutex m_lock;
+
+		// m_misses
+		//
+		// Number of instances constructed on demand because the pool was empty
+		uint64_t m_misses = 0;
+
+		// m_pending
+		//
+		// Number of instances queued for construction
+		size_t m_pending = 0;
 	};
 
 	// svctl::service
@@ -768,7 +2306,22 @@ namespace svctl {
 	public:
 
 		// Destructor
-		virtual ~service()=default;
+		virtual ~service();
+
+		// svctl::service::control_statistics
+		//
+		// Snapshot of the statistics recorded for a service control code; latencies are in microseconds
+		struct control_statistics
+		{
+			uint64_t	Invocations;		// Number of times the control was received
+			uint64_t	Errors;				// Number of times a result other than ERROR_SUCCESS was returned
+			uint64_t	HandlerP50;			// Median time spent processing the control
+			uint64_t	HandlerP99;			// 99th percentile time spent processing the control
+			uint64_t	HandlerMax;			// Longest time spent processing the control
+			uint64_t	LockWaitP50;		// Median time spent waiting for the status lock
+			uint64_t	LockWaitP99;		// 99th percentile time spent waiting for the status lock
+			uint64_t	LockWaitMax;		// Longest time spent waiting for the status lock
+		};
 
 	protected:
 		
@@ -785,6 +2338,23 @@ namespace svctl {
 		// Continues the service from a paused state
 		DWORD Continue(void);
 
+		// DumpControlStatistics
+		//
+		// Writes the statistics for every control code received to the debugger output.  Can be
+		// bound to a custom control code in the service's CONTROL_HANDLER_MAP
+		void DumpControlStatistics(void);
+
+		// GetControlStatistics
+		//
+		// Gets a snapshot of the statistics recorded for a service control code
+		control_statistics GetControlStatistics(ServiceControl control);
+
+		// GetStopGroupDeadline
+		//
+		// Gets the deadline, in milliseconds, declared for a stop group in the STOP_GROUP_MAP;
+		// zero if the group has no deadline
+		virtual uint32_t GetStopGroupDeadline(uint32_t group) const;
+
 		// IterateParameters
 		//
 		// Iterates over the collection of parameters and executes a function against each
@@ -795,6 +2365,12 @@ namespace svctl {
 		// Loads a named value from the parameter store; uses registry if not overriden in derived class
 		virtual size_t LoadParameter(void* handle, const tchar_t* name, ServiceParameterFormat format, void* buffer, size_t length);
 
+		// GetListener
+		//
+		// Gets a listening socket kept open by the service host, either passed in by the parent process or
+		// retained by an earlier instance of the service; returns false if there is no socket with the name
+		bool GetListener(const tchar_t* name, uintptr_t& socket) const;
+
 		// LocalMain (shared_ptr)
 		//
 		// Entry point when the service is executed as an application.  Enabled if the service class derives
@@ -805,13 +2381,20 @@ namespace svctl {
 		{
 			_ASSERTE(argc);					// Service name = argv[0]
 
-			// Create an instance of the derived service class and invoke ServiceMain() with specified context
-			std::shared_ptr<service> instance = std::make_shared<_derived>();
-			instance->Main(static_cast<int>(argc), argv, context);
+			// Create an instance of the derived service class, or take a prewarmed one, and invoke ServiceMain() with specified context
+			uint32_t attempt = 0;
+			while(true) {
+
+				std::shared_ptr<service> instance = instance_pool<_derived>::Get().AcquireShared();
+				instance->Main(static_cast<int>(argc), argv, context);
 
-			// If the service opted for shared_ptr, there isn't much that can be done to force the destructor
-			// to be called if it leaks references to itself; but this can be asserted in DEBUG builds ...
-			_ASSERTE(instance.use_count() == 1);
+				// If the service opted for shared_ptr, there isn't much that can be done to force the destructor
+				// to be called if it leaks references to itself; but this can be asserted in DEBUG builds ...
+				_ASSERTE(instance.use_count() == 1);
+
+				// An instance that aborted is replaced in place when in-process recovery is enabled
+				if(!Recover(std::move(instance), argv[0], context, attempt)) break;
+			}
 		}
 
 		// LocalMain (unique_ptr)
@@ -824,16 +2407,51 @@ namespace svctl {
 		{
 			_ASSERTE(argc);					// Service name = argv[0]
 
-			// Create an instance of the derived service class and invoke ServiceMain() with specified context
-			std::unique_ptr<service> instance = std::make_unique<_derived>();
-			instance->Main(static_cast<int>(argc), argv, context);
+			// Create an instance of the derived service class, or take a prewarmed one, and invoke ServiceMain() with specified context
+			uint32_t attempt = 0;
+			while(true) {
+
+				std::unique_ptr<service> instance = instance_pool<_derived>::Get().Acquire();
+				instance->Main(static_cast<int>(argc), argv, context);
+
+				// An instance that aborted is replaced in place when in-process recovery is enabled
+				if(!Recover(std::move(instance), argv[0], context, attempt)) break;
+			}
 		}
 
+		// MarkPhase
+		//
+		// Marks the beginning of a lifecycle phase; can be used to break OnStart() down into sub-phases
+		void MarkPhase(const tchar_t* phase);
+
 		// OnStart
 		//
 		// Invoked when the service is started; must be implemented in the service
 		virtual void OnStart(int argc, LPTSTR* argv) = 0;
 
+		// OnPauseGateOverrun
+		//
+		// Invoked when registered worker threads have not parked at the pause gate before the
+		// timeout expired; SERVICE_PAUSED is reported anyway.  Default does nothing
+		virtual void OnPauseGateOverrun(uint32_t unparked, uint32_t timeout);
+
+		// OnPreShutdownFlushed
+		//
+		// Invoked when the PRESHUTDOWN flush has completed or its budget has expired; default does nothing
+		virtual void OnPreShutdownFlushed(uint64_t flushed, uint64_t abandoned, uint32_t elapsed);
+
+		// OnStopHandlerOverrun
+		//
+		// Invoked when a grouped Stop handler is still running when the group deadline expires;
+		// the handler is still waited for.  Default does nothing
+		virtual void OnStopHandlerOverrun(const tchar_t* name, uint32_t group, uint32_t deadline);
+
+		// OnProgressStalled
+		//
+		// Invoked when explicit progress has been reported during a pending status but no further
+		// progress has been reported before the wait hint expired; default does nothing
+		virtual void OnProgressStalled(ServiceStatus status, uint32_t step, uint32_t total);
+
 		// OpenParameterStore
 		//
 		// Opens the parameter store; uses registry if not overriden in derived class
@@ -844,11 +2462,43 @@ namespace svctl {
 		// Pauses the service
 		DWORD Pause(void);
 
+		// RegisterFlush
+		//
+		// Registers a function to flush buffered data when PRESHUTDOWN is received; the remaining budget is
+		// split across the flushes by priority and estimated size.  Returns a cookie for UnregisterFlush
+		uint32_t RegisterFlush(uint32_t priority, flush_estimate_func estimate, flush_func flush);
+
 		// ReloadParameters
 		//
 		// Reloads all of the bound service parameter values
 		void ReloadParameters(void);
 
+		// RetainListener
+		//
+		// Hands a listening socket created by the service over to the service host, which keeps it open so
+		// that connections queue in its backlog while the service is restarted
+		void RetainListener(const tchar_t* name, uintptr_t socket);
+
+		// ReportProgress
+		//
+		// Reports explicit progress during a pending status, optionally with a new wait hint in
+		// milliseconds.  Once progress has been reported the checkpoint is no longer incremented
+		// automatically for the remainder of the pending status
+		void ReportProgress(uint32_t step, uint32_t total) { ReportProgress(step, total, 0); }
+		void ReportProgress(uint32_t step, uint32_t total, uint32_t waithint);
+
+		// SaveFlightRecorder
+		//
+		// Saves a binary dump of the flight recorder to the parameter store.  Can be bound to a
+		// custom control code in the service's CONTROL_HANDLER_MAP
+		void SaveFlightRecorder(void);
+
+		// SaveParameter
+		//
+		// Saves a named value to the parameter store; uses registry if not overriden in derived class.
+		// The default throws ERROR_NOT_SUPPORTED unless the default OpenParameterStore opened the store
+		virtual void SaveParameter(void* handle, const tchar_t* name, ServiceParameterFormat format, const void* buffer, size_t length);
+
 		// ServiceMain (shared_ptr)
 		//
 		// Service entry point, specific for the derived class object.  Enabled if the service class derives
@@ -861,15 +2511,22 @@ namespace svctl {
 
 			// When running as a regular service, the process type is read from the registry, the standard Win32
 			// service API functions are used for registration and status reporting, and parameters are dynamic
-			service_context context = { GetServiceProcessType(argv[0]), ::RegisterServiceCtrlHandlerEx, ::SetServiceStatus, nullptr, nullptr, nullptr };
+			service_context context = { GetServiceProcessType(argv[0]), ::RegisterServiceCtrlHandlerEx, ::SetServiceStatus, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, &GetServiceDependencies(), &GetShutdownBroadcaster(), nullptr, &GetListenerRegistry() };
+
+			// Create an instance of the derived service class, or take a prewarmed one, and invoke ServiceMain()
+			uint32_t attempt = 0;
+			while(true) {
 
-			// Create an instance of the derived service class and invoke ServiceMain()
-			std::shared_ptr<service> instance = std::make_shared<_derived>();
-			instance->Main(static_cast<int>(argc), argv, context);
+				std::shared_ptr<service> instance = instance_pool<_derived>::Get().AcquireShared();
+				instance->Main(static_cast<int>(argc), argv, context);
 
-			// If the service opted for shared_ptr, there isn't much that can be done to force the destructor
-			// to be called if it leaks references to itself; but this can be asserted in DEBUG builds ...
-			_ASSERTE(instance.use_count() == 1);
+				// If the service opted for shared_ptr, there isn't much that can be done to force the destructor
+				// to be called if it leaks references to itself; but this can be asserted in DEBUG builds ...
+				_ASSERTE(instance.use_count() == 1);
+
+				// An instance that aborted is replaced in place when in-process recovery is enabled
+				if(!Recover(std::move(instance), argv[0], context, attempt)) break;
+			}
 		}
 
 		// ServiceMain (unique_ptr)
@@ -884,11 +2541,18 @@ namespace svctl {
 
 			// When running as a regular service, the process type is read from the registry, the standard Win32
 			// service API functions are used for registration and status reporting, and parameters are dynamic
-			service_context context = { GetServiceProcessType(argv[0]), ::RegisterServiceCtrlHandlerEx, ::SetServiceStatus, nullptr, nullptr, nullptr };
+			service_context context = { GetServiceProcessType(argv[0]), ::RegisterServiceCtrlHandlerEx, ::SetServiceStatus, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, &GetServiceDependencies(), &GetShutdownBroadcaster(), nullptr, &GetListenerRegistry() };
 
-			// Create an instance of the derived service class and invoke ServiceMain()
-			std::unique_ptr<service> instance = std::make_unique<_derived>();
-			instance->Main(static_cast<int>(argc), argv, context);
+			// Create an instance of the derived service class, or take a prewarmed one, and invoke ServiceMain()
+			uint32_t attempt = 0;
+			while(true) {
+
+				std::unique_ptr<service> instance = instance_pool<_derived>::Get().Acquire();
+				instance->Main(static_cast<int>(argc), argv, context);
+
+				// An instance that aborted is replaced in place when in-process recovery is enabled
+				if(!Recover(std::move(instance), argv[0], context, attempt)) break;
+			}
 		}
 
 		// Stop
@@ -897,35 +2561,238 @@ namespace svctl {
 		DWORD Stop(void) { return Stop(ERROR_SUCCESS, ERROR_SUCCESS); }
 		DWORD Stop(DWORD win32exitcode, DWORD serviceexitcode);
 
+		// SubmitOnControl
+		//
+		// Queues a one-shot task to the Executor the next time the specified control has been
+		// processed by the service.  Pause tasks run once SERVICE_PAUSED has been reported, on a
+		// thread of their own since the Executor is paused.  Cannot be used with Interrogate
+		void SubmitOnControl(ServiceControl control, task_func task);
+
+		// SubmitWarmup
+		//
+		// Registers a warm-up task.  Tasks registered from OnStart() are queued to the Executor once
+		// SERVICE_RUNNING has been reported; tasks registered afterwards are queued immediately
+		void SubmitWarmup(task_func task);
+
+		// UnregisterFlush
+		//
+		// Removes a function registered with RegisterFlush
+		void UnregisterFlush(uint32_t cookie);
+
+		// WaitForWarm
+		//
+		// Waits for all warm-up tasks to complete; returns false on timeout or if the service is stopping
+		bool WaitForWarm(void) { return WaitForWarm(INFINITE); }
+		bool WaitForWarm(uint32_t timeout);
+
 		// Handlers
 		//
 		// Gets the collection of service-specific control handlers
 		__declspec(property(get=getHandlers)) const control_handler_table& Handlers;
 		virtual const control_handler_table& getHandlers(void) const;
 
+		// StopToken
+		//
+		// Gets a cancellation token that is cancelled when the service begins to stop
+		// or the system is shutting down; can be used to interrupt worker thread waits
+		__declspec(property(get=getStopToken)) cancellation_token StopToken;
+		cancellation_token getStopToken(void) const { return m_stopsource.Token; }
+
+		// Executor
+		//
+		// Gets the service-owned thread pool.  The pool is sized from the ThreadPoolSize parameter,
+		// paused while the service is paused and drained after the Stop handlers have been invoked
+		__declspec(property(get=getExecutor)) thread_pool& Executor;
+		thread_pool& getExecutor(void) { return m_executor; }
+
+		// PauseGate
+		//
+		// Gets the service pause gate.  The gate is closed when the service is paused, and
+		// PAUSE_PENDING is not completed until all registered worker threads have parked or
+		// PAUSE_GATE_TIMEOUT has elapsed
+		__declspec(property(get=getPauseGate)) pause_gate& PauseGate;
+		pause_gate& getPauseGate(void) { return m_pausegate; }
+
+		// Readiness
+		//
+		// Gets the current service readiness level
+		__declspec(property(get=getReadiness)) ServiceReadiness Readiness;
+		ServiceReadiness getReadiness(void);
+
+		// Timeline
+		//
+		// Gets a copy of the lifecycle phases marked since the service was started
+		__declspec(property(get=getTimeline)) std::vector<timeline_entry> Timeline;
+		std::vector<timeline_entry> getTimeline(void) { std::lock_guard<std::mutex> critsec(m_timelinelock); return m_timeline; }
+
 	private:
 
 		service(const service&)=delete;
 		service& operator=(const service&)=delete;
 
+		// ADAPTIVE_MINIMUM_SAMPLES
+		//
+		// Number of recorded transitions required before the wait hint is derived from history
+		const uint32_t ADAPTIVE_MINIMUM_SAMPLES = 3;
+
+		// ADAPTIVE_PERCENTILE
+		//
+		// Percentile of the recorded transition durations used to derive the wait hint
+		const uint32_t ADAPTIVE_PERCENTILE = 90;
+
+		// DEPENDENCY_TIMEOUT
+		//
+		// Default time allowed for the in-process services this service depends on to start, in milliseconds
+		const uint32_t DEPENDENCY_TIMEOUT = 120000;
+
+		// DEPENDENCY_TIMEOUT_PARAMETER
+		//
+		// Name of the parameter used to override the in-process dependency timeout
+		const tchar_t* DEPENDENCY_TIMEOUT_PARAMETER = _T("DependencyTimeout");
+
+		// FLIGHT_RECORDER_PARAMETER
+		//
+		// Name of the binary parameter the flight recorder is saved to
+		const tchar_t* FLIGHT_RECORDER_PARAMETER = _T("FlightRecorder");
+
+		// MAXIMUM_RECOVERY_DELAY
+		//
+		// Longest delay before an aborted service is restarted in place, in milliseconds
+		const uint32_t MAXIMUM_RECOVERY_DELAY = 60000;
+
+		// MINIMUM_CHECKPOINT_INTERVAL
+		//
+		// Shortest interval at which the pending status thread will report progress
+		const uint32_t MINIMUM_CHECKPOINT_INTERVAL = 250;
+
+		// MINIMUM_WAIT_HINT
+		//
+		// Shortest wait hint that will be derived from the recorded transition durations
+		const uint32_t MINIMUM_WAIT_HINT = 1000;
+
+		// MINIMUM_FLUSH_BUDGET
+		//
+		// Shortest budget that will be given to an individual PRESHUTDOWN flush
+		const uint32_t MINIMUM_FLUSH_BUDGET = 100;
+
+		// PAUSE_GATE_TIMEOUT
+		//
+		// Time allowed for the registered worker threads to park at the pause gate, in milliseconds
+		const uint32_t PAUSE_GATE_TIMEOUT = 30000;
+
 		// PENDING_CHECKPOINT_INTERVAL
 		//
 		// Interval at which the pending status thread will report progress
 		const uint32_t PENDING_CHECKPOINT_INTERVAL = 1000;
 
+		// PRESHUTDOWN_BUDGET
+		//
+		// Default amount of time to allow the PRESHUTDOWN flush, in milliseconds
+		const uint32_t PRESHUTDOWN_BUDGET = 10000;
+
+		// PRESHUTDOWN_TIMEOUT_PARAMETER
+		//
+		// Name of the parameter used to override the PRESHUTDOWN flush budget
+		const tchar_t* PRESHUTDOWN_TIMEOUT_PARAMETER = _T("PreShutdownTimeout");
+
 		// PENDING_WAIT_HINT
 		//
 		// Standard wait hint used when a pending status has been set
 		const uint32_t PENDING_WAIT_HINT = 2000;
 
+		// RECOVERY_ATTEMPTS_PARAMETER
+		//
+		// Name of the parameter used to enable in-process recovery; number of consecutive attempts
+		const tchar_t* RECOVERY_ATTEMPTS_PARAMETER = _T("RecoveryAttempts");
+
+		// RECOVERY_CLEANUP_TIMEOUT
+		//
+		// Time allowed for an aborted service instance to be destroyed before it's abandoned
+		const uint32_t RECOVERY_CLEANUP_TIMEOUT = 5000;
+
+		// RECOVERY_DELAY
+		//
+		// Default delay before the first in-process recovery attempt, in milliseconds
+		const uint32_t RECOVERY_DELAY = 1000;
+
+		// RECOVERY_DELAY_PARAMETER
+		//
+		// Name of the parameter used to override the delay before the first recovery attempt
+		const tchar_t* RECOVERY_DELAY_PARAMETER = _T("RecoveryDelay");
+
+		// RECOVERY_RESET_INTERVAL
+		//
+		// Time a service instance has to run before its failure is no longer a consecutive one
+		const uint32_t RECOVERY_RESET_INTERVAL = 60000;
+
 		// STARTUP_WAIT_HINT
 		//
 		// Wait hint used during the initial service START_PENDING status
 		const uint32_t STARTUP_WAIT_HINT = 5000;
 
+		// THREADPOOL_SIZE_PARAMETER
+		//
+		// Name of the parameter used to size the service thread pool
+		const tchar_t* THREADPOOL_SIZE_PARAMETER = _T("ThreadPoolSize");
+
+		// TRANSITION_HISTORY_PARAMETER
+		//
+		// Name of the parameter used to persist the transition duration history
+		const tchar_t* TRANSITION_HISTORY_PARAMETER = _T("TransitionHistory");
+
+		// abort_exception
+		//
+		// Thrown by Abort() to unwind the calling thread when in-process recovery is enabled
+		struct abort_exception {};
+
+		// control_counters
+		//
+		// Statistics recorded for a service control code
+		struct control_counters
+		{
+			std::atomic<uint64_t>	Invocations;	// Number of times the control was received
+			std::atomic<uint64_t>	Errors;			// Number of non-ERROR_SUCCESS results
+			latency_histogram		HandlerTime;	// Time spent processing the control
+			latency_histogram		LockWait;		// Time spent waiting for the status lock
+
+			control_counters() : Invocations(0), Errors(0) {}
+		};
+
+		// flusher
+		//
+		// PRESHUTDOWN flush registration
+		struct flusher
+		{
+			uint32_t				Priority;		// Flush priority
+			flush_estimate_func		Estimate;		// Size estimate function
+			flush_func				Flush;			// Flush function
+		};
+
+		// progress
+		//
+		// Explicit progress reported during a pending status
+		struct progress
+		{
+			uint32_t	Sequence;			// Incremented each time progress is reported
+			uint32_t	Step;				// Current step
+			uint32_t	Total;				// Total number of steps
+			uint32_t	WaitHint;			// Wait hint for the next step, or zero
+		};
+
+		// transition_history
+		//
+		// Durations of the most recent start, stop, pause and continue transitions.  This is
+		// persisted as a binary parameter, the layout cannot change without renaming it
+		struct transition_history
+		{
+			uint32_t	Count[4];			// Total number of recorded transitions
+			uint32_t	Durations[4][16];	// Circular buffers of durations in milliseconds
+		};
+
 		// Abort
 		//
-		// Causes an abnormal termination of the service
+		// Causes an abnormal termination of the service; unwinds the calling thread instead of
+		// hanging it when in-process recovery is enabled and the thread entered via Unwindable()
 		void Abort(std::exception_ptr exception);
 
 		// ControlHandler
@@ -933,11 +2800,77 @@ namespace svctl {
 		// Service control request handler method
 		DWORD ControlHandler(ServiceControl control, DWORD eventtype, void* eventdata);
 
+		// DispatchControl
+		//
+		// Dispatches a service control request; sets acquired once the status lock is held
+		DWORD DispatchControl(ServiceControl control, DWORD eventtype, void* eventdata, std::chrono::steady_clock::time_point& acquired);
+
+		// DumpTimeline
+		//
+		// Writes the lifecycle timeline to the debugger output
+		void DumpTimeline(void);
+
+		// GetControlCounters
+		//
+		// Gets the statistics for a service control code, creating them if necessary
+		control_counters* GetControlCounters(ServiceControl control);
+
+		// GetCheckpointInterval
+		//
+		// Derives the automatic checkpoint interval from a pending status wait hint
+		uint32_t GetCheckpointInterval(uint32_t waithint) const;
+
+		// GetTransitionIndex (static)
+		//
+		// Gets the transition history index for a pending status, or -1
+		static int GetTransitionIndex(ServiceStatus status);
+
+		// GetWaitHint
+		//
+		// Derives the wait hint for a pending status from the transition history
+		uint32_t GetWaitHint(ServiceStatus status) const;
+
+		// InvokeStopGroup
+		//
+		// Invokes a group of Stop handlers in parallel
+		void InvokeStopGroup(uint32_t group, const std::vector<const control_handler*>& handlers);
+
+		// InvokeStopHandlers
+		//
+		// Invokes all of the ungrouped and grouped Stop handlers
+		void InvokeStopHandlers(void);
+
 		// ServiceMain
 		//
 		// Service entry point
 		void Main(int argc, tchar_t** argv, const service_context& context);
 
+		// PreShutdownFlush
+		//
+		// Runs the registered PRESHUTDOWN flush functions in parallel within the budget
+		void PreShutdownFlush(void);
+
+		// QueueWarmup
+		//
+		// Queues a single warm-up task to the Executor
+		void QueueWarmup(task_func task);
+
+		// RecordTransition
+		//
+		// Records the duration of a completed transition; the history is saved by SaveTransitionHistory
+		void RecordTransition(ServiceStatus status, uint32_t duration);
+
+		// Recover (static)
+		//
+		// Replaces an aborted service instance when in-process recovery is enabled; returns true if
+		// a new instance of the service should be started
+		static bool Recover(std::shared_ptr<service> instance, const tchar_t* servicename, const service_context& context, uint32_t& attempt);
+
+		// SaveTransitionHistory
+		//
+		// Saves the transition history to the parameter store if it has changed
+		void SaveTransitionHistory(void);
+
 		// SetNonPendingStatus
 		//
 		// Sets a non-pending status
@@ -956,6 +2889,16 @@ namespace svctl {
 		void SetStatus(ServiceStatus status, uint32_t win32exitcode) { SetStatus(status, win32exitcode, ERROR_SUCCESS); }
 		void SetStatus(ServiceStatus status, uint32_t win32exitcode, uint32_t serviceexitcode);
 
+		// StartWarmup
+		//
+		// Queues the warm-up tasks registered during OnStart() to the Executor
+		void StartWarmup(void);
+
+		// SubmitContinuations
+		//
+		// Queues the one-shot tasks registered for a control to the Executor
+		void SubmitContinuations(ServiceControl control);
+
 		// TrySetStatus
 		//
 		// Sets a new service status, does not allow exceptions to propogate
@@ -963,12 +2906,192 @@ namespace svctl {
 		bool TrySetStatus(ServiceStatus status, uint32_t win32exitcode) { return TrySetStatus(status, win32exitcode, ERROR_SUCCESS); }
 		bool TrySetStatus(ServiceStatus status, uint32_t win32exitcode, uint32_t serviceexitcode);
 
+		// Unwindable
+		//
+		// Invokes a function that Abort() can unwind; returns false if the service aborted
+		bool Unwindable(std::function<void(void)> func);
+
+		// WaitForDependencies
+		//
+		// Waits for the in-process services this service depends on to be running
+		bool WaitForDependencies(void);
+
 		// AcceptedControls
 		//
 		// Gets what control codes the service will accept
 		__declspec(property(get=getAcceptedControls)) DWORD AcceptedControls;
 		DWORD getAcceptedControls(void);
 
+		// m_abortcode
+		//
+		// Exit code of an abort that unwound for in-process recovery
+		DWORD m_abortcode = ERROR_SUCCESS;
+
+		// m_aborted
+		//
+		// Flag set when the service aborted and unwound for in-process recovery
+		bool m_aborted = false;
+
+		// m_continuations
+		//
+		// One-shot tasks to be queued when a control has been processed
+		std::multimap<ServiceControl, task_func> m_continuations;
+
+		// m_continuationslock
+		//
+		// Synchronization object for the one-shot control task collection
+		std::mutex m_continuationslock;
+
+		// m_controlcounters
+		//
+		// Statistics for each service control code, created on first use
+		std::atomic<control_counters*> m_controlcounters[256] = {};
+
+		// m_dependencies
+		//
+		// In-process dependency tracker provided by the service host, if any
+		dependency_tracker* m_dependencies = nullptr;
+
+		// m_dependencytimeout
+		//
+		// Time allowed for the in-process services this service depends on to start
+		uint32_t m_dependencytimeout = DEPENDENCY_TIMEOUT;
+
+		// m_dependencywait
+		//
+		// Set while Main() is waiting for in-process dependencies; protected by m_statuslock
+		bool m_dependencywait = false;
+
+		// m_executor
+		//
+		// Service thread pool
+		thread_pool m_executor;
+
+		// m_flightrecorder
+		//
+		// Flight recorder owned by the service; used unless the host provides one
+		flight_recorder m_flightrecorder;
+
+		// m_flushers
+		//
+		// Registered PRESHUTDOWN flush functions
+		std::map<uint32_t, flusher> m_flushers;
+
+		// m_flushexecutor
+		//
+		// Thread pool dedicated to the PRESHUTDOWN flush functions, one worker per flush
+		thread_pool m_flushexecutor;
+
+		// m_flusherslock
+		//
+		// Synchronization object for the PRESHUTDOWN flush functions
+		std::mutex m_flusherslock;
+
+		// m_history
+		//
+		// Transition duration history; protected by m_statuslock
+		transition_history m_history = transition_history();
+
+		// m_historydirty
+		//
+		// Flag indicating that the transition history has changed since it was saved; protected by m_statuslock
+		bool m_historydirty = false;
+
+		// m_listeners
+		//
+		// Listening socket registry provided by the service host, if any
+		listener_registry* m_listeners = nullptr;
+
+		// m_paramhandle
+		//
+		// Parameter store handle; protected by m_paramstorelock
+		void* m_paramhandle = nullptr;
+
+		// m_paramstorelock
+		//
+		// Synchronization object for writes to the parameter store; never acquired before m_statuslock
+		std::mutex m_paramstorelock;
+
+		// m_paramsaver
+		//
+		// Function used to save a parameter to the parameter store
+		save_parameter_func m_paramsaver;
+
+		// m_nextflusher
+		//
+		// Next PRESHUTDOWN flush function cookie; protected by m_flusherslock
+		uint32_t m_nextflusher = 1;
+
+		// m_pauseexecutor
+		//
+		// Single worker thread pool for PAUSE continuations, which cannot run on the paused Executor
+		thread_pool m_pauseexecutor;
+
+		// m_pausegate
+		//
+		// Pause gate for service worker threads
+		pause_gate m_pausegate;
+
+		// m_preshutdownbudget
+		//
+		// Amount of time to allow the PRESHUTDOWN flush, in milliseconds
+		uint32_t m_preshutdownbudget = PRESHUTDOWN_BUDGET;
+
+		// m_progress
+		//
+		// Most recently reported explicit progress for the current pending status
+		progress m_progress = progress();
+
+		// m_progressfunc
+		//
+		// Optional function used to report explicit progress to the service host
+		report_progress_func m_progressfunc;
+
+		// m_progresslock
+		//
+		// Synchronization object for explicit progress
+		std::mutex m_progresslock;
+
+		// m_progresssignal
+		//
+		// Signal used to wake the pending status thread when progress is reported
+		signal<signal_type::AutomaticReset> m_progresssignal;
+
+		// m_recorder
+		//
+		// Flight recorder events are written to
+		flight_recorder* m_recorder = &m_flightrecorder;
+
+		// m_recoveryattempts
+		//
+		// Number of consecutive in-process recovery attempts; zero if disabled
+		uint32_t m_recoveryattempts = 0;
+
+		// m_recoverydelay
+		//
+		// Delay before the first in-process recovery attempt, doubled for each consecutive attempt
+		uint32_t m_recoverydelay = RECOVERY_DELAY;
+
+		// m_registrystore
+		//
+		// Flag indicating that the parameter store was opened by the default OpenParameterStore
+		bool m_registrystore = false;
+
+		// m_runningstart
+		//
+		// Time at which SERVICE_RUNNING was first reported; unset if it never was
+		std::chrono::steady_clock::time_point m_runningstart;
+
+		// m_servicename
+		//
+		// Name of the service, as provided by the service host
+		tstring m_servicename;
+
+		// m_shutdown
+		//
+		// Optional process-wide broadcaster of SHUTDOWN and PRESHUTDOWN
+		shutdown_broadcaster* m_shutdown = nullptr;
+
 		// m_status
 		//
 		// Current service status
@@ -979,30 +3102,85 @@ namespace svctl {
 		// Holds any exception thrown by a status worker thread
 		std::exception_ptr m_statusexception;
 
-		// m_statusfunc
+		// m_statusfunc
+		//
+		// Function pointer used to report an updated service status
+		report_status_func m_statusfunc;
+ 
+		// m_statuslock;
+		//
+		// Synchronization object for status updates
+		named_recursive_mutex m_statuslock { _T("service::m_statuslock") };
+
+		// m_statussignal
+		//
+		// Signal (event) object used to stop a pending status thread
+		signal<signal_type::ManualReset> m_statussignal;
+
+		// m_statusworker
+		//
+		// Pending status worker thread
+		std::thread m_statusworker;
+
+		// m_stopsignal
+		//
+		// Signal indicating that SERVICE_CONTROL_STOP has been triggered
+		signal<signal_type::ManualReset> m_stopsignal;
+
+		// m_stopsource
+		//
+		// Cancellation source for the StopToken property
+		cancellation_source m_stopsource;
+
+		// m_timeline
+		//
+		// Lifecycle phases marked since the service was started
+		std::vector<timeline_entry> m_timeline;
+
+		// m_timelinefunc
+		//
+		// Optional function to report lifecycle phases to the service host
+		report_phase_func m_timelinefunc;
+
+		// m_timelinelock
+		//
+		// Synchronizes access to the lifecycle timeline
+		std::mutex m_timelinelock;
+
+		// m_timelinestart
+		//
+		// Time at which the service was started
+		std::chrono::steady_clock::time_point m_timelinestart;
+
+		// m_transitionstart
+		//
+		// Time at which the current pending status was set
+		std::chrono::steady_clock::time_point m_transitionstart;
+
+		// m_warmsignal
 		//
-		// Function pointer used to report an updated service status
-		report_status_func m_statusfunc;
- 
-		// m_statuslock;
+		// Signal set when there are no outstanding warm-up tasks
+		signal<signal_type::ManualReset> m_warmsignal;
+
+		// m_warmupcount
 		//
-		// Synchronization object for status updates
-		std::recursive_mutex m_statuslock;
+		// Number of outstanding warm-up tasks; protected by m_warmuplock
+		uint32_t m_warmupcount = 0;
 
-		// m_statussignal
+		// m_warmuplock
 		//
-		// Signal (event) object used to stop a pending status thread
-		signal<signal_type::ManualReset> m_statussignal;
+		// Synchronization object for the warm-up tasks
+		std::mutex m_warmuplock;
 
-		// m_statusworker
+		// m_warmupstarted
 		//
-		// Pending status worker thread
-		std::thread m_statusworker;
+		// Flag indicating that warm-up tasks are being queued to the Executor
+		std::atomic<bool> m_warmupstarted { false };
 
-		// m_stopsignal
+		// m_warmuptasks
 		//
-		// Signal indicating that SERVICE_CONTROL_STOP has been triggered
-		signal<signal_type::ManualReset> m_stopsignal;
+		// Warm-up tasks registered before SERVICE_RUNNING was reported
+		std::vector<task_func> m_warmuptasks;
 	};
 
 	// svctl::service_harness
@@ -1011,7 +3189,67 @@ namespace svctl {
 	class service_harness
 	{
 	public:
-	
+
+		// svctl::service_harness::progress
+		//
+		// Explicit progress reported by the service during a pending status
+		struct progress
+		{
+			ServiceStatus	Status;			// Pending status the progress was reported for
+			uint32_t		Step;			// Reported step
+			uint32_t		Total;			// Reported total number of steps
+			uint32_t		WaitHint;		// Wait hint reported to the SCM
+			uint32_t		Elapsed;		// Milliseconds since the service was started
+		};
+
+		// svctl::service_harness::console_statistics
+		//
+		// Statistics for console control events forwarded to the service; latencies are in microseconds
+		struct console_statistics
+		{
+			uint64_t		Events;			// Number of console control events forwarded
+			uint64_t		Failures;		// Number of forwarded controls that did not return ERROR_SUCCESS
+			uint64_t		LatencyP50;		// Median time from the console event to the handler returning
+			uint64_t		LatencyP99;		// 99th percentile time from the console event to the handler returning
+			uint64_t		LatencyMax;		// Longest time from the console event to the handler returning
+		};
+
+		// svctl::service_harness::violation_type
+		//
+		// Service control manager rule broken by the service while in strict mode
+		enum class violation_type
+		{
+			IllegalTransition		= 1,		// Status change that is not allowed from the current status
+			WaitHintExpired			= 2,		// Pending status checkpoint not advanced within the wait hint
+			HandlerTimeout			= 3,		// Control handler did not return within the time limit
+		};
+
+		// svctl::service_harness::violation
+		//
+		// Service control manager rule violation detected while in strict mode
+		struct violation
+		{
+			violation_type	Type;			// Rule that was broken
+			ServiceControl	Control;		// Control being handled (HandlerTimeout only)
+			ServiceStatus	Status;			// Service status when the rule was broken
+			ServiceStatus	NewStatus;		// Status the service attempted to set (IllegalTransition only)
+			uint32_t		Elapsed;		// Milliseconds taken by the handler or since the last checkpoint
+			uint32_t		Limit;			// Milliseconds allowed by the handler limit or wait hint
+			tstring			Phase;			// Last lifecycle phase marked by the service
+		};
+
+		// svctl::service_harness::recovery
+		//
+		// In-process recovery of the service after it aborted
+		struct recovery
+		{
+			DWORD			ExitCode;		// Exit code of the failure
+			uint32_t		Attempt;		// Consecutive recovery attempt
+			uint32_t		Delay;			// Milliseconds waited before the new instance was started
+			bool			Recovered;		// Set once the service was running again
+			uint32_t		Elapsed;		// Milliseconds from the failure until the service was running again
+		};
+
 		// Constructor / Destructor
 		service_harness();
 		virtual ~service_harness();
@@ -1021,6 +3259,34 @@ namespace svctl {
 		// Sends ServiceControl::Continue and waits for ServiceStatus::Running
 		void Continue(void);
 
+		// DisableConsoleControls
+		//
+		// Stops forwarding console control events to the service
+		void DisableConsoleControls(void);
+
+		// DisableStrictMode
+		//
+		// Stops enforcing the service control manager timing and status transition rules
+		void DisableStrictMode(void);
+
+		// EnableConsoleControls
+		//
+		// Forwards console control events (Ctrl+C, Ctrl+Break, console close, system shutdown)
+		// to the service as service controls; only one harness can receive them at a time
+		void EnableConsoleControls(void);
+
+		// EnableStrictMode
+		//
+		// Enforces the service control manager timing and status transition rules; violations
+		// fail the harness operation and are recorded in the Violations collection
+		void EnableStrictMode(void) { EnableStrictMode(HANDLER_TIMEOUT, 0); }
+		void EnableStrictMode(uint32_t handlertimeout, uint32_t waithintgrace);
+
+		// MapConsoleEvent
+		//
+		// Changes the service control sent in response to a console control event
+		void MapConsoleEvent(DWORD ctrltype, ServiceControl control);
+
 		// Pause
 		//
 		// Sends ServiceControl::Pause and waits for ServiceStatus::Paused
@@ -1128,11 +3394,59 @@ namespace svctl {
 		__declspec(property(get=getCanStop)) bool CanStop;
 		bool getCanStop(void);
 
+		// ConsoleStatistics
+		//
+		// Gets the statistics for console control events forwarded to the service
+		__declspec(property(get=getConsoleStatistics)) console_statistics ConsoleStatistics;
+		console_statistics getConsoleStatistics(void) const;
+
+		// FlightRecorder
+		//
+		// Gets a binary dump of the events recorded by the service's flight recorder
+		__declspec(property(get=getFlightRecorder)) std::vector<uint8_t> FlightRecorder;
+		std::vector<uint8_t> getFlightRecorder(void) const { return m_flightrecorder.Dump(); }
+
+		// Listeners
+		//
+		// Gets the registry of listening sockets provided to the service, standing in for the parent process
+		__declspec(property(get=getListeners)) listener_registry& Listeners;
+		listener_registry& getListeners(void) { return m_listeners; }
+
+		// LockStatistics
+		//
+		// Gets a snapshot of the statistics recorded for each named lock
+		__declspec(property(get=getLockStatistics)) std::vector<lock_statistics> LockStatistics;
+		std::vector<lock_statistics> getLockStatistics(void) const { return GetLockStatistics(); }
+
+		// Progress
+		//
+		// Gets a copy of the explicit progress reported by the service since it was started
+		__declspec(property(get=getProgress)) std::vector<progress> Progress;
+		std::vector<progress> getProgress(void) { std::lock_guard<named_mutex> critsec(m_statuslock); return m_progress; }
+
+		// Recoveries
+		//
+		// Gets a copy of the in-process recoveries of the service since it was started
+		__declspec(property(get=getRecoveries)) std::vector<recovery> Recoveries;
+		std::vector<recovery> getRecoveries(void) { std::lock_guard<named_mutex> critsec(m_statuslock); return m_recoveries; }
+
+		// Timeline
+		//
+		// Gets a copy of the lifecycle phases marked by the service since it was started
+		__declspec(property(get=getTimeline)) std::vector<timeline_entry> Timeline;
+		std::vector<timeline_entry> getTimeline(void) { std::lock_guard<named_mutex> critsec(m_statuslock); return m_timeline; }
+
 		// Status
 		//
 		// Gets a copy of the current service status
 		__declspec(property(get=getStatus)) SERVICE_STATUS Status;
-		SERVICE_STATUS getStatus(void) { std::lock_guard<std::mutex> critsec(m_statuslock); return m_status; }
+		SERVICE_STATUS getStatus(void) { std::lock_guard<named_mutex> critsec(m_statuslock); return m_status; }
+
+		// Violations
+		//
+		// Gets a copy of the rule violations detected in strict mode since the service was started
+		__declspec(property(get=getViolations)) std::vector<violation> Violations;
+		std::vector<violation> getViolations(void) { std::lock_guard<named_mutex> critsec(m_statuslock); return m_violations; }
 
 	protected:
 
@@ -1146,6 +3460,11 @@ namespace svctl {
 		service_harness(const service_harness&)=delete;
 		service_harness& operator=(const service_harness&)=delete;
 
+		// HANDLER_TIMEOUT
+		//
+		// Time allowed by the service control manager for a control handler to return
+		const uint32_t HANDLER_TIMEOUT = 30000;
+
 		// parameter_compare
 		//
 		// Case-insensitive key comparison for the parameter collection
@@ -1177,6 +3496,41 @@ namespace svctl {
 		// Function invoked by the service to close parameter storage
 		void CloseParameterStoreFunc(void* handle);
 
+		// console_event
+		//
+		// Console control event queued for the console bridge thread
+		struct console_event
+		{
+			DWORD									CtrlType;		// Console control event type
+			std::chrono::steady_clock::time_point	Raised;			// Time the event was raised
+			signal<signal_type::ManualReset>*		Completed;		// Optional completion signal
+		};
+
+		// ConsoleControlHandler (static)
+		//
+		// HandlerRoutine registered with SetConsoleCtrlHandler
+		static BOOL WINAPI ConsoleControlHandler(DWORD ctrltype);
+
+		// CheckWaitHint
+		//
+		// Records a violation if the wait hint of a pending status has expired
+		bool CheckWaitHint(std::chrono::steady_clock::time_point now);
+
+		// ConsoleMain
+		//
+		// Entry point for the console bridge thread
+		void ConsoleMain(void);
+
+		// GetWaitHintDeadline
+		//
+		// Gets the time by which a pending status must advance its checkpoint
+		std::chrono::steady_clock::time_point GetWaitHintDeadline(void) const;
+
+		// IsLegalTransition (static)
+		//
+		// Determines if a service status change is allowed by the service control manager
+		static bool IsLegalTransition(ServiceStatus from, ServiceStatus to);
+
 		// LoadParameterFunc
 		//
 		// Function invoked by the service to load a parameter value
@@ -1192,6 +3546,31 @@ namespace svctl {
 		// Function invoked by the service to register it's control handler
 		SERVICE_STATUS_HANDLE RegisterHandlerFunc(LPCTSTR servicename, LPHANDLER_FUNCTION_EX handler, LPVOID context);
 
+		// ReportPhaseFunc
+		//
+		// Function invoked by the service to report a lifecycle phase
+		void ReportPhaseFunc(const tchar_t* phase, uint64_t offset);
+
+		// ReportProgressFunc
+		//
+		// Function invoked by the service to report explicit progress
+		void ReportProgressFunc(ServiceStatus status, uint32_t step, uint32_t total, uint32_t waithint);
+
+		// ReportRecoveryFunc
+		//
+		// Function invoked when the service is being restarted in place after it aborted
+		void ReportRecoveryFunc(DWORD exitcode, uint32_t attempt, uint32_t delay);
+
+		// RecordViolation
+		//
+		// Records a strict mode violation; must be called with m_statuslock held
+		void RecordViolation(violation_type type, ServiceControl control, ServiceStatus newstatus, uint32_t elapsed, uint32_t limit);
+
+		// SaveParameterFunc
+		//
+		// Function invoked by the service to save a parameter value
+		void SaveParameterFunc(void* handle, const tchar_t* name, ServiceParameterFormat format, const void* buffer, size_t length);
+
 		// ServiceControlAccepted (static)
 		//
 		// Checks a ServiceControl against a SERVICE_ACCEPTS_XXXX mask
@@ -1244,16 +3623,76 @@ namespace svctl {
 		// Final overload in the variadic chain for Start()
 		void Start(std::vector<tstring>& argvector);
 
+		// m_checkpointexpired
+		//
+		// Flag indicating that the current checkpoint has already exceeded its wait hint
+		bool m_checkpointexpired = false;
+
+		// m_checkpointtime
+		//
+		// Time at which the status last changed or its checkpoint last advanced
+		std::chrono::steady_clock::time_point m_checkpointtime;
+
+		// m_consolechanged
+		//
+		// Condition variable set when a console event is queued or the bridge is stopping
+		std::condition_variable m_consolechanged;
+
+		// m_consoleevents
+		//
+		// Console control events waiting to be forwarded to the service
+		std::deque<console_event> m_consoleevents;
+
+		// m_consolefailures
+		//
+		// Number of forwarded console controls that did not return ERROR_SUCCESS
+		std::atomic<uint64_t> m_consolefailures { 0 };
+
+		// m_consolelatency
+		//
+		// Time from each console event being raised to the service handler returning
+		latency_histogram m_consolelatency;
+
+		// m_consolelock
+		//
+		// Synchronization object for the console bridge
+		std::mutex m_consolelock;
+
+		// m_consolemap
+		//
+		// Service control sent for each console control event type
+		std::map<DWORD, ServiceControl> m_consolemap;
+
+		// m_consolestop
+		//
+		// Flag indicating that the console bridge thread should exit
+		bool m_consolestop = false;
+
+		// m_consolethread
+		//
+		// Console bridge thread
+		std::thread m_consolethread;
+
 		// m_context
 		//
-		// Context pointer registered for the service control handler
+		// Context pointer registered for the service control handler; protected by m_statuslock
 		void* m_context = nullptr;
 
+		// m_flightrecorder
+		//
+		// Flight recorder provided to the service
+		flight_recorder m_flightrecorder;
+
 		// m_handler
 		//
-		// Service control handler callback function pointer
+		// Service control handler callback function pointer; protected by m_statuslock
 		LPHANDLER_FUNCTION_EX m_handler = nullptr;
 
+		// m_listeners
+		//
+		// Listening sockets provided to the service
+		listener_registry m_listeners;
+
 		// m_mainthread
 		//
 		// Main service thread
@@ -1267,7 +3706,27 @@ namespace svctl {
 		// m_paramlock
 		//
 		// Parameter collection synchronization object
-		std::recursive_mutex m_paramlock;
+		named_recursive_mutex m_paramlock { _T("service_harness::m_paramlock") };
+
+		// m_progress
+		//
+		// Explicit progress reported by the service; protected by m_statuslock
+		std::vector<progress> m_progress;
+
+		// m_recoveries
+		//
+		// In-process recoveries of the service; protected by m_statuslock
+		std::vector<recovery> m_recoveries;
+
+		// m_recoverystart
+		//
+		// Time at which the most recent in-process recovery began
+		std::chrono::steady_clock::time_point m_recoverystart;
+
+		// m_started
+		//
+		// Time at which the service was started
+		std::chrono::steady_clock::time_point m_started;
 
 		// m_status
 		//
@@ -1277,12 +3736,42 @@ namespace svctl {
 		// m_statuschanged
 		//
 		// Condition variable set when service status has changed
-		std::condition_variable m_statuschanged;
+		named_condition_variable m_statuschanged;
 
 		// m_statuslock
 		//
 		// Critical section to serialize access to the SERVICE_STATUS
-		std::mutex m_statuslock;
+		named_mutex m_statuslock { _T("service_harness::m_statuslock") };
+
+		// m_statusreported
+		//
+		// Flag indicating that the service has reported a status since it was started
+		bool m_statusreported = false;
+
+		// m_strict
+		//
+		// Flag indicating that the service control manager rules are enforced
+		bool m_strict = false;
+
+		// m_strictgrace
+		//
+		// Additional time allowed beyond each wait hint in strict mode
+		uint32_t m_strictgrace = 0;
+
+		// m_strictlimit
+		//
+		// Time allowed for a control handler to return in strict mode
+		uint32_t m_strictlimit = HANDLER_TIMEOUT;
+
+		// m_timeline
+		//
+		// Lifecycle phases marked by the service; protected by m_statuslock
+		std::vector<timeline_entry> m_timeline;
+
+		// m_violations
+		//
+		// Rule violations detected in strict mode; protected by m_statuslock
+		std::vector<violation> m_violations;
 	};
 
 } // namespace svctl
@@ -1326,14 +3815,14 @@ private:
 public:
 
 	// Instance Constructors
-	ServiceControlHandler(ServiceControl control, void_handler func) :
-		control_handler(control), m_void_handler(std::bind(func, std::placeholders::_1)) {}
-	ServiceControlHandler(ServiceControl control, void_handler_ex func) :
-		control_handler(control), m_void_handler_ex(std::bind(func, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)) {}
-	ServiceControlHandler(ServiceControl control, result_handler func) :
-		control_handler(control), m_result_handler(std::bind(func, std::placeholders::_1)) {}
-	ServiceControlHandler(ServiceControl control, result_handler_ex func) :
-		control_handler(control), m_result_handler_ex(std::bind(func, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)) {}
+	ServiceControlHandler(ServiceControl control, void_handler func, const svctl::tchar_t* name = nullptr, uint32_t group = 0) :
+		control_handler(control, name, group), m_void_handler(std::bind(func, std::placeholders::_1)) {}
+	ServiceControlHandler(ServiceControl control, void_handler_ex func, const svctl::tchar_t* name = nullptr, uint32_t group = 0) :
+		control_handler(control, name, group), m_void_handler_ex(std::bind(func, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)) {}
+	ServiceControlHandler(ServiceControl control, result_handler func, const svctl::tchar_t* name = nullptr, uint32_t group = 0) :
+		control_handler(control, name, group), m_result_handler(std::bind(func, std::placeholders::_1)) {}
+	ServiceControlHandler(ServiceControl control, result_handler_ex func, const svctl::tchar_t* name = nullptr, uint32_t group = 0) :
+		control_handler(control, name, group), m_result_handler_ex(std::bind(func, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)) {}
 
 	// Destructor
 	virtual ~ServiceControlHandler()=default;
@@ -1398,7 +3887,11 @@ struct ServiceTableEntry : public svctl::service_table_entry
 {
 	// Instance constructors
 	ServiceTableEntry(const svctl::resstring& name) : 
-		service_table_entry(name, &svctl::service::ServiceMain<_derived>) {}
+		service_table_entry(name, &svctl::service::ServiceMain<_derived>, &svctl::service::LocalMain<_derived>) {}
+
+	ServiceTableEntry(const svctl::resstring& name, std::initializer_list<svctl::resstring> dependencies) :
+		service_table_entry(name, &svctl::service::ServiceMain<_derived>, &svctl::service::LocalMain<_derived>,
+		std::vector<svctl::tstring>(dependencies.begin(), dependencies.end())) {}
 };
 
 //-----------------------------------------------------------------------------
@@ -1424,6 +3917,12 @@ public:
 	// Inserts a new entry into the collection
 	void Add(const svctl::service_table_entry& item) { vector::push_back(item); }
 
+	// Count
+	//
+	// Gets the number of entries in the collection
+	__declspec(property(get=getCount)) size_t Count;
+	size_t getCount(void) const { return vector::size(); }
+
 	// Dispatch
 	//
 	// Dispatches the service table to the service control manager
@@ -1463,6 +3962,262 @@ private:
 	}
 };
 
+//-----------------------------------------------------------------------------
+// ::ServiceTableHarness
+//
+// Runs every service in a ServiceTable as a shared process service.  Controls are
+// delivered to the services through a single dispatcher thread, the same way the
+// service control manager delivers them to a shared service process
+
+class ServiceTableHarness
+{
+public:
+
+	// ServiceTableHarness::control_result
+	//
+	// Result of a control broadcast to a single service
+	struct control_result
+	{
+		svctl::tstring	Name;			// Name of the service
+		DWORD			Result;			// Result returned by the service's control handler
+		uint64_t		Elapsed;		// Microseconds from the broadcast to the handler returning
+	};
+
+	// ServiceTableHarness::dispatch_statistics
+	//
+	// Statistics for the controls dispatched to a single service; times are in microseconds
+	struct dispatch_statistics
+	{
+		svctl::tstring	Name;			// Name of the service
+		uint64_t		Controls;		// Number of controls dispatched to the service
+		uint64_t		DelayP50;		// Median time a control waited for the dispatcher
+		uint64_t		DelayP99;		// 99th percentile time a control waited for the dispatcher
+		uint64_t		DelayMax;		// Longest time a control waited for the dispatcher
+		uint64_t		HandlerP50;		// Median time taken by the service's control handler
+		uint64_t		HandlerP99;		// 99th percentile time taken by the service's control handler
+		uint64_t		HandlerMax;		// Longest time taken by the service's control handler
+	};
+
+	// Constructor / Destructor
+	explicit ServiceTableHarness(const ServiceTable& table);
+	~ServiceTableHarness();
+
+	// Array subscript operator
+	//
+	// Gets the harness for an individual service, to set parameters and query status
+	svctl::service_harness& operator[](const svctl::resstring& name);
+
+	// BroadcastControl
+	//
+	// Sends a control to every service and waits for all of them to process it
+	std::vector<control_result> BroadcastControl(ServiceControl control) { return BroadcastControl(control, 0, nullptr); }
+	std::vector<control_result> BroadcastControl(ServiceControl control, DWORD eventtype, void* eventdata);
+
+	// SendControl
+	//
+	// Sends a control to a single service through the dispatcher
+	DWORD SendControl(const svctl::resstring& name, ServiceControl control) { return SendControl(name, control, 0, nullptr); }
+	DWORD SendControl(const svctl::resstring& name, ServiceControl control, DWORD eventtype, void* eventdata);
+
+	// Start
+	//
+	// Starts every service in parallel and waits for all of them to reach ServiceStatus::Running
+	void Start(void);
+
+	// Stop
+	//
+	// Sends ServiceControl::Stop to every service and waits for all of them to stop
+	void Stop(void);
+
+	// WaitForStatus
+	//
+	// Waits for every service to reach the specified status
+	bool WaitForStatus(ServiceStatus status, uint32_t timeout = INFINITE);
+
+	// DispatchStatistics
+	//
+	// Gets the statistics for the controls dispatched to each service
+	__declspec(property(get=getDispatchStatistics)) std::vector<dispatch_statistics> DispatchStatistics;
+	std::vector<dispatch_statistics> getDispatchStatistics(void) const;
+
+	// Listeners
+	//
+	// Gets the registry of listening sockets shared by the services in the table
+	__declspec(property(get=getListeners)) svctl::listener_registry& Listeners;
+	svctl::listener_registry& getListeners(void) { return m_listeners; }
+
+	// ShutdownBroadcaster
+	//
+	// Gets the broadcaster of SHUTDOWN and PRESHUTDOWN to the services in the table
+	__declspec(property(get=getShutdownBroadcaster)) svctl::shutdown_broadcaster& ShutdownBroadcaster;
+	svctl::shutdown_broadcaster& getShutdownBroadcaster(void) { return m_broadcaster; }
+
+private:
+
+	ServiceTableHarness(const ServiceTableHarness&)=delete;
+	ServiceTableHarness& operator=(const ServiceTableHarness&)=delete;
+
+	// ServiceTableHarness::entry_harness
+	//
+	// Service harness that launches a service table entry as a shared process service
+	class entry_harness : public svctl::service_harness
+	{
+	public:
+
+		// Constructor / Destructor
+		entry_harness(svctl::local_main_func localmain, svctl::dependency_tracker* dependencies, svctl::shutdown_broadcaster* broadcaster, svctl::listener_registry* listeners) :
+			m_broadcaster(broadcaster), m_dependencies(dependencies), m_listeners(listeners), m_localmain(localmain) {}
+		virtual ~entry_harness()=default;
+
+	private:
+
+		entry_harness(const entry_harness&)=delete;
+		entry_harness& operator=(const entry_harness&)=delete;
+
+		// LaunchService (service_harness)
+		//
+		// Launches the service by invoking it's LocalMain entry point with a shared process context
+		virtual void LaunchService(int argc, LPTSTR* argv, const svctl::service_context& context);
+
+		// m_broadcaster
+		//
+		// Shutdown broadcaster shared by the services in the table
+		svctl::shutdown_broadcaster* const m_broadcaster;
+
+		// m_dependencies
+		//
+		// In-process dependency tracker shared by the services in the table
+		svctl::dependency_tracker* const m_dependencies;
+
+		// m_listeners
+		//
+		// Listening socket registry shared by the services in the table
+		svctl::listener_registry* const m_listeners;
+
+		// m_localmain
+		//
+		// Service LocalMain() entry point
+		const svctl::local_main_func m_localmain;
+	};
+
+	// ServiceTableHarness::entry
+	//
+	// Harness and dispatch statistics for a single service
+	struct entry
+	{
+		svctl::tstring					Name;			// Name of the service
+		std::unique_ptr<entry_harness>	Harness;		// Harness for the service
+		svctl::latency_histogram		Delay;			// Time controls waited for the dispatcher
+		svctl::latency_histogram		Handler;		// Time taken by the control handler
+	};
+
+	// ServiceTableHarness::pending_control
+	//
+	// Control waiting to be delivered by the dispatcher thread
+	struct pending_control
+	{
+		entry*									Target;			// Service to receive the control
+		ServiceControl							Control;		// Control code
+		DWORD									EventType;		// Control-specific event type
+		void*									EventData;		// Control-specific event data
+		std::chrono::steady_clock::time_point	Queued;			// Time the control was queued
+		std::promise<DWORD>						Result;			// Result of the control handler
+	};
+
+	// DispatcherMain
+	//
+	// Entry point for the dispatcher thread
+	void DispatcherMain(void);
+
+	// Find
+	//
+	// Locates a service entry by name
+	entry& Find(const svctl::tstring& name);
+
+	// QueueControl
+	//
+	// Queues a control for the dispatcher thread
+	std::future<DWORD> QueueControl(entry& target, ServiceControl control, DWORD eventtype, void* eventdata);
+
+	// m_broadcaster
+	//
+	// Shutdown broadcaster shared by the services in the table
+	svctl::shutdown_broadcaster m_broadcaster;
+
+	// m_controls
+	//
+	// Controls waiting to be delivered by the dispatcher thread
+	std::deque<std::unique_ptr<pending_control>> m_controls;
+
+	// m_controlschanged
+	//
+	// Condition variable set when a control is queued or the dispatcher is stopping
+	std::condition_variable m_controlschanged;
+
+	// m_controlslock
+	//
+	// Synchronization object for the dispatcher queue
+	std::mutex m_controlslock;
+
+	// m_dependencies
+	//
+	// In-process dependency tracker shared by the services in the table
+	svctl::dependency_tracker m_dependencies;
+
+	// m_dispatcher
+	//
+	// Dispatcher thread
+	std::thread m_dispatcher;
+
+	// m_dispatcherstop
+	//
+	// Flag indicating that the dispatcher thread should exit
+	bool m_dispatcherstop = false;
+
+	// m_listeners
+	//
+	// Listening socket registry shared by the services in the table; must outlive m_entries
+	svctl::listener_registry m_listeners;
+
+	// m_entries
+	//
+	// Harness for each service in the table
+	std::vector<std::unique_ptr<entry>> m_entries;
+};
+
+//-----------------------------------------------------------------------------
+// ::ServicePool<>
+//
+// Opt-in prewarming of service class instances, so that starting the service does not
+// have to wait for an expensive constructor
+
+template <class _service>
+class ServicePool
+{
+public:
+
+	// Disable
+	//
+	// Stops prewarming instances of the service class and destroys any that are waiting
+	static void Disable(void) { svctl::instance_pool<_service>::Get().Resize(0); }
+
+	// GetStatistics
+	//
+	// Gets a snapshot of the instance pool counters for the service class
+	static typename svctl::instance_pool<_service>::statistics GetStatistics(void) { return svctl::instance_pool<_service>::Get().Statistics; }
+
+	// Prewarm
+	//
+	// Keeps the specified number of instances of the service class constructed ahead of time
+	static void Prewarm(size_t count) { svctl::instance_pool<_service>::Get().Resize(count); }
+
+private:
+
+	ServicePool()=delete;
+	ServicePool(const ServicePool&)=delete;
+	ServicePool& operator=(const ServicePool&)=delete;
+};
+
 //-----------------------------------------------------------------------------
 // ::Service<>
 //
@@ -1534,12 +4289,20 @@ private:
 // map to compile without errors, however this method will never be called as this control
 // is blocked by the HandlerEx implementation.
 //
+// Stop handlers declared with STOP_GROUP_HANDLER_ENTRY are grouped; handlers in the same
+// group are invoked in parallel on the service thread pool, and groups are invoked in
+// ascending order after all of the ungrouped Stop handlers.  Group numbers start at one,
+// zero is rejected at compile time.  Deadlines are declared per group in a STOP_GROUP_MAP.
+//
 // Sample usage:
 //
 //	BEGIN_CONTROL_HANDLER_MAP(MyService)
 //		CONTROL_HANDLER_ENTRY(ServiceControl::Stop, OnStop)
 //		CONTROL_HANDLER_ENTRY(ServiceControl::ParamChange, OnParameterChange)
 //		CONTROL_HANDLER_ENTRY(200, OnMyCustomCommand)
+//		STOP_GROUP_HANDLER_ENTRY(1, OnStopListeners)
+//		STOP_GROUP_HANDLER_ENTRY(2, OnFlushJournal)
+//		STOP_GROUP_HANDLER_ENTRY(2, OnDropCaches)
 //	END_CONTROL_HANDLER_MAP()
 //
 #define BEGIN_CONTROL_HANDLER_MAP(_class) \
@@ -1551,7 +4314,10 @@ private:
 		std::make_unique<ServiceControlHandler<__control_map_class>>(ServiceControl::Interrogate, &__control_map_class::__null_handler##_class),
 
 #define CONTROL_HANDLER_ENTRY(_control, _func) \
-		std::make_unique<ServiceControlHandler<__control_map_class>>(static_cast<ServiceControl>(_control), &__control_map_class::_func),
+		std::make_unique<ServiceControlHandler<__control_map_class>>(static_cast<ServiceControl>(_control), &__control_map_class::_func, _T(#_func)),
+
+#define STOP_GROUP_HANDLER_ENTRY(_group, _func) \
+		std::make_unique<ServiceControlHandler<__control_map_class>>(ServiceControl::Stop, &__control_map_class::_func, _T(#_func), svctl::stop_group<_group>::value),
 
 #define END_CONTROL_HANDLER_MAP() \
 		}; \
@@ -1559,6 +4325,33 @@ private:
 		return table; \
 	}
 
+// STOP_GROUP_MAP
+//
+// Used to declare the GetStopGroupDeadline virtual function implementation for the service.
+// The deadline, in milliseconds, is the amount of time the group is expected to take; any
+// handler still running when it expires is reported via OnStopHandlerOverrun() but is still
+// waited for.  A group without an entry has no deadline, and a group can only be declared once
+//
+// Sample usage:
+//
+//	BEGIN_STOP_GROUP_MAP(MyService)
+//		STOP_GROUP_ENTRY(1, 5000)
+//		STOP_GROUP_ENTRY(2, 10000)
+//	END_STOP_GROUP_MAP()
+//
+#define BEGIN_STOP_GROUP_MAP(_class) \
+	virtual uint32_t GetStopGroupDeadline(uint32_t group) const \
+	{ \
+		switch(group) {
+
+#define STOP_GROUP_ENTRY(_group, _deadline) \
+		case svctl::stop_group<_group>::value: return _deadline;
+
+#define END_STOP_GROUP_MAP() \
+		} \
+		return 0; \
+	}
+
 // PARAMETER_MAP
 //
 // Used to declare the IterateParameters virtual function implementation for the service.
@@ -74,19 +74,30 @@ private:
 		UNREFERENCED_PARAMETER(argc);
 		UNREFERENCED_PARAMETER(argv);
 
-		m_worker = std::move(std::thread([=]() { 
-		
-			auto waitms = m_messageRate.Value;
-			while(WaitForSingleObject(m_signal, waitms) == WAIT_TIMEOUT)
-			{
-				// do stuff
-				auto message = m_message.Value;
-
-				// Parameter values are only changed when a ServiceControl::ParameterChange
-				// has been received; re-read the value from cached storage each loop in this case
-				waitms = m_messageRate.Value;
-			}
-		}));
+		// Rather than dedicating a thread to the message loop, each iteration schedules
+		// the next one as a delayed task on the service thread pool
+		Executor.SubmitAfter(m_messageRate.Value, [=]() { OnMessageTimer(); });
+	}
+
+	// OnMessageTimer
+	//
+	// Delayed task invoked at the interval specified by the MessageRate parameter
+	//
+	void OnMessageTimer(void)
+	{
+		// The stop token is triggered as soon as the service begins to stop; any delayed
+		// task that hasn't come due when the thread pool is drained is discarded
+		if(StopToken.IsCancellationRequested) return;
+
+		// do stuff
+		auto message = m_message.Value;
+
+		// Parameter values are only changed when a ServiceControl::ParameterChange
+		// has been received; re-read the value from cached storage each iteration.
+		// The service may have started to stop since the token was checked, in which
+		// case the thread pool refuses the delayed task
+		try { Executor.SubmitAfter(m_messageRate.Value, [=]() { OnMessageTimer(); }); }
+		catch(ServiceException&) { /* DO NOTHING */ }
 	}
 
 	// Service Control Handlers
@@ -103,9 +114,8 @@ private:
 	//
 	void OnStop(void)
 	{
-		m_signal.Set();
-		if(!m_worker.joinable()) throw ServiceException(E_UNEXPECTED);
-		m_worker.join();
+		// Nothing to do here; the service thread pool is drained automatically
+		// after all of the Stop handlers have been invoked
 	}
 
 	// PARAMETER_MAP
@@ -117,9 +127,6 @@ private:
 
 	DWordParameter m_messageRate { 1000 };
 	StringParameter m_message { _T("Hello from ParameterService\r\n") };
-
-	svctl::signal<svctl::signal_type::AutomaticReset> m_signal;
-	std::thread m_worker;
 };
 
 #endif	// __PARAMETERSERVICE_H_